@@ -0,0 +1,52 @@
+#ifndef ASSIGNMENT_1_MEMALLOC_CUSTOMALLOCATOR_H
+#define ASSIGNMENT_1_MEMALLOC_CUSTOMALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#include "mymalloc.h"
+
+/***
+ * Custom simple allocator based on Microsoft's example:
+ * https://learn.microsoft.com/en-us/cpp/standard-library/allocators?view=msvc-170
+ * @tparam T
+ */
+template <class T>
+struct CustomAllocator {
+    typedef T value_type;
+
+    CustomAllocator() noexcept {} //default ctor not required by C++ Standard Library
+
+    // A converting copy constructor:
+    template<class U> CustomAllocator(const CustomAllocator<U>&) noexcept {}
+    template<class U> bool operator==(const CustomAllocator<U>&) const noexcept {
+        return true;
+    }
+    template<class U> bool operator!=(const CustomAllocator<U>&) const noexcept {
+        return false;
+    }
+
+    T* allocate(const size_t n) const {
+        if (n == 0) {
+            return nullptr;
+        }
+        if (n > static_cast<size_t>(-1) / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+
+        // Use custom memory allocator
+        void* const pv = allocator::malloc(n * sizeof(T));
+        if (!pv) {
+            throw std::bad_alloc();
+        }
+
+        return static_cast<T*>(pv);
+    }
+
+    void deallocate(T* const p, size_t) const noexcept {
+        allocator::free(p);
+    }
+};
+
+#endif
@@ -4,10 +4,17 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <chrono>
+#include <memory>
 #include <optional>
 
 #include "Common.hpp"
+#include "Doorbell.hpp"
 #include "Protocol.hpp"
+#include "ShmTable.hpp"
+#include "Trace.hpp"
 
 template <typename Key, typename Value>
 class Client {
@@ -19,39 +26,462 @@ class Client {
 public:
 
     Client() {}
-    ~Client() { free_memory_page(); }
+
+    /***
+     * The asynchronous writes still outstanding are flushed, for `CLOSE_TIMEOUT` at most
+     * (or the timeout, if shorter): the server may be gone. To wait for them longer, `flush`
+     * before destroying the client.
+     */
+    ~Client() {
+        if (m_timeout.count() == 0 || m_timeout > CLOSE_TIMEOUT) {
+            m_timeout = CLOSE_TIMEOUT;
+        }
+        flush();
+        if (m_server_doorbell != -1) {
+            close(m_server_doorbell);
+        }
+        free_memory_page();
+    }
 
     void start() noexcept {
+        TRACE_PROCESS_NAME("client");
         connect_to_server();
     }
 
-    void send_insert_request(Key key, Value value, bool async = false) {
+    /***
+     * Insert the (key, value) couple. An asynchronous insert returns as soon as the
+     * request is enqueued, use `flush` to wait until it has been applied.
+     * @param ttl The pair expires after it, if not zero.
+     * @return False if the insert timed out, or if it has a TTL and the server's table does
+     * not support expirations (then it is not sent at all).
+     */
+    bool send_insert_request(Key key, Value value, bool async = false, std::chrono::nanoseconds ttl = {}) {
         ReqMessage insert_msg(m_client_id, ReqMessage::Type::Insert, key, value, async);
-        m_shared_queue->send_waiting_request(insert_msg);
+        if (ttl.count() != 0) {
+            if (!m_shared_queue->m_expirations) {
+                return false;
+            }
+            insert_msg.m_expires_at = deadline::now() + ttl.count();
+        }
+        return send_write_request(insert_msg);
     }
 
-    void send_remove_request(Key key, bool async = false) {
+    /***
+     * @return False if the remove timed out.
+     */
+    bool send_remove_request(Key key, bool async = false) {
         ReqMessage remove_msg(m_client_id, ReqMessage::Type::Remove, key, async);
-        m_shared_queue->send_waiting_request(remove_msg);
+        return send_write_request(remove_msg);
+    }
+
+    /***
+     * How many asynchronous writes have been sent and not yet acknowledged by a `flush`.
+     */
+    uint64_t outstanding_writes() const {
+        return m_async_sent - m_async_acked;
+    }
+
+    /***
+     * Barrier waiting until all the asynchronous writes sent so far have been applied by
+     * the server, with a single cumulative acknowledgement. Don't mix it with requests
+     * posted through the event loop interface whose responses are still pending.
+     */
+    void flush() {
+
+        if (outstanding_writes() == 0) {
+            return;
+        }
+
+        ReqMessage flush_msg(m_client_id, ReqMessage::Type::Flush, Key{});
+        flush_msg.m_sequence = m_async_sent;
+
+        if (auto answer = send_waiting_request(flush_msg)) {
+            m_async_acked = answer->m_sequence;
+        }
     }
 
     std::optional<Value> send_read_request(Key key) {
 
+        // One-sided read, the server is asked only if it could not be validated. It skips the
+        // request queue, where our own asynchronous writes could still be: they are applied first.
+        if (m_table_reader) {
+            flush();
+        }
+        if (m_table_reader && outstanding_writes() == 0) {
+            if (auto result = m_table_reader->get(key)) {
+                m_timed_out = false;
+                return result.value();
+            }
+        }
+
         ReqMessage read_msg(m_client_id, ReqMessage::Type::Read, key);
 
-        auto answer = m_shared_queue->send_waiting_request(read_msg);
+        auto answer = send_waiting_request(read_msg);
 
-        if (answer.m_type == ResMessage::Type::FailedRead) {
+        if (!answer || answer->m_type == ResMessage::Type::FailedRead) {
             return {};
         }
 
-        return answer.m_value;
+        return answer->m_value;
+    }
+
+    //region Read-modify-write requests
+
+    /***
+     * The outcome of a read-modify-write request, applied atomically by the server.
+     */
+    struct UpdateResult {
+        // Whether the value has been stored
+        bool m_updated{false};
+        // The value reported by the server (see each request), None if the key is missing
+        std::optional<Value> m_value{};
+    };
+
+    /***
+     * Replace the value with `desired` if it is equal to `expected`.
+     * @return The previous value if swapped, otherwise the current one (None if missing).
+     */
+    UpdateResult send_compare_and_swap_request(Key key, Value expected, Value desired) {
+        ReqMessage cas_msg(m_client_id, ReqMessage::Type::CompareAndSwap, key, desired);
+        cas_msg.m_expected = expected;
+        return send_update_request(cas_msg);
+    }
+
+    /***
+     * Add to a value holding a decimal integer, a missing one counts as zero.
+     * @return The previous number, or the current value if it is not a number.
+     */
+    UpdateResult send_fetch_add_request(Key key, int64_t delta) {
+        ReqMessage add_msg(m_client_id, ReqMessage::Type::FetchAdd, key);
+        add_msg.m_delta = delta;
+        return send_update_request(add_msg);
+    }
+
+    /***
+     * Append the suffix to the value, creating it if missing (integers cannot be appended to).
+     * @return The resulting value, or the current one if the result would not fit.
+     */
+    UpdateResult send_append_request(Key key, Value suffix) requires (!std::is_integral_v<Value>) {
+        return send_update_request(ReqMessage(m_client_id, ReqMessage::Type::Append, key, suffix));
+    }
+
+    /***
+     * Set the value, reading the previous one in the same request.
+     * @return The previous value (None if missing).
+     */
+    UpdateResult send_get_and_set_request(Key key, Value value) {
+        return send_update_request(ReqMessage(m_client_id, ReqMessage::Type::GetAndSet, key, value));
+    }
+
+    //endregion
+
+    /***
+     * Visit all the pairs of the server's table, with a cursor-based scan: the server fills
+     * a batch of pairs inside the shared memory for each request, and the next batch is
+     * requested before visiting the current one, so the server produces it meanwhile.
+     * Like Redis' SCAN, the pairs present for the whole scan are visited at least once,
+     * the ones written meanwhile may or may not be visited, and some may be visited twice.
+     * @param visit Invoked with each (key, value) pair, it must not send requests of its own.
+     * @return False if the scan is incomplete: it timed out, or the server's table cannot be scanned.
+     */
+    template <typename Visit>
+    bool scan(Visit visit) {
+
+        ReqMessage request(m_client_id, ReqMessage::Type::Scan, Key{});
+        if (!send_request(request)) {
+            return false;
+        }
+
+        while (true) {
+
+            auto answer = wait_response(request);
+            if (!answer || answer->m_type == ResMessage::Type::FailedRead) {
+                return false;
+            }
+
+            auto& batch = m_shared_queue->m_scan_batches[m_client_id][request.m_batch];
+
+            ReqMessage next = request;
+            if (!batch.is_last()) {
+                next.m_cursor = batch.m_cursor;
+                next.m_skip = static_cast<uint32_t>(batch.m_skip);
+                next.m_batch = 1 - request.m_batch;
+                if (!send_request(next)) {
+                    return false;
+                }
+            }
+
+            for (size_t i = 0; i < batch.m_count; i++) {
+                visit(batch.m_entries[i].m_key, batch.m_entries[i].m_value);
+            }
+
+            if (batch.is_last()) {
+                return true;
+            }
+
+            request = next;
+        }
+    }
+
+    /***
+     * Give up on the requests not answered within the timeout: the server drops them
+     * if they are still enqueued once expired. A zero timeout waits forever.
+     * @param timeout
+     */
+    void set_timeout(std::chrono::nanoseconds timeout) {
+        m_timeout = timeout;
+    }
+
+    /***
+     * Did the last request (or `flush`) expire before being enqueued or answered?
+     */
+    bool timed_out() const {
+        return m_timed_out;
+    }
+
+    /***
+     * Serve the reads straight from the server's table, if the server keeps it in shared
+     * memory (`SHM_HASH_TABLE`): no request is sent, unless the read races with the writers.
+     * A read bypasses the request queue, hence it first waits (`flush`) for the asynchronous
+     * writes sent so far; the writes posted through the event loop interface are not waited
+     * for, a read may not see them until their responses are collected.
+     * @return False if the server does not export its table.
+     */
+    bool enable_direct_reads() {
+        auto reader = std::make_unique<shm_table::Reader<Key, Value>>();
+        if (!reader->attach()) {
+            return false;
+        }
+        m_table_reader = std::move(reader);
+        return true;
     }
 
+    //region Event loop interface
+
+    /***
+     * Register a doorbell for this client within the server. The returned descriptor
+     * becomes readable when responses are ready, it can be added to an `epoll`/`kqueue`
+     * event loop, and `poll_responses` should be invoked once it is readable.
+     * Multiple responses published while the doorbell is pending ring it only once.
+     * @return The descriptor to wait on.
+     */
+    int enable_notifications() {
+
+        if (m_doorbell) {
+            return m_doorbell->wait_fd();
+        }
+
+        int sock;
+        if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+            panic("[client] :: error while invoking socket");
+        }
+
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, protocol::DOORBELL_SOCKET, sizeof(addr.sun_path) - 1);
+
+        if (connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1) {
+            panic("[client] :: error while connecting to the doorbell socket. Did you start the server?");
+        }
+
+        m_doorbell = std::make_unique<Doorbell>();
+
+        int payload = -1;
+        if (!Doorbell::send_fd(sock, m_doorbell->ring_fd(), m_client_id) ||
+            (m_server_doorbell = Doorbell::receive_fd(sock, &payload)) == -1) {
+            panic("[client] :: error while exchanging doorbells with the server");
+        }
+
+        close(sock);
+
+        // From now on, the server rings our doorbell
+        m_shared_queue->m_response_pending[m_client_id] = false;
+
+        return m_doorbell->wait_fd();
+    }
+
+    /***
+     * Enqueue a request without waiting for its response, which is collected
+     * with `poll_responses`.
+     * @return False if the request queue is full.
+     */
+    bool post_read_request(Key key) {
+        return post_request(ReqMessage(m_client_id, ReqMessage::Type::Read, key));
+    }
+
+    bool post_insert_request(Key key, Value value) {
+        return post_request(ReqMessage(m_client_id, ReqMessage::Type::Insert, key, value));
+    }
+
+    bool post_remove_request(Key key) {
+        return post_request(ReqMessage(m_client_id, ReqMessage::Type::Remove, key));
+    }
+
+    /***
+     * Consume the doorbell and all the responses currently available, without blocking.
+     * @param on_response Invoked for each response, in order of arrival.
+     * @return How many responses have been consumed.
+     */
+    template <typename Callback>
+    size_t poll_responses(Callback on_response) {
+
+        // Re-arm the doorbell before looking at the queue, so a response published
+        // from now on rings it again.
+        if (m_doorbell) {
+            m_doorbell->drain();
+            m_shared_queue->m_response_pending[m_client_id] = false;
+        }
+
+        size_t consumed = 0;
+        while (auto response = m_shared_queue->try_receive_response(m_client_id)) {
+            // Meant for the previous owner of our client id
+            if (response->m_request_id <= m_first_request_id) {
+                continue;
+            }
+            TRACE_FLOW_END("response", tracing::trace_id(m_client_id, response->m_request_id));
+            on_response(response.value());
+            consumed++;
+        }
+
+        return consumed;
+    }
+
+    //endregion
+
 private:
 
-    size_t m_client_id{0};
+    int m_client_id{0};
     ShmQueue* m_shared_queue{nullptr};
+    // Our request ids follow it, the ones of the previous owners of the client id precede it
+    uint64_t m_first_request_id{0};
+
+    //region Deadlines
+    // How long the destructor waits for the asynchronous writes to be applied
+    static constexpr std::chrono::seconds CLOSE_TIMEOUT{1};
+
+    std::chrono::nanoseconds m_timeout{0};
+    uint64_t m_last_request_id{0};
+    bool m_timed_out{false};
+    //endregion
+
+    //region Asynchronous writes
+    uint64_t m_async_sent{0};
+    uint64_t m_async_acked{0};
+    //endregion
+
+    std::unique_ptr<shm_table::Reader<Key, Value>> m_table_reader{};
+
+    //region Doorbells
+    std::unique_ptr<Doorbell> m_doorbell{};
+    int m_server_doorbell{-1};
+    //endregion
+
+    /***
+     * Tag the request with a new id and with the deadline derived from the timeout.
+     */
+    void prepare_request(ReqMessage& msg) {
+        msg.m_request_id = ++m_last_request_id;
+        msg.m_deadline = m_timeout.count() == 0 ? deadline::NONE : deadline::now() + m_timeout.count();
+    }
+
+    std::optional<ResMessage> send_waiting_request(ReqMessage msg) {
+
+        if (!send_request(msg)) {
+            return {};
+        }
+
+        return wait_response(msg);
+    }
+
+    /***
+     * Enqueue the request, waiting for a free slot until its deadline.
+     * @return False if it expired meanwhile.
+     */
+    bool send_request(ReqMessage& msg) {
+
+        prepare_request(msg);
+        m_timed_out = true;
+
+        TRACE_SPAN(request_enqueue, tracing::trace_id(m_client_id, msg.m_request_id), msg.m_type);
+
+        if (!m_shared_queue->send_request_until(msg, msg.m_deadline)) {
+            return false;
+        }
+        TRACE_FLOW_START("request", tracing::trace_id(m_client_id, msg.m_request_id));
+        ring_server();
+        return true;
+    }
+
+    std::optional<ResMessage> wait_response(const ReqMessage& msg) {
+
+        TRACE_SPAN(response_wait, tracing::trace_id(m_client_id, msg.m_request_id), msg.m_type);
+
+        // The answers to the requests we gave up on could still be in our queue, skip them
+        while (auto answer = m_shared_queue->receive_response_until(m_client_id, msg.m_deadline)) {
+            if (answer->m_request_id == msg.m_request_id) {
+                TRACE_FLOW_END("response", tracing::trace_id(m_client_id, msg.m_request_id));
+                m_timed_out = false;
+                return answer;
+            }
+        }
+
+        return {};
+    }
+
+    UpdateResult send_update_request(ReqMessage msg) {
+
+        UpdateResult result{};
+
+        auto answer = send_waiting_request(msg);
+        if (!answer || answer->m_type == ResMessage::Type::FailedRead) {
+            // Missing key (a get-and-set stores the value anyway)
+            result.m_updated = answer && msg.m_type == ReqMessage::Type::GetAndSet;
+            return result;
+        }
+
+        result.m_updated = answer->m_type == ResMessage::Type::SuccessfulRead;
+        result.m_value = answer->m_value;
+        return result;
+    }
+
+    /***
+     * @return False if the write timed out, or if the server could not apply it.
+     */
+    bool send_write_request(ReqMessage msg) {
+
+        if (!msg.m_async) {
+            auto answer = send_waiting_request(msg);
+            return answer && answer->m_type == ResMessage::Type::Acknowledgment;
+        }
+
+        // Fire and forget: the server does not answer asynchronous writes
+        prepare_request(msg);
+        TRACE_SPAN(request_enqueue, tracing::trace_id(m_client_id, msg.m_request_id), msg.m_type);
+        if ((m_timed_out = !m_shared_queue->send_request_until(msg, msg.m_deadline))) {
+            return false;
+        }
+        TRACE_FLOW_START("request", tracing::trace_id(m_client_id, msg.m_request_id));
+        ring_server();
+        m_async_sent++;
+        return true;
+    }
+
+    bool post_request(ReqMessage msg) {
+        prepare_request(msg);
+        TRACE_SPAN(request_enqueue, tracing::trace_id(m_client_id, msg.m_request_id), msg.m_type);
+        if (!m_shared_queue->try_send_request(msg)) {
+            return false;
+        }
+        TRACE_FLOW_START("request", tracing::trace_id(m_client_id, msg.m_request_id));
+        ring_server();
+        return true;
+    }
+
+    void ring_server() noexcept {
+        if (m_server_doorbell != -1 && m_shared_queue->arm_request_doorbell()) {
+            Doorbell::ring(m_server_doorbell);
+        }
+    }
 
     void connect_to_server() noexcept {
 
@@ -65,13 +495,23 @@ private:
         // We don't need to keep the file open
         close(fd);
 
+        if (m_shared_queue->m_key_size != sizeof(Key) || m_shared_queue->m_value_size != sizeof(Value)) {
+            std::fprintf(stderr, "[client] :: the server stores %u-byte keys and %u-byte values, check the key and value types\n",
+                         m_shared_queue->m_key_size, m_shared_queue->m_value_size);
+            std::exit(EXIT_FAILURE);
+        }
+
         // Get a client id from the queue
-        m_client_id = m_shared_queue->get_client_id();
+        if ((m_client_id = m_shared_queue->get_client_id()) == -1) {
+            panic("[client] :: too many clients connected to the server");
+        }
+        m_first_request_id = m_last_request_id = m_shared_queue->first_request_id(m_client_id);
 
-        std::fprintf(stdout, "[client] :: registered as client #%ld...\n", m_client_id);
+        std::fprintf(stderr, "[client] :: registered as client #%d...\n", m_client_id);
     }
 
     void free_memory_page() {
+        m_shared_queue->release_client_id(m_client_id);
         if (munmap(reinterpret_cast<void*>(m_shared_queue), sizeof(ShmQueue)) == -1) {
             panic("[client] :: error while freeing shared memory page");
         }
@@ -79,4 +519,4 @@ private:
 
 };
 
-#endif
\ No newline at end of file
+#endif
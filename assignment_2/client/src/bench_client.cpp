@@ -0,0 +1,786 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Client.hpp"
+#include "Stats.hpp"
+
+/***
+ * YCSB-style benchmark of a running server: the clients (threads of one or more processes)
+ * load the records, then run one of the YCSB core workloads against them, and the throughput
+ * and the latency percentiles of each operation are printed as CSV or JSON.
+ *
+ * The table has no order, so the scans of workload E read the keys following the first one
+ * (by id) one at a time; the read-modify-writes of workload F read the value, then write it.
+ */
+
+enum class Op : size_t {
+    Read,
+    Update,
+    Insert,
+    Scan,
+    ReadModifyWrite
+};
+
+static constexpr std::array<const char*, 5> OPS = {"read", "update", "insert", "scan", "read_modify_write"};
+
+enum class Distribution {
+    Uniform,
+    Zipfian,
+    // Zipfian, the most recently inserted keys being the most popular
+    Latest
+};
+
+static constexpr std::array<const char*, 3> DISTRIBUTIONS = {"uniform", "zipfian", "latest"};
+
+/***
+ * A YCSB core workload: the percentage of each operation, and the default key distribution.
+ */
+struct Workload {
+    char m_name;
+    std::array<unsigned, OPS.size()> m_mix;
+    Distribution m_distribution;
+};
+
+static constexpr std::array<Workload, 6> WORKLOADS = {{
+    // Update heavy
+    {'a', {50, 50, 0, 0, 0}, Distribution::Zipfian},
+    // Read mostly
+    {'b', {95, 5, 0, 0, 0}, Distribution::Zipfian},
+    // Read only
+    {'c', {100, 0, 0, 0, 0}, Distribution::Zipfian},
+    // Read latest
+    {'d', {95, 0, 5, 0, 0}, Distribution::Latest},
+    // Short ranges
+    {'e', {0, 0, 5, 95, 0}, Distribution::Zipfian},
+    // Read-modify-write
+    {'f', {50, 0, 0, 0, 50}, Distribution::Zipfian}
+}};
+
+enum Phase : size_t {
+    Load,
+    Run
+};
+
+static constexpr std::array<const char*, 2> PHASES = {"load", "run"};
+
+// As many clients as the server accepts
+static constexpr size_t MAX_CLIENTS = protocol::SharedMessageQueue<uint64_t, uint64_t>::MAX_CLIENTS;
+
+// How far the inserts can complete ahead of the oldest one still in flight: each client has
+// at most one in flight, a client stalled for this many inserts of the others holds them back
+static constexpr size_t INSERT_WINDOW = 1 << 16;
+
+struct Args {
+    Workload workload = WORKLOADS[0];
+    std::optional<Distribution> distribution{};
+    uint64_t records = 100000;
+    // Of all the clients together, unless a duration is given
+    uint64_t operations = 1000000;
+    std::chrono::seconds duration{0};
+    unsigned processes = 1;
+    // For each process
+    unsigned threads = 1;
+    // The operations per second of all the clients together, zero for a closed loop
+    uint64_t rate = 0;
+    // For the string values, up to MyString::SIZE
+    size_t value_size = MyString::SIZE;
+    uint64_t max_scan_length = 100;
+    bool load = true;
+    bool run = true;
+    bool json = false;
+    uint64_t seed = 1;
+    std::chrono::milliseconds timeout{0};
+    // "string" (32-byte strings) or "u64" (64-bit integers), as the server has been started with
+    std::string key_type{"string"};
+    std::string value_type{"string"};
+
+    Distribution key_distribution() const {
+        return distribution.value_or(workload.m_distribution);
+    }
+
+    unsigned clients() const {
+        return processes * threads;
+    }
+};
+
+void print_usage() {
+    std::fprintf(stderr, "usage: ./bench_client [--workload a|b|c|d|e|f] [--distribution uniform|zipfian|latest] [--records <n>=100000] "
+                         "[--operations <n>=1000000] [--duration <seconds>] [--processes <n>=1] [--threads <n>=1] [--rate <ops/s>] "
+                         "[--value-size <bytes>=%lu] [--max-scan-length <n>=100] [--phase load|run|both] [--format csv|json] "
+                         "[--seed <n>=1] [--timeout <ms>] [--key-type string|u64] [--value-type string|u64]\n", MyString::SIZE);
+}
+
+Args parse_arguments(int argc, char *const *argv) {
+
+    Args args;
+
+    for (int i = 1; i < argc; i += 2) {
+
+        std::string arg{argv[i]};
+
+        if (i + 1 == argc) {
+            print_usage();
+            std::exit(EXIT_FAILURE);
+        }
+
+        std::string value{argv[i + 1]};
+
+        try {
+            if (arg == "--workload") {
+                auto workload = std::find_if(WORKLOADS.begin(), WORKLOADS.end(), [&](const Workload& w) {
+                    return value.size() == 1 && std::tolower(value[0]) == w.m_name;
+                });
+                if (workload == WORKLOADS.end()) {
+                    throw std::invalid_argument{arg};
+                }
+                args.workload = *workload;
+            }
+            else if (arg == "--distribution") {
+                auto distribution = std::find(DISTRIBUTIONS.begin(), DISTRIBUTIONS.end(), value);
+                if (distribution == DISTRIBUTIONS.end()) {
+                    throw std::invalid_argument{arg};
+                }
+                args.distribution = static_cast<Distribution>(distribution - DISTRIBUTIONS.begin());
+            }
+            else if (arg == "--records") {
+                args.records = std::stoull(value);
+            }
+            else if (arg == "--operations") {
+                args.operations = std::stoull(value);
+            }
+            else if (arg == "--duration") {
+                args.duration = std::chrono::seconds{std::stoul(value)};
+            }
+            else if (arg == "--processes") {
+                args.processes = std::max<unsigned>(std::stoul(value), 1);
+            }
+            else if (arg == "--threads") {
+                args.threads = std::max<unsigned>(std::stoul(value), 1);
+            }
+            else if (arg == "--rate") {
+                args.rate = std::stoull(value);
+            }
+            else if (arg == "--value-size") {
+                args.value_size = std::min<size_t>(std::stoul(value), MyString::SIZE);
+            }
+            else if (arg == "--max-scan-length") {
+                args.max_scan_length = std::max<uint64_t>(std::stoull(value), 1);
+            }
+            else if (arg == "--phase") {
+                if (value != "load" && value != "run" && value != "both") {
+                    throw std::invalid_argument{arg};
+                }
+                args.load = value != "run";
+                args.run = value != "load";
+            }
+            else if (arg == "--format") {
+                if (value != "csv" && value != "json") {
+                    throw std::invalid_argument{arg};
+                }
+                args.json = value == "json";
+            }
+            else if (arg == "--seed") {
+                args.seed = std::stoull(value);
+            }
+            else if (arg == "--timeout") {
+                args.timeout = std::chrono::milliseconds{std::stoul(value)};
+            }
+            else if (arg == "--key-type" || arg == "--value-type") {
+                if (value != "string" && value != "u64") {
+                    throw std::invalid_argument{arg};
+                }
+                (arg == "--key-type" ? args.key_type : args.value_type) = value;
+            }
+            else {
+                throw std::invalid_argument{arg};
+            }
+        }
+        catch (const std::logic_error &e) {
+            print_usage();
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    if (args.clients() > MAX_CLIENTS) {
+        std::fprintf(stderr, "[bench][error] :: the server accepts %lu clients at most\n", MAX_CLIENTS);
+        std::exit(EXIT_FAILURE);
+    }
+
+    return args;
+}
+
+//region Keys
+
+/***
+ * The zipfian generator of YCSB (Gray et al., "Quickly generating billion-record synthetic
+ * databases"): 0 is the most popular item, then 1, and so on.
+ */
+class Zipfian {
+
+public:
+
+    static constexpr double THETA = 0.99;
+
+    explicit Zipfian(uint64_t items) : m_items{std::max<uint64_t>(items, 2)} {
+        m_zeta = zeta(m_items);
+        m_alpha = 1.0 / (1.0 - THETA);
+        m_eta = (1.0 - std::pow(2.0 / static_cast<double>(m_items), 1.0 - THETA)) / (1.0 - zeta(2) / m_zeta);
+    }
+
+    uint64_t next(std::mt19937_64& rng) const {
+        double u = std::uniform_real_distribution<double>{0.0, 1.0}(rng);
+        double uz = u * m_zeta;
+        if (uz < 1.0) {
+            return 0;
+        }
+        if (uz < 1.0 + std::pow(0.5, THETA)) {
+            return 1;
+        }
+        auto item = static_cast<uint64_t>(static_cast<double>(m_items) * std::pow(m_eta * u - m_eta + 1.0, m_alpha));
+        return std::min(item, m_items - 1);
+    }
+
+private:
+    uint64_t m_items;
+    double m_zeta{0};
+    double m_alpha{0};
+    double m_eta{0};
+
+    static double zeta(uint64_t items) {
+        double sum = 0;
+        for (uint64_t i = 1; i <= items; i++) {
+            sum += 1.0 / std::pow(static_cast<double>(i), THETA);
+        }
+        return sum;
+    }
+};
+
+/***
+ * Pick the id of an existing key, out of the `count` inserted so far.
+ */
+class KeyChooser {
+
+public:
+
+    KeyChooser(Distribution distribution, const Zipfian& zipfian) : m_distribution{distribution}, m_zipfian{zipfian} {}
+
+    uint64_t next(std::mt19937_64& rng, uint64_t count) const {
+        count = std::max<uint64_t>(count, 1);
+        switch (m_distribution) {
+            case Distribution::Uniform:
+                return std::uniform_int_distribution<uint64_t>{0, count - 1}(rng);
+            case Distribution::Zipfian:
+                // Scattered, so the popular keys are not the first ones loaded
+                return fnv1a(m_zipfian.next(rng)) % count;
+            case Distribution::Latest:
+                return count - 1 - std::min(m_zipfian.next(rng), count - 1);
+        }
+        return 0;
+    }
+
+private:
+    Distribution m_distribution;
+    const Zipfian& m_zipfian;
+
+    static uint64_t fnv1a(uint64_t value) {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (int i = 0; i < 8; i++) {
+            hash = (hash ^ (value & 0xff)) * 0x100000001b3ull;
+            value >>= 8;
+        }
+        return hash;
+    }
+};
+
+template <typename Key>
+Key make_key(uint64_t id) {
+    if constexpr (std::is_integral_v<Key>) {
+        return id;
+    }
+    else {
+        char text[MyString::SIZE] = "user";
+        auto end = std::to_chars(text + 4, text + sizeof(text), id).ptr;
+        return text::parse<Key>(std::string_view{text, static_cast<size_t>(end - text)});
+    }
+}
+
+template <typename Value>
+Value make_value(std::mt19937_64& rng, size_t size) {
+    if constexpr (std::is_integral_v<Value>) {
+        return rng();
+    }
+    else {
+        Value value{};
+        for (size_t i = 0; i < size; i++) {
+            value.data[i] = static_cast<char>('a' + rng() % 26);
+        }
+        return value;
+    }
+}
+
+//endregion
+
+//region Results
+
+/***
+ * What a client measured during a phase, written by the client only.
+ */
+struct PhaseResults {
+    // From the (intended, in an open loop) start of each operation until it completed, in nanoseconds
+    std::array<stats::Histogram, OPS.size()> m_latencies{};
+    std::array<uint64_t, OPS.size()> m_count{};
+    std::array<uint64_t, OPS.size()> m_failures{};
+    std::array<uint64_t, OPS.size()> m_not_found{};
+    // On the deadline clock
+    uint64_t m_started_at{0};
+    uint64_t m_finished_at{0};
+};
+
+/***
+ * Shared by all the clients, in an anonymous mapping inherited by the processes.
+ */
+struct Shared {
+    // The barriers the clients wait on before each phase
+    std::atomic_uint64_t m_connected{0};
+    std::atomic_uint64_t m_loaded{0};
+    // The id of the next key inserted by the run
+    std::atomic_uint64_t m_next_insert{0};
+    // The keys below this id have all been inserted, the others may still be in flight
+    std::atomic_uint64_t m_inserted{0};
+    // `id + 1` once the insert of `id` completed, at `id % INSERT_WINDOW`
+    std::array<std::atomic_uint64_t, INSERT_WINDOW> m_completed{};
+    std::array<std::array<PhaseResults, PHASES.size()>, MAX_CLIENTS> m_results{};
+
+    /***
+     * Mark the insert of the key as completed (acknowledged, or failed: a failed one would
+     * otherwise hold the others back forever), and move `m_inserted` past the completed ones.
+     */
+    void complete_insert(uint64_t id) {
+        m_completed[id % INSERT_WINDOW].store(id + 1, std::memory_order_release);
+        uint64_t inserted = m_inserted.load(std::memory_order_acquire);
+        while (m_completed[inserted % INSERT_WINDOW].load(std::memory_order_acquire) == inserted + 1) {
+            // On failure another client moved it, from where it left off
+            if (m_inserted.compare_exchange_weak(inserted, inserted + 1, std::memory_order_acq_rel)) {
+                inserted++;
+            }
+        }
+    }
+};
+
+void wait_for_all(std::atomic_uint64_t& arrived, uint64_t clients) {
+    arrived.fetch_add(1);
+    while (arrived.load() < clients) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+//endregion
+
+template <typename Key, typename Value>
+class BenchClient {
+
+public:
+
+    BenchClient(const Args& args, Shared& shared, unsigned index, const Zipfian& zipfian) :
+        m_args{args}, m_shared{shared}, m_index{index}, m_rng{args.seed * 1000003 + index},
+        m_keys{args.key_distribution(), zipfian} {}
+
+    void run() {
+
+        m_client.start();
+        m_client.set_timeout(m_args.timeout);
+
+        wait_for_all(m_shared.m_connected, m_args.clients());
+
+        if (m_args.load) {
+            load();
+        }
+
+        wait_for_all(m_shared.m_loaded, m_args.clients());
+
+        if (m_args.run) {
+            run_workload();
+        }
+    }
+
+private:
+    const Args& m_args;
+    Shared& m_shared;
+    unsigned m_index;
+    std::mt19937_64 m_rng;
+    KeyChooser m_keys;
+    Client<Key, Value> m_client{};
+
+    static constexpr uint64_t OPEN_LOOP_SPIN_NS = 100'000;
+
+    struct Outcome {
+        bool m_found{true};
+        bool m_failed{false};
+    };
+
+    /***
+     * Insert this client's share of the records, asynchronously: only the phase's throughput
+     * is measured, the inserts are not acknowledged one by one.
+     */
+    void load() {
+
+        auto& results = m_shared.m_results[m_index][Phase::Load];
+        auto insert = static_cast<size_t>(Op::Insert);
+        uint64_t clients = m_args.clients();
+
+        results.m_started_at = deadline::now();
+
+        for (uint64_t id = m_args.records * m_index / clients; id < m_args.records * (m_index + 1) / clients; id++) {
+            m_client.send_insert_request(make_key<Key>(id), make_value<Value>(m_rng, m_args.value_size), true);
+            results.m_count[insert]++;
+            results.m_failures[insert] += m_client.timed_out();
+        }
+        m_client.flush();
+
+        results.m_finished_at = deadline::now();
+    }
+
+    /***
+     * Run this client's share of the operations (or until the duration elapsed): in a closed
+     * loop each operation starts once the previous one completed, in an open loop at a fixed
+     * rate, and its latency is measured from when it was due, so the operations delayed by a
+     * slow one count as slow too.
+     */
+    void run_workload() {
+
+        auto& results = m_shared.m_results[m_index][Phase::Run];
+        uint64_t clients = m_args.clients();
+        uint64_t operations = m_args.operations * (m_index + 1) / clients - m_args.operations * m_index / clients;
+        uint64_t interval_ns = m_args.rate == 0 ? 0 : std::max<uint64_t>(1'000'000'000ull * clients / m_args.rate, 1);
+
+        std::uniform_int_distribution<unsigned> percent{0, 99};
+
+        uint64_t start = deadline::now();
+        uint64_t stop = m_args.duration.count() == 0 ? deadline::NONE :
+            start + std::chrono::duration_cast<std::chrono::nanoseconds>(m_args.duration).count();
+
+        results.m_started_at = start;
+
+        for (uint64_t i = 0; stop != deadline::NONE || i < operations; i++) {
+
+            uint64_t begin = deadline::now();
+
+            if (interval_ns != 0) {
+                uint64_t due = start + i * interval_ns;
+                // The sleep overshoots, and the overshoot would count as latency: the last
+                // stretch is waited for by yielding
+                if (due > begin + OPEN_LOOP_SPIN_NS) {
+                    std::this_thread::sleep_for(std::chrono::nanoseconds(due - begin - OPEN_LOOP_SPIN_NS));
+                }
+                while (deadline::now() < due) {
+                    std::this_thread::yield();
+                }
+                begin = due;
+            }
+
+            if (stop != deadline::NONE && begin >= stop) {
+                break;
+            }
+
+            Op op = choose_op(percent(m_rng));
+            Outcome outcome = perform(op);
+
+            auto index = static_cast<size_t>(op);
+            results.m_latencies[index].record(deadline::now() - begin);
+            results.m_count[index]++;
+            results.m_failures[index] += outcome.m_failed;
+            results.m_not_found[index] += !outcome.m_found;
+        }
+
+        results.m_finished_at = deadline::now();
+    }
+
+    Op choose_op(unsigned roll) const {
+        for (size_t op = 0; op < OPS.size(); op++) {
+            if (roll < m_args.workload.m_mix[op]) {
+                return static_cast<Op>(op);
+            }
+            roll -= m_args.workload.m_mix[op];
+        }
+        return Op::Read;
+    }
+
+    Outcome perform(Op op) {
+
+        Outcome outcome{};
+        // Only the keys whose insert completed, the later ones may not be there yet
+        uint64_t count = m_shared.m_inserted.load(std::memory_order_acquire);
+
+        auto read = [&](uint64_t id) {
+            outcome.m_found &= m_client.send_read_request(make_key<Key>(id)).has_value();
+            outcome.m_failed |= m_client.timed_out();
+        };
+        auto write = [&](uint64_t id) {
+            m_client.send_insert_request(make_key<Key>(id), make_value<Value>(m_rng, m_args.value_size));
+            outcome.m_failed |= m_client.timed_out();
+        };
+
+        switch (op) {
+            case Op::Read:
+                read(m_keys.next(m_rng, count));
+                break;
+            case Op::Update:
+                write(m_keys.next(m_rng, count));
+                break;
+            case Op::Insert: {
+                uint64_t id = m_shared.m_next_insert.fetch_add(1, std::memory_order_relaxed);
+                write(id);
+                m_shared.complete_insert(id);
+                break;
+            }
+            case Op::Scan: {
+                uint64_t first = m_keys.next(m_rng, count);
+                uint64_t length = std::uniform_int_distribution<uint64_t>{1, m_args.max_scan_length}(m_rng);
+                for (uint64_t id = first; id < std::min(first + length, count); id++) {
+                    read(id);
+                }
+                break;
+            }
+            case Op::ReadModifyWrite: {
+                uint64_t id = m_keys.next(m_rng, count);
+                read(id);
+                write(id);
+                break;
+            }
+        }
+
+        return outcome;
+    }
+};
+
+//region Report
+
+struct OpReport {
+    uint64_t m_count{0};
+    uint64_t m_failures{0};
+    uint64_t m_not_found{0};
+    stats::Histogram::Summary m_latency{};
+};
+
+struct PhaseReport {
+    uint64_t m_elapsed_ns{0};
+    // The operations, then all of them together
+    std::array<OpReport, OPS.size() + 1> m_ops{};
+};
+
+/***
+ * Merge the results of all the clients: the phase lasted from the first client starting it
+ * to the last one finishing it.
+ */
+PhaseReport merge(const Shared& shared, unsigned clients, Phase phase) {
+
+    PhaseReport report{};
+    auto snapshots = std::make_unique<std::array<stats::Histogram::Snapshot, OPS.size() + 1>>();
+
+    uint64_t started_at = UINT64_MAX, finished_at = 0;
+
+    for (unsigned client = 0; client < clients; client++) {
+        auto& results = shared.m_results[client][phase];
+        started_at = std::min(started_at, results.m_started_at);
+        finished_at = std::max(finished_at, results.m_finished_at);
+        for (size_t op = 0; op < OPS.size(); op++) {
+            for (size_t into: {op, OPS.size()}) {
+                report.m_ops[into].m_count += results.m_count[op];
+                report.m_ops[into].m_failures += results.m_failures[op];
+                report.m_ops[into].m_not_found += results.m_not_found[op];
+                (*snapshots)[into].add(results.m_latencies[op]);
+            }
+        }
+    }
+
+    for (size_t op = 0; op <= OPS.size(); op++) {
+        report.m_ops[op].m_latency = stats::Histogram::summarize((*snapshots)[op], stats::Histogram::Snapshot{});
+    }
+    report.m_elapsed_ns = finished_at > started_at ? finished_at - started_at : 0;
+
+    return report;
+}
+
+double throughput(uint64_t count, uint64_t elapsed_ns) {
+    return elapsed_ns == 0 ? 0.0 : static_cast<double>(count) * 1e9 / static_cast<double>(elapsed_ns);
+}
+
+void print_csv(const Args& args, const std::vector<std::pair<Phase, PhaseReport>>& reports) {
+
+    std::fprintf(stdout, "phase,workload,distribution,mode,rate,clients,op,count,failures,not_found,elapsed_s,throughput,"
+                         "mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n");
+
+    for (auto& [phase, report]: reports) {
+        for (size_t op = 0; op <= OPS.size(); op++) {
+            auto& ops = report.m_ops[op];
+            if (ops.m_count == 0) {
+                continue;
+            }
+            auto& s = ops.m_latency;
+            std::fprintf(stdout, "%s,%c,%s,%s,%lu,%u,%s,%lu,%lu,%lu,%.3f,%.1f,",
+                         PHASES[phase], args.workload.m_name, DISTRIBUTIONS[static_cast<size_t>(args.key_distribution())],
+                         args.rate == 0 ? "closed" : "open", args.rate, args.clients(), op < OPS.size() ? OPS[op] : "all",
+                         ops.m_count, ops.m_failures, ops.m_not_found, static_cast<double>(report.m_elapsed_ns) / 1e9,
+                         throughput(ops.m_count, report.m_elapsed_ns));
+            // The asynchronous inserts of the load have no latency of their own, the columns are left empty
+            if (s.m_count == 0) {
+                std::fprintf(stdout, ",,,,,\n");
+            }
+            else {
+                std::fprintf(stdout, "%.0f,%lu,%lu,%lu,%lu,%lu\n", s.m_mean, s.m_p50, s.m_p90, s.m_p99, s.m_p999, s.m_max);
+            }
+        }
+    }
+}
+
+void print_json(const Args& args, const std::vector<std::pair<Phase, PhaseReport>>& reports) {
+
+    std::fprintf(stdout, "{\"workload\":\"%c\",\"distribution\":\"%s\",\"mode\":\"%s\",\"rate\":%lu,\"processes\":%u,\"threads\":%u,"
+                         "\"records\":%lu,\"value_size\":%lu,\"phases\":{",
+                 args.workload.m_name, DISTRIBUTIONS[static_cast<size_t>(args.key_distribution())], args.rate == 0 ? "closed" : "open",
+                 args.rate, args.processes, args.threads, args.records, args.value_size);
+
+    for (size_t i = 0; i < reports.size(); i++) {
+        auto& [phase, report] = reports[i];
+        std::fprintf(stdout, "%s\"%s\":{\"elapsed_ns\":%lu,\"ops\":{", i == 0 ? "" : ",", PHASES[phase], report.m_elapsed_ns);
+
+        bool first = true;
+        for (size_t op = 0; op <= OPS.size(); op++) {
+            auto& ops = report.m_ops[op];
+            if (ops.m_count == 0) {
+                continue;
+            }
+            auto& s = ops.m_latency;
+            std::fprintf(stdout, "%s\"%s\":{\"count\":%lu,\"failures\":%lu,\"not_found\":%lu,\"throughput\":%.1f,\"latency_ns\":",
+                         first ? "" : ",", op < OPS.size() ? OPS[op] : "all", ops.m_count, ops.m_failures, ops.m_not_found,
+                         throughput(ops.m_count, report.m_elapsed_ns));
+            // Null for the asynchronous inserts of the load, which have no latency of their own
+            if (s.m_count == 0) {
+                std::fprintf(stdout, "null}");
+            }
+            else {
+                std::fprintf(stdout, "{\"count\":%lu,\"mean\":%.2f,\"p50\":%lu,\"p90\":%lu,\"p99\":%lu,\"p999\":%lu,\"max\":%lu}}",
+                             s.m_count, s.m_mean, s.m_p50, s.m_p90, s.m_p99, s.m_p999, s.m_max);
+            }
+            first = false;
+        }
+        std::fprintf(stdout, "}}");
+    }
+
+    std::fprintf(stdout, "}}\n");
+}
+
+//endregion
+
+template <typename Key, typename Value>
+int run(const Args& args) {
+
+    void* addr = mmap(nullptr, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        std::perror("[bench][error] :: cannot map the shared results");
+        return EXIT_FAILURE;
+    }
+
+    auto shared = new(addr) Shared();
+    shared->m_next_insert = args.records;
+    shared->m_inserted = args.records;
+
+    Zipfian zipfian{args.records};
+
+    auto run_clients = [&](unsigned process) {
+        std::vector<std::thread> threads{};
+        for (unsigned thread = 0; thread < args.threads; thread++) {
+            threads.emplace_back([&, thread]() {
+                BenchClient<Key, Value>{args, *shared, process * args.threads + thread, zipfian}.run();
+            });
+        }
+        for (auto& th: threads) {
+            th.join();
+        }
+    };
+
+    std::fprintf(stderr, "[bench][info] :: workload %c, %s keys, %u processes of %u clients, %s loop\n", args.workload.m_name,
+                 DISTRIBUTIONS[static_cast<size_t>(args.key_distribution())], args.processes, args.threads,
+                 args.rate == 0 ? "closed" : "open");
+
+    bool succeeded = true;
+
+    if (args.processes == 1) {
+        run_clients(0);
+    }
+    else {
+        std::vector<pid_t> children{};
+        for (unsigned process = 0; process < args.processes; process++) {
+            pid_t pid = fork();
+            if (pid == -1) {
+                std::perror("[bench][error] :: cannot fork the clients");
+                for (pid_t child: children) {
+                    kill(child, SIGKILL);
+                }
+                return EXIT_FAILURE;
+            }
+            if (pid == 0) {
+                run_clients(process);
+                std::exit(EXIT_SUCCESS);
+            }
+            children.push_back(pid);
+        }
+        for (pid_t child: children) {
+            int status = 0;
+            waitpid(child, &status, 0);
+            succeeded &= WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+        }
+    }
+
+    if (!succeeded) {
+        std::fprintf(stderr, "[bench][error] :: some clients failed\n");
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::pair<Phase, PhaseReport>> reports{};
+    if (args.load) {
+        reports.emplace_back(Phase::Load, merge(*shared, args.clients(), Phase::Load));
+    }
+    if (args.run) {
+        reports.emplace_back(Phase::Run, merge(*shared, args.clients(), Phase::Run));
+    }
+
+    if (args.json) {
+        print_json(args, reports);
+    }
+    else {
+        print_csv(args, reports);
+    }
+
+    munmap(addr, sizeof(Shared));
+
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+
+    auto args = parse_arguments(argc, argv);
+
+    if (args.key_type == "u64") {
+        return args.value_type == "u64" ? run<uint64_t, uint64_t>(args) : run<uint64_t, MyString>(args);
+    }
+    return args.value_type == "u64" ? run<MyString, uint64_t>(args) : run<MyString, MyString>(args);
+}
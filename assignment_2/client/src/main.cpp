@@ -18,11 +18,16 @@ std::string read_string(const char* msg) {
     return str;
 }
 
-int main(int argc, char **argv) {
+template <typename Key, typename Value>
+int run() {
 
-    Client<MyString, MyString> client{};
+    Client<Key, Value> client{};
     client.start();
 
+    if (client.enable_direct_reads()) {
+        std::cout << "> Reads are served directly from the server's shared table.\n";
+    }
+
     std::string input{};
     Command command = Command::None;
 
@@ -53,20 +58,20 @@ int main(int argc, char **argv) {
             case Command::Insert: {
                 auto key = read_string("Insert a key to insert: ");
                 auto value = read_string("Insert a value to insert: ");
-                client.send_insert_request(MyString::from_string(key), MyString::from_string(value));
+                client.send_insert_request(text::parse<Key>(key), text::parse<Value>(value));
                 break;
             }
             case Command::Remove: {
                 auto key = read_string("Insert a key to remove: ");
-                client.send_remove_request(MyString::from_string(key));
+                client.send_remove_request(text::parse<Key>(key));
                 break;
             }
             case Command::Read: {
 
                 auto key = read_string("Insert a key to read: ");
 
-                if (auto val = client.send_read_request(MyString::from_string(key))) {
-                    std::cout << "> Value read from server: '" << val.value().data << "'\n";
+                if (auto val = client.send_read_request(text::parse<Key>(key))) {
+                    std::cout << "> Value read from server: '" << text::format(val.value()).m_text << "'\n";
                 }
                 else {
                     std::cout << "> Key not present!\n";
@@ -79,4 +84,31 @@ int main(int argc, char **argv) {
     }
 
     return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char **argv) {
+
+    // The same types the server has been started with: "string" (32-byte strings) or "u64" (64-bit integers)
+    std::string key_type{"string"};
+    std::string value_type{"string"};
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg{argv[i]};
+        if (arg == "--key-type") {
+            key_type = argv[i + 1];
+        }
+        else if (arg == "--value-type") {
+            value_type = argv[i + 1];
+        }
+    }
+
+    if ((key_type != "string" && key_type != "u64") || (value_type != "string" && value_type != "u64") || argc % 2 == 0) {
+        std::cerr << "usage: ./client [--key-type string|u64] [--value-type string|u64]\n";
+        return EXIT_FAILURE;
+    }
+
+    if (key_type == "u64") {
+        return value_type == "u64" ? run<uint64_t, uint64_t>() : run<uint64_t, MyString>();
+    }
+    return value_type == "u64" ? run<MyString, uint64_t>() : run<MyString, MyString>();
+}
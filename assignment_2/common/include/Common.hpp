@@ -1,8 +1,20 @@
 #ifndef ASSIGNMENT_2_COMMON_HPP
 #define ASSIGNMENT_2_COMMON_HPP
 
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 struct MyString {
 
@@ -24,8 +36,24 @@ struct MyString {
         std::memset(str.data, 0, SIZE);
     }
 
+    /***
+     * The strings have a fixed size, hence they are compared with a single 32-byte
+     * vector compare (or two 16-byte ones), without branching on each byte.
+     */
     friend bool operator==(const MyString& lhs, const MyString& rhs) {
+        #if defined(__AVX2__)
+        __m256i l = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lhs.data));
+        __m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rhs.data));
+        return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(l, r))) == 0xFFFFFFFFu;
+        #elif defined(__SSE2__)
+        __m128i low = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lhs.data)),
+                                     _mm_loadu_si128(reinterpret_cast<const __m128i*>(rhs.data)));
+        __m128i high = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lhs.data + 16)),
+                                      _mm_loadu_si128(reinterpret_cast<const __m128i*>(rhs.data + 16)));
+        return _mm_movemask_epi8(_mm_and_si128(low, high)) == 0xFFFF;
+        #else
         return std::memcmp(lhs.data, rhs.data, SIZE) == 0;
+        #endif
     }
 
     // user-defined copy assignment (copy-and-swap idiom)
@@ -47,17 +75,253 @@ struct MyString {
 
 };
 
+/***
+ * Value transformations of the read-modify-write requests, run by the server with the
+ * key's stripe locked. They return None when the value cannot be transformed.
+ */
+namespace rmw {
+
+    /***
+     * Add to a value holding a decimal integer (a missing or empty value counts as zero).
+     */
+    inline std::optional<MyString> add(const std::optional<MyString>& current, int64_t delta) {
+
+        int64_t number = 0;
+        if (current) {
+            const char* begin = current->data;
+            const char* end = begin + strnlen(begin, MyString::SIZE);
+            if (begin != end) {
+                auto [ptr, error] = std::from_chars(begin, end, number);
+                if (error != std::errc{} || ptr != end) {
+                    return {};
+                }
+            }
+        }
+
+        if (__builtin_add_overflow(number, delta, &number)) {
+            return {};
+        }
+
+        MyString result{};
+        std::to_chars(result.data, result.data + MyString::SIZE, number);
+        return result;
+    }
+
+    /***
+     * Append the suffix to a value (a missing value counts as empty), if it fits.
+     */
+    inline std::optional<MyString> append(const std::optional<MyString>& current, const MyString& suffix) {
+
+        MyString result = current.value_or(MyString{});
+        size_t length = strnlen(result.data, MyString::SIZE);
+        size_t suffix_length = strnlen(suffix.data, MyString::SIZE);
+
+        if (length + suffix_length > MyString::SIZE) {
+            return {};
+        }
+
+        std::memcpy(result.data + length, suffix.data, suffix_length);
+        return result;
+    }
+
+    /***
+     * Add to an integer value (a missing value counts as zero), unless it overflows.
+     */
+    template <typename Integer> requires std::is_integral_v<Integer>
+    std::optional<Integer> add(const std::optional<Integer>& current, int64_t delta) {
+        Integer result;
+        if (__builtin_add_overflow(current.value_or(0), delta, &result)) {
+            return {};
+        }
+        return result;
+    }
+
+}
+
+/***
+ * Conversions of the keys and values from text (command lines, seed files) and to text (logs).
+ */
+namespace text {
+
+    /***
+     * @return False if the text is not a valid key or value: a string is always valid (it is
+     * truncated to its size), an integer must be a whole decimal number that fits.
+     */
+    inline bool parse(std::string_view text, MyString& out) {
+        out = MyString{};
+        std::memcpy(out.data, text.data(), std::min(text.size(), MyString::SIZE));
+        return true;
+    }
+
+    template <typename Integer> requires std::is_integral_v<Integer>
+    bool parse(std::string_view text, Integer& out) {
+        auto [ptr, error] = std::from_chars(text.data(), text.data() + text.size(), out);
+        return error == std::errc{} && ptr == text.data() + text.size();
+    }
+
+    template <typename T>
+    T parse(std::string_view text) {
+        T out{};
+        parse(text, out);
+        return out;
+    }
+
+    // A NUL-terminated copy, to be printed with `%s`
+    struct Printable {
+        char m_text[MyString::SIZE + 1]{};
+    };
+
+    inline Printable format(const MyString& s) {
+        Printable printable{};
+        std::memcpy(printable.m_text, s.data, MyString::SIZE);
+        return printable;
+    }
+
+    template <typename Integer> requires std::is_integral_v<Integer>
+    Printable format(Integer value) {
+        Printable printable{};
+        std::to_chars(printable.m_text, printable.m_text + MyString::SIZE, value);
+        return printable;
+    }
+
+}
+
+namespace hashing {
+
+    /***
+     * Byte-wise FNV-1a over the whole string, padding included.
+     */
+    struct Fnv1a {
+        size_t operator()(MyString const& s) const noexcept {
+            size_t hash = 2166136261u;
+            for (char i : s.data) {
+                hash ^= static_cast<uint8_t>(i);
+                hash *= 16777619;
+            }
+            return hash;
+        }
+    };
+
+    /***
+     * Word-at-a-time hash in the style of wyhash: it consumes the string 16 bytes per
+     * step, only up to its length, and it folds a 128-bit multiplication at each step,
+     * so that every bit (the low ones too) depends on the whole input.
+     */
+    struct WordAtATime {
+
+        static constexpr uint64_t SECRET[] = {0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull};
+
+        static uint64_t mix(uint64_t a, uint64_t b) noexcept {
+            __uint128_t product = static_cast<__uint128_t>(a) * b;
+            return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+        }
+
+        size_t operator()(MyString const& s) const noexcept {
+
+            uint64_t length = strnlen(s.data, MyString::SIZE);
+            uint64_t seed = SECRET[0] ^ length;
+
+            // The padding is zeroed, hence the last word can be read entirely
+            for (size_t i = 0; i < length; i += 16) {
+                uint64_t words[2];
+                std::memcpy(words, s.data + i, sizeof(words));
+                seed = mix(words[0] ^ SECRET[1], words[1] ^ seed);
+            }
+
+            return mix(seed ^ SECRET[2], length ^ SECRET[1]);
+        }
+    };
+
+    /***
+     * Finalizer of MurmurHash3, for integer keys: `std::hash` is the identity on integers,
+     * which leaves sequential or strided ids clustered on the low bits picking the slot.
+     */
+    struct Mix64 {
+        size_t operator()(uint64_t key) const noexcept {
+            key ^= key >> 33;
+            key *= 0xff51afd7ed558ccdull;
+            key ^= key >> 33;
+            key *= 0xc4ceb9fe1a85ec53ull;
+            key ^= key >> 33;
+            return key;
+        }
+    };
+
+    /***
+     * The tables' hash policy by default: `Mix64` for integer keys, `std::hash` otherwise.
+     */
+    template <typename Key>
+    using Default = std::conditional_t<std::is_integral_v<Key>, Mix64, std::hash<Key>>;
+
+}
+
 template <>
-struct std::hash<MyString> {
-    size_t operator()(MyString const& s) const noexcept {
-        size_t hash = 2166136261u;
-        for (char i : s.data) {
-            hash ^= static_cast<uint8_t>(i);
-            hash *= 16777619;
+struct std::hash<MyString> : hashing::WordAtATime {};
+
+namespace deadline {
+
+    // Clock used to express the requests' deadlines, it has to be shared between
+    // processes and it has to be usable by `pthread_cond_timedwait`.
+    #ifdef __APPLE__
+    static constexpr clockid_t CLOCK = CLOCK_REALTIME;
+    #else
+    static constexpr clockid_t CLOCK = CLOCK_MONOTONIC;
+    #endif
+
+    // A deadline that never expires
+    static constexpr uint64_t NONE = 0;
+
+    /***
+     * Current time of the deadline clock, in nanoseconds.
+     */
+    inline uint64_t now() noexcept {
+        timespec ts{};
+        clock_gettime(CLOCK, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1'000'000'000ull + static_cast<uint64_t>(ts.tv_nsec);
+    }
+
+    inline timespec to_timespec(uint64_t deadline_ns) noexcept {
+        return timespec{
+            .tv_sec = static_cast<time_t>(deadline_ns / 1'000'000'000ull),
+            .tv_nsec = static_cast<long>(deadline_ns % 1'000'000'000ull)
+        };
+    }
+
+    inline bool expired(uint64_t deadline_ns) noexcept {
+        return deadline_ns != NONE && now() >= deadline_ns;
+    }
+
+    inline uint64_t wall_now() noexcept {
+        timespec ts{};
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1'000'000'000ull + static_cast<uint64_t>(ts.tv_nsec);
+    }
+
+    /***
+     * The deadline as a wall-clock instant (nanoseconds since the Unix epoch): unlike the
+     * deadline clock, it still means the same instant after a restart or a reboot.
+     */
+    inline uint64_t to_wall(uint64_t deadline_ns) noexcept {
+        if (deadline_ns == NONE) {
+            return NONE;
         }
-        return hash;
+        auto remaining = static_cast<int64_t>(deadline_ns - now());
+        return static_cast<uint64_t>(static_cast<int64_t>(wall_now()) + remaining);
     }
-};
+
+    /***
+     * The wall-clock instant written by `to_wall` as a deadline; one already past is expired.
+     */
+    inline uint64_t from_wall(uint64_t wall_ns) noexcept {
+        if (wall_ns == NONE) {
+            return NONE;
+        }
+        auto remaining = static_cast<int64_t>(wall_ns - wall_now());
+        uint64_t current = now();
+        return remaining > 0 ? current + static_cast<uint64_t>(remaining) : std::max<uint64_t>(current, 1);
+    }
+
+}
 
 [[noreturn]] void panic(const char* msg) {
     perror(msg);
@@ -0,0 +1,160 @@
+#ifndef ASSIGNMENT_2_DOORBELL_HPP
+#define ASSIGNMENT_2_DOORBELL_HPP
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include "Common.hpp"
+
+/***
+ * A doorbell is a file descriptor that becomes readable when the other side of the
+ * shared memory queue has published something for us. It lets a process wait for
+ * shared memory completions from an `epoll`/`kqueue` event loop, instead of parking
+ * a thread inside `pthread_cond_wait`.
+ *
+ * On Linux it is backed by an `eventfd` (the wait and ring descriptors are the same),
+ * elsewhere by a non-blocking pipe.
+ */
+class Doorbell {
+
+public:
+
+    Doorbell() {
+        #ifdef __linux__
+        if ((m_wait_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+            panic("[doorbell] :: error while invoking eventfd");
+        }
+        m_ring_fd = m_wait_fd;
+        #else
+        int fds[2];
+        if (pipe(fds) == -1) {
+            panic("[doorbell] :: error while invoking pipe");
+        }
+        for (int fd: fds) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        m_wait_fd = fds[0];
+        m_ring_fd = fds[1];
+        #endif
+    }
+
+    ~Doorbell() {
+        if (m_ring_fd != m_wait_fd) {
+            close(m_ring_fd);
+        }
+        close(m_wait_fd);
+    }
+
+    Doorbell(const Doorbell&) = delete;
+    Doorbell& operator=(const Doorbell&) = delete;
+
+    /***
+     * The descriptor to register inside an event loop, it becomes readable once rung.
+     */
+    int wait_fd() const { return m_wait_fd; }
+
+    /***
+     * The descriptor that has to be handed over to the process ringing the doorbell.
+     */
+    int ring_fd() const { return m_ring_fd; }
+
+    /***
+     * Consume all the pending rings, so the wait descriptor is not readable anymore.
+     */
+    void drain() const noexcept {
+        uint64_t buffer[8];
+        while (read(m_wait_fd, buffer, sizeof(buffer)) > 0) {}
+    }
+
+    /***
+     * Ring the doorbell identified by the given descriptor. A full doorbell is
+     * already readable, hence `EAGAIN` is not an error.
+     * @param ring_fd
+     */
+    static void ring(int ring_fd) noexcept {
+        #ifdef __linux__
+        uint64_t value = 1;
+        #else
+        uint8_t value = 1;
+        #endif
+        while (write(ring_fd, &value, sizeof(value)) == -1 && errno == EINTR) {}
+    }
+
+    /***
+     * Send a file descriptor, together with an integer payload, over a unix socket.
+     * @param socket
+     * @param fd
+     * @param payload
+     * @return True if the descriptor has been sent, false otherwise.
+     */
+    static bool send_fd(int socket, int fd, int payload) noexcept {
+
+        char control[CMSG_SPACE(sizeof(int))];
+        std::memset(control, 0, sizeof(control));
+
+        iovec io{.iov_base = &payload, .iov_len = sizeof(payload)};
+
+        msghdr msg{};
+        msg.msg_iov = &io;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+        return sendmsg(socket, &msg, 0) == sizeof(payload);
+    }
+
+    /***
+     * Receive a file descriptor sent through `send_fd`.
+     * @param socket
+     * @param payload Filled with the integer sent alongside the descriptor.
+     * @return The received descriptor, or -1 in case of error.
+     */
+    static int receive_fd(int socket, int* payload) noexcept {
+
+        char control[CMSG_SPACE(sizeof(int))];
+        std::memset(control, 0, sizeof(control));
+
+        iovec io{.iov_base = payload, .iov_len = sizeof(*payload)};
+
+        msghdr msg{};
+        msg.msg_iov = &io;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(socket, &msg, 0) != sizeof(*payload)) {
+            return -1;
+        }
+
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg == nullptr || cmsg->cmsg_type != SCM_RIGHTS) {
+            return -1;
+        }
+
+        int fd;
+        std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        return fd;
+    }
+
+private:
+    int m_wait_fd{-1};
+    int m_ring_fd{-1};
+};
+
+#endif //ASSIGNMENT_2_DOORBELL_HPP
@@ -2,7 +2,14 @@
 #define ASSIGNMENT_2_PROTOCOL_HPP
 
 #include <fcntl.h>
+#include <signal.h>
 #include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <optional>
+
 #include "RingBuffer.hpp"
 
 namespace protocol {
@@ -13,49 +20,123 @@ namespace protocol {
     static constexpr const char *SHM_FILENAME = "/shm-queue";
     #endif
 
+    // Unix socket used to exchange the doorbells' descriptors
+    static constexpr const char* DOORBELL_SOCKET = "/tmp/shm-queue.sock";
+
+    /***
+     * The fields are laid out from the largest to the smallest, and the arguments of the
+     * different request types share the same word: with integer keys and values a request
+     * fits a cache line.
+     */
     template <typename Key, typename Value>
     struct RequestMessage {
 
-        enum class Type { Read, Insert, Remove };
+        enum class Type : uint8_t {
+            Read, Insert, Remove, Flush,
+            // Read-modify-write requests, applied atomically and answered with a single response
+            CompareAndSwap, FetchAdd, Append, GetAndSet,
+            // Fill one of the client's scan batches with the pairs following the cursor
+            Scan
+        };
+
+        // Identifier chosen by the client, echoed back inside the response
+        uint64_t m_request_id{0};
+
+        // The client gives up on the request after the deadline (`deadline::NONE` if never),
+        // the server drops it without serving if it is already expired.
+        uint64_t m_deadline{deadline::NONE};
+
+        union {
+            // For a `Flush` request: how many asynchronous writes the client sent so far
+            uint64_t m_sequence{0};
+            // For an `Insert` request: when the pair expires (`deadline::NONE` if never)
+            uint64_t m_expires_at;
+            // For a `FetchAdd` request: what is added to the value
+            int64_t m_delta;
+            // For a `Scan` request: where to continue from (see `ScanBatch`)
+            uint64_t m_cursor;
+        };
+
+        Key m_key{};
+        Value m_value{};
+
+        // For a `CompareAndSwap` request: the value `m_value` replaces
+        Value m_expected{};
 
         // Which client sent the message to the server
         int m_from_client_id{-1};
-        bool m_async{false};
 
-        Type m_type;
+        // For a `Scan` request: the pairs of the cursor's slots to skip, and which batch to fill
+        uint32_t m_skip{0};
+        uint8_t m_batch{0};
 
-        Key m_key;
-        Value m_value;
+        Type m_type;
+        bool m_async{false};
 
         RequestMessage() {}
 
-        RequestMessage(int client_id, Type type, Key key, Value val, bool async = false) : m_from_client_id{client_id}, m_type{type},
-            m_key{key}, m_value{val}, m_async{async} {}
+        RequestMessage(int client_id, Type type, Key key, Value val, bool async = false) : m_key{key}, m_value{val},
+            m_from_client_id{client_id}, m_type{type}, m_async{async} {}
 
-        RequestMessage(int client_id, Type type, Key key, bool async = false) : m_from_client_id{client_id},
-            m_type{type}, m_key{key}, m_async{async} {}
+        RequestMessage(int client_id, Type type, Key key, bool async = false) : m_key{key},
+            m_from_client_id{client_id}, m_type{type}, m_async{async} {}
 
     };
 
     template <typename Value>
     struct ResponseMessage {
 
-        enum class Type {
-            Acknowledgment, SuccessfulRead, FailedRead
+        enum class Type : uint8_t {
+            Acknowledgment, SuccessfulRead, FailedRead,
+            // A read-modify-write request that left the value unchanged, `m_value` is the current one;
+            // or an insert that could not be applied
+            FailedUpdate
         };
 
+        // The identifier of the request the message is answering to
+        uint64_t m_request_id{0};
+
+        // For the acknowledgement of a `Flush` request: how many asynchronous writes have been applied
+        uint64_t m_sequence{0};
+
+        Value m_value{};
+
         // To which client is the message referred to
         int m_dest_client{-1};
 
         Type m_type;
-        Value m_value;
 
         ResponseMessage() {}
 
         ResponseMessage(int dest_client_id, Type type = Type::Acknowledgment) : m_dest_client{dest_client_id}, m_type{type} {}
 
-        ResponseMessage(int dest_client_id, Type type, Value val) : m_dest_client{dest_client_id},
-            m_type{type}, m_value{val} {}
+        ResponseMessage(int dest_client_id, Type type, Value val) : m_value{val}, m_dest_client{dest_client_id},
+            m_type{type} {}
+    };
+
+    /***
+     * A batch of pairs produced by a `Scan` request, inside the client's transfer area.
+     * The next batch starts from the table's cursor, skipping the pairs of its slots that
+     * are already in this batch (the slots larger than a batch are split).
+     */
+    template <typename Key, typename Value>
+    struct ScanBatch {
+
+        static constexpr size_t CAPACITY = 128;
+
+        struct Entry {
+            Key m_key;
+            Value m_value;
+        };
+
+        // Both zero once the scan is complete
+        uint64_t m_cursor{0};
+        uint64_t m_skip{0};
+
+        size_t m_count{0};
+        std::array<Entry, CAPACITY> m_entries{};
+
+        bool is_last() const { return m_cursor == 0 && m_skip == 0; }
     };
 
     template <typename Key, typename Value, size_t QueueSize = 64>
@@ -64,23 +145,88 @@ namespace protocol {
         using ReqMessage = RequestMessage<Key, Value>;
         using ResMessage = ResponseMessage<Value>;
 
-        struct WrapperResMessage {
-            bool m_valid{false};
-            ResMessage m_msg;
-        };
+        // How many clients can be connected at the same time to the server
+        static constexpr size_t MAX_CLIENTS = 64;
+
+        // The server and the clients must agree on the keys' and values' types
+        uint32_t m_key_size{sizeof(Key)};
+        uint32_t m_value_size{sizeof(Value)};
+
+        // Whether the server's table lets the inserted pairs expire (see `m_expires_at`)
+        bool m_expirations{false};
+
+        // The requests are stamped when enqueued, for the server's statistics
+        using Requests = RingBuffer<ReqMessage, QueueSize, true>;
+        Requests m_requests{};
+
+        // Every client owns a response queue, so a client never has to look at
+        // (or wait behind) the answers addressed to someone else.
+        std::array<RingBuffer<ResMessage, QueueSize>, MAX_CLIENTS> m_responses{};
+
+        // The process owning each client id, 0 if free: the ids of the processes that died
+        // without releasing them are reclaimed
+        std::array<std::atomic<pid_t>, MAX_CLIENTS> m_clients{};
+
+        // Bumped each time a client id is handed out: the owner's request ids start with it (see
+        // `first_request_id`), so the owner can tell the responses meant for a previous one
+        std::array<std::atomic_uint32_t, MAX_CLIENTS> m_generations{};
+
+        // How many asynchronous writes of each client have been applied by the server
+        std::array<std::atomic_uint64_t, MAX_CLIENTS> m_async_applied{};
 
-        RingBuffer<ReqMessage, QueueSize> m_requests{};
-        RingBuffer<WrapperResMessage , QueueSize> m_responses{};
+        // Transfer area of the scans: the server fills a client's batch while the client
+        // reads the other one
+        std::array<std::array<ScanBatch<Key, Value>, 2>, MAX_CLIENTS> m_scan_batches{};
 
-        std::atomic_int m_curr_id{0};
+        //region Doorbells coalescing flags
+        // A flag is set when the corresponding doorbell has been rung and the waiting
+        // side has not consumed it yet: while it is set, nobody rings the doorbell again.
+        // The flags start set, so no doorbell is rung until someone is listening to it.
+        std::atomic_bool m_request_pending{true};
+        std::array<std::atomic_bool, MAX_CLIENTS> m_response_pending{};
+        //endregion
 
         SharedMessageQueue() { }
 
         /***
-         * Function used by a client to register itself to the shared queue.
-         * @return
+         * Function used by a client to register itself to the shared queue: it takes a free
+         * id, or the id of a client that died. The responses the previous owner left behind
+         * are dropped.
+         * @return The client id, or -1 if too many clients are connected.
          */
-        int get_client_id() { return m_curr_id++; }
+        int get_client_id() {
+            pid_t self = getpid();
+            for (size_t id = 0; id < MAX_CLIENTS; id++) {
+                pid_t owner = m_clients[id].load();
+                if (owner != 0 && is_alive(owner)) {
+                    continue;
+                }
+                if (m_clients[id].compare_exchange_strong(owner, self)) {
+                    while (m_responses[id].try_pop()) {}
+                    m_generations[id]++;
+                    m_response_pending[id] = true;
+                    m_async_applied[id] = 0;
+                    return static_cast<int>(id);
+                }
+            }
+            return -1;
+        }
+
+        /***
+         * Function used by a client to unregister itself from the shared queue.
+         * @param client_id
+         */
+        void release_client_id(int client_id) {
+            m_clients[client_id] = 0;
+        }
+
+        /***
+         * The first request id of the client id's current owner: the responses with a request
+         * id below it (for a previous owner) are to be skipped.
+         */
+        uint64_t first_request_id(int client_id) const {
+            return static_cast<uint64_t>(m_generations[client_id].load()) << 32;
+        }
 
         /***
          * Send a request message for the server (for Messages that
@@ -91,32 +237,108 @@ namespace protocol {
             m_requests.put(msg);
         }
 
+        bool send_request_until(ReqMessage msg, uint64_t deadline_ns) noexcept {
+            return m_requests.put_until(msg, deadline_ns);
+        }
+
+        bool try_send_request(ReqMessage msg) noexcept {
+            return m_requests.try_put(msg);
+        }
+
         ReqMessage receive_request() noexcept {
             return m_requests.pop();
         }
 
-        ResMessage send_waiting_request(ReqMessage snd) noexcept {
+        /***
+         * @param dequeued Filled in with the request's enqueue time and the depth of the queue.
+         */
+        ReqMessage receive_request(typename Requests::Dequeued& dequeued) noexcept {
+            return m_requests.pop(dequeued);
+        }
 
-            int client_id = snd.m_from_client_id;
+        std::optional<ReqMessage> try_receive_request(typename Requests::Dequeued* dequeued = nullptr) noexcept {
+            return m_requests.try_pop(dequeued);
+        }
+
+        /***
+         * Dequeue up to `max` requests at once, waiting for at least one.
+         * @param dequeued Filled in for each request with its enqueue time and the depth of the queue.
+         * @return How many requests have been dequeued.
+         */
+        size_t receive_requests(ReqMessage* requests, typename Requests::Dequeued* dequeued, size_t max) noexcept {
+            return m_requests.pop_batch(requests, dequeued, max);
+        }
+
+        size_t try_receive_requests(ReqMessage* requests, typename Requests::Dequeued* dequeued, size_t max) noexcept {
+            return m_requests.try_pop_batch(requests, dequeued, max);
+        }
+
+        /***
+         * Whether there may be requests in the queue, without locking it (for busy polling).
+         */
+        bool requests_pending() const noexcept {
+            return m_requests.approximate_size() != 0;
+        }
+
+        ResMessage send_waiting_request(ReqMessage snd) noexcept {
 
             // Send the normal request to the server
             send_request(snd);
 
-            // Now we should wait for the answer, we use the response queue.
-            auto incoming_msg = m_responses.conditional_pop([client_id](const WrapperResMessage& head) -> bool {
-                return client_id != head.m_msg.m_dest_client && !head.m_valid;
-            }, [](WrapperResMessage& head) {
-                head.m_valid = false;
-            });
+            // Now we should wait for the answer, we use the client's response queue.
+            return receive_response(snd.m_from_client_id);
+        }
+
+        ResMessage receive_response(int client_id) noexcept {
+            return m_responses[client_id].pop();
+        }
+
+        std::optional<ResMessage> receive_response_until(int client_id, uint64_t deadline_ns) noexcept {
+            return m_responses[client_id].pop_until(deadline_ns);
+        }
+
+        std::optional<ResMessage> try_receive_response(int client_id) noexcept {
+            return m_responses[client_id].try_pop();
+        }
+
+        /***
+         * Enqueue the response in the client's queue.
+         * @param msg
+         * @param deadline_ns Once expired the response is dropped: the client is not waiting anymore,
+         * or it does not consume its queue.
+         * @return False if the response has been dropped.
+         */
+        bool answer_pending_request(ResMessage msg, uint64_t deadline_ns = deadline::NONE) noexcept {
+            return m_responses[msg.m_dest_client].put_until(msg, deadline_ns);
+        }
 
-            return incoming_msg.m_msg;
+        /***
+         * Enqueue responses for the same client at once, as many as there are free slots for.
+         * @return How many responses have been enqueued, the following ones have to be sent
+         * one by one.
+         */
+        size_t try_answer_pending_requests(int client_id, const ResMessage* responses, size_t count) noexcept {
+            return m_responses[client_id].try_put_batch(responses, count);
+        }
+
+        /***
+         * Mark the request doorbell as rung.
+         * @return True if the caller is in charge of ringing it, false if it is already pending.
+         */
+        bool arm_request_doorbell() noexcept {
+            return !m_request_pending.exchange(true);
+        }
+
+        /***
+         * Mark the response doorbell of the given client as rung.
+         * @return True if the caller is in charge of ringing it, false if it is already pending.
+         */
+        bool arm_response_doorbell(int client_id) noexcept {
+            return !m_response_pending[client_id].exchange(true);
         }
 
-        void answer_pending_request(ResMessage msg) noexcept {
-            m_responses.put(WrapperResMessage {
-                    .m_valid = true,
-                    .m_msg = msg
-            });
+        static bool is_alive(pid_t pid) noexcept {
+            return kill(pid, 0) == 0 || errno != ESRCH;
         }
 
     };
@@ -1,16 +1,32 @@
 #ifndef ASSIGNMENT_2_RINGBUFFER_HPP
 #define ASSIGNMENT_2_RINGBUFFER_HPP
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cerrno>
+#include <optional>
 
 #include <pthread.h>
 #include "Common.hpp"
 
-template<typename T, size_t BuffSize = 64>
+/***
+ * @tparam Stamped Record when each element is inserted (see `Dequeued`), for the statistics.
+ */
+template<typename T, size_t BuffSize = 64, bool Stamped = false>
 class RingBuffer {
 
 public:
 
+    /***
+     * What a pop tells besides the element: when it has been inserted (on the deadline
+     * clock, zero if the buffer is not `Stamped`), and how many elements were left behind it.
+     */
+    struct Dequeued {
+        uint64_t m_enqueued_at{0};
+        size_t m_depth{0};
+    };
+
     RingBuffer() {
 
         //region Initialize mutex
@@ -22,12 +38,18 @@ public:
         //region Initialize `full` condition variable
         pthread_condattr_init(&m_cond_attr_full);
         pthread_condattr_setpshared(&m_cond_attr_full, PTHREAD_PROCESS_SHARED);
+        #ifndef __APPLE__
+        pthread_condattr_setclock(&m_cond_attr_full, deadline::CLOCK);
+        #endif
         pthread_cond_init(&m_cond_full, &m_cond_attr_full);
         //endregion
 
         //region Initialize `empty` condition variable
         pthread_condattr_init(&m_cond_attr_empty);
         pthread_condattr_setpshared(&m_cond_attr_empty, PTHREAD_PROCESS_SHARED);
+        #ifndef __APPLE__
+        pthread_condattr_setclock(&m_cond_attr_empty, deadline::CLOCK);
+        #endif
         pthread_cond_init(&m_cond_empty, &m_cond_attr_empty);
         //endregion
 
@@ -52,32 +74,37 @@ public:
     }
 
     void put(T element) {
+        put_until(element, deadline::NONE);
+    }
+
+    /***
+     * Insert the element, waiting for a free slot until the deadline expires.
+     * @param element
+     * @param deadline_ns Absolute deadline (see `deadline::now`), `deadline::NONE` to wait forever.
+     * @return False if the deadline expired before the element could be inserted.
+     */
+    bool put_until(T element, uint64_t deadline_ns) {
+
+        uint64_t enqueued_at = Stamped ? deadline::now() : 0;
 
         if (pthread_mutex_lock(&m_mutex) != 0) {
             panic("Error while locking the RingBuffer's mutex");
         }
 
         while (is_full()) {
-            if (pthread_cond_wait(&m_cond_empty, &m_mutex) != 0) {
-                if (errno != ETIMEDOUT) {
-                    panic("Error while waiting for `empty` condition variable");
-                }
-                else {
-                    if (pthread_mutex_unlock(&m_mutex) != 0) {
-                        panic("Error while unlocking the RingBuffer's mutex");
-                    }
-                    if (pthread_mutex_lock(&m_mutex) != 0) {
-                        panic("Error while locking the RingBuffer's mutex");
-                    }
-
+            if (!wait(&m_cond_empty, deadline_ns)) {
+                if (pthread_mutex_unlock(&m_mutex) != 0) {
+                    panic("Error while unlocking the RingBuffer's mutex");
                 }
+                return false;
             }
         }
 
         //region Critical Section
         m_buffer[m_tail] = element;
+        m_enqueued_at[m_tail] = enqueued_at;
         m_tail = (m_tail + 1) % BuffSize;
-        m_count++;
+        m_count.fetch_add(1, std::memory_order_relaxed);
         //endregion
 
         if (pthread_cond_signal(&m_cond_full) != 0) {
@@ -87,29 +114,35 @@ public:
         if (pthread_mutex_unlock(&m_mutex) != 0) {
             panic("Error while locking the RingBuffer's mutex");
         }
+
+        return true;
     }
 
     template <typename Predicate, typename PostEffect>
     T conditional_pop(Predicate predicate, PostEffect effect) {
-        T elem;
+        return conditional_pop_until(predicate, effect, deadline::NONE).value();
+    }
+
+    /***
+     * Pop the head of the buffer once it satisfies the predicate, waiting until the deadline expires.
+     * @param deadline_ns Absolute deadline (see `deadline::now`), `deadline::NONE` to wait forever.
+     * @param dequeued If not null, filled in with the element's insertion time and the buffer's depth.
+     * @return The head of the buffer, otherwise a None option if the deadline expired.
+     */
+    template <typename Predicate, typename PostEffect>
+    std::optional<T> conditional_pop_until(Predicate predicate, PostEffect effect, uint64_t deadline_ns, Dequeued* dequeued = nullptr) {
+        std::optional<T> elem{};
 
         if (pthread_mutex_lock(&m_mutex) != 0) {
             panic("Error while locking the RingBuffer's mutex");
         }
 
         while (is_empty() || predicate(m_buffer[m_head])) {
-            if (pthread_cond_wait(&m_cond_full, &m_mutex) != 0) {
-                if (errno != ETIMEDOUT) {
-                    panic("Error while waiting for `full` condition variable");
-                }
-                else {
-                    if (pthread_mutex_unlock(&m_mutex) != 0) {
-                        panic("Error while locking the RingBuffer's mutex");
-                    }
-                    if (pthread_mutex_lock(&m_mutex) != 0) {
-                        panic("Error while locking the RingBuffer's mutex");
-                    }
+            if (!wait(&m_cond_full, deadline_ns)) {
+                if (pthread_mutex_unlock(&m_mutex) != 0) {
+                    panic("Error while locking the RingBuffer's mutex");
                 }
+                return elem;
             }
         }
 
@@ -117,8 +150,11 @@ public:
         effect(m_buffer[m_head]);
 
         elem = std::move(m_buffer[m_head]);
+        if (dequeued != nullptr) {
+            *dequeued = Dequeued{m_enqueued_at[m_head], m_count.load(std::memory_order_relaxed) - 1};
+        }
         m_head = (m_head + 1) % BuffSize;
-        m_count--;
+        m_count.fetch_sub(1, std::memory_order_relaxed);
         //endregion
 
         if (pthread_cond_signal(&m_cond_empty) != 0) {
@@ -136,14 +172,181 @@ public:
         return conditional_pop([](const T& head) -> bool {return false;}, [](const T& head){});
     }
 
+    T pop(Dequeued& dequeued) {
+        return conditional_pop_until([](const T& head) -> bool {return false;}, [](const T& head){}, deadline::NONE, &dequeued).value();
+    }
+
+    std::optional<T> pop_until(uint64_t deadline_ns) {
+        return conditional_pop_until([](const T& head) -> bool {return false;}, [](const T& head){}, deadline_ns);
+    }
+
+    /***
+     * Non-blocking version of `put`.
+     * @param element
+     * @return False if the buffer is full, true if the element has been inserted.
+     */
+    bool try_put(T element) {
+
+        uint64_t enqueued_at = Stamped ? deadline::now() : 0;
+
+        if (pthread_mutex_lock(&m_mutex) != 0) {
+            panic("Error while locking the RingBuffer's mutex");
+        }
+
+        bool inserted = !is_full();
+
+        if (inserted) {
+            //region Critical Section
+            m_buffer[m_tail] = element;
+            m_enqueued_at[m_tail] = enqueued_at;
+            m_tail = (m_tail + 1) % BuffSize;
+            m_count.fetch_add(1, std::memory_order_relaxed);
+            //endregion
+
+            if (pthread_cond_signal(&m_cond_full) != 0) {
+                panic("Error while sending signal for `empty` condition variable");
+            }
+        }
+
+        if (pthread_mutex_unlock(&m_mutex) != 0) {
+            panic("Error while locking the RingBuffer's mutex");
+        }
+
+        return inserted;
+    }
+
+    /***
+     * Non-blocking version of `pop`.
+     * @param dequeued If not null, filled in with the element's insertion time and the buffer's depth.
+     * @return The head of the buffer, otherwise a None option if the buffer is empty.
+     */
+    std::optional<T> try_pop(Dequeued* dequeued = nullptr) {
+
+        std::optional<T> elem{};
+
+        if (pthread_mutex_lock(&m_mutex) != 0) {
+            panic("Error while locking the RingBuffer's mutex");
+        }
+
+        if (!is_empty()) {
+            //region Critical section
+            elem = std::move(m_buffer[m_head]);
+            if (dequeued != nullptr) {
+                *dequeued = Dequeued{m_enqueued_at[m_head], m_count.load(std::memory_order_relaxed) - 1};
+            }
+            m_head = (m_head + 1) % BuffSize;
+            m_count.fetch_sub(1, std::memory_order_relaxed);
+            //endregion
+
+            if (pthread_cond_signal(&m_cond_empty) != 0) {
+                panic("Error while sending signal for `full` condition variable");
+            }
+        }
+
+        if (pthread_mutex_unlock(&m_mutex) != 0) {
+            panic("Error while locking the RingBuffer's mutex");
+        }
+
+        return elem;
+    }
+
+    /***
+     * Pop up to `max` elements at once, waiting until there is at least one: the mutex is
+     * taken, and the producers waiting for a free slot are woken up, once for all of them.
+     * @param dequeued If not null, filled in for each element (see `Dequeued`).
+     * @return How many elements have been popped, at least one.
+     */
+    size_t pop_batch(T* elements, Dequeued* dequeued, size_t max) {
+
+        if (pthread_mutex_lock(&m_mutex) != 0) {
+            panic("Error while locking the RingBuffer's mutex");
+        }
+
+        while (is_empty()) {
+            wait(&m_cond_full, deadline::NONE);
+        }
+
+        size_t popped = pop_locked(elements, dequeued, max);
+
+        if (pthread_mutex_unlock(&m_mutex) != 0) {
+            panic("Error while locking the RingBuffer's mutex");
+        }
+
+        return popped;
+    }
+
+    /***
+     * Non-blocking version of `pop_batch`.
+     * @return How many elements have been popped, zero if the buffer is empty.
+     */
+    size_t try_pop_batch(T* elements, Dequeued* dequeued, size_t max) {
+
+        if (pthread_mutex_lock(&m_mutex) != 0) {
+            panic("Error while locking the RingBuffer's mutex");
+        }
+
+        size_t popped = pop_locked(elements, dequeued, max);
+
+        if (pthread_mutex_unlock(&m_mutex) != 0) {
+            panic("Error while locking the RingBuffer's mutex");
+        }
+
+        return popped;
+    }
+
+    /***
+     * Insert as many of the elements as there are free slots for, in order, without waiting:
+     * the mutex is taken, and the consumers are woken up, once for all of them.
+     * @return How many elements have been inserted.
+     */
+    size_t try_put_batch(const T* elements, size_t count) {
+
+        uint64_t enqueued_at = Stamped ? deadline::now() : 0;
+
+        if (pthread_mutex_lock(&m_mutex) != 0) {
+            panic("Error while locking the RingBuffer's mutex");
+        }
+
+        size_t inserted = std::min(count, BuffSize - m_count.load(std::memory_order_relaxed));
+
+        //region Critical Section
+        for (size_t i = 0; i < inserted; i++) {
+            m_buffer[m_tail] = elements[i];
+            m_enqueued_at[m_tail] = enqueued_at;
+            m_tail = (m_tail + 1) % BuffSize;
+        }
+        m_count.fetch_add(inserted, std::memory_order_relaxed);
+        //endregion
+
+        if (inserted != 0 && wake(&m_cond_full, inserted) != 0) {
+            panic("Error while sending signal for `empty` condition variable");
+        }
+
+        if (pthread_mutex_unlock(&m_mutex) != 0) {
+            panic("Error while locking the RingBuffer's mutex");
+        }
+
+        return inserted;
+    }
+
+    /***
+     * How many elements the buffer holds, read without taking the mutex: it can be stale
+     * already, it only lets a poller skip locking an empty buffer.
+     */
+    size_t approximate_size() const noexcept {
+        return m_count.load(std::memory_order_relaxed);
+    }
 
 private:
     std::array<T, BuffSize> m_buffer;
+    // When each element has been inserted, if `Stamped`
+    std::array<uint64_t, BuffSize> m_enqueued_at{};
 
     size_t m_head{0};
     size_t m_tail{0};
 
-    size_t m_count{0};
+    // Updated with the mutex held, it can be read without (see `approximate_size`)
+    std::atomic_size_t m_count{0};
 
     pthread_mutex_t m_mutex;
     pthread_mutexattr_t m_mutex_attr;
@@ -154,9 +357,67 @@ private:
     pthread_cond_t m_cond_empty;
     pthread_condattr_t m_cond_attr_empty;
 
-    inline bool is_empty() { return m_count == 0; }
+    inline bool is_empty() { return m_count.load(std::memory_order_relaxed) == 0; }
+
+    /***
+     * Pop up to `max` elements, with the mutex held.
+     */
+    size_t pop_locked(T* elements, Dequeued* dequeued, size_t max) {
+
+        size_t count = m_count.load(std::memory_order_relaxed);
+        size_t popped = std::min(count, max);
+
+        //region Critical section
+        for (size_t i = 0; i < popped; i++) {
+            elements[i] = std::move(m_buffer[m_head]);
+            if (dequeued != nullptr) {
+                dequeued[i] = Dequeued{m_enqueued_at[m_head], count - i - 1};
+            }
+            m_head = (m_head + 1) % BuffSize;
+        }
+        m_count.fetch_sub(popped, std::memory_order_relaxed);
+        //endregion
+
+        if (popped != 0 && wake(&m_cond_empty, popped) != 0) {
+            panic("Error while sending signal for `full` condition variable");
+        }
+
+        return popped;
+    }
+
+    /***
+     * Wake up as many waiters as there are elements (or free slots) for.
+     */
+    static int wake(pthread_cond_t* cond, size_t count) {
+        return count == 1 ? pthread_cond_signal(cond) : pthread_cond_broadcast(cond);
+    }
+
+    /***
+     * Wait on the condition variable, with the mutex held.
+     * @return False if the deadline expired.
+     */
+    bool wait(pthread_cond_t* cond, uint64_t deadline_ns) {
+
+        if (deadline_ns == deadline::NONE) {
+            if (pthread_cond_wait(cond, &m_mutex) != 0) {
+                panic("Error while waiting for the RingBuffer's condition variable");
+            }
+            return true;
+        }
+
+        auto abs_time = deadline::to_timespec(deadline_ns);
+        int err = pthread_cond_timedwait(cond, &m_mutex, &abs_time);
+
+        if (err == ETIMEDOUT) {
+            return false;
+        }
+        if (err != 0) {
+            panic("Error while waiting for the RingBuffer's condition variable");
+        }
+        return true;
+    }
 
-    inline bool is_full() {  return (m_count == BuffSize); }
+    inline bool is_full() {  return (m_count.load(std::memory_order_relaxed) == BuffSize); }
 
 };
 
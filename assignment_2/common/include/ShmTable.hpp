@@ -0,0 +1,262 @@
+#ifndef ASSIGNMENT_2_SHMTABLE_HPP
+#define ASSIGNMENT_2_SHMTABLE_HPP
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <type_traits>
+
+#include "Common.hpp"
+
+namespace shm_table {
+
+    // Segment naming the current generation of the table
+    static constexpr const char* CONTROL_SHM_FILENAME = "/shm-table";
+
+    // The null offset
+    static constexpr uint32_t NIL = 0;
+
+    inline std::string segment_name(uint64_t generation) {
+        return std::string{CONTROL_SHM_FILENAME} + "-" + std::to_string(generation);
+    }
+
+    struct Control {
+        std::atomic_uint64_t m_generation{0};
+    };
+
+    /***
+     * A stripe's version: odd while the server is modifying one of its slots.
+     */
+    struct alignas(64) Stripe {
+        std::atomic_uint64_t m_version{0};
+    };
+
+    template <typename Key, typename Value>
+    struct Node {
+        std::atomic_uint32_t m_next{NIL};
+        uint64_t m_hash;
+        Key m_key;
+        Value m_value;
+    };
+
+    /***
+     * A generation of the table, mapped by the server and by the clients. Every process
+     * maps it at a different address, hence the links are offsets (node index + 1)
+     * instead of pointers. The header is followed by the stripes, the slots and the nodes.
+     * The segment never grows: the server builds a new generation instead, and marks
+     * this one as stale.
+     */
+    template <typename Key, typename Value>
+    struct Segment {
+
+        static_assert(std::is_trivially_destructible_v<Key> && std::is_trivially_destructible_v<Value>,
+                      "the shared table stores flat keys and values");
+
+        using Node = shm_table::Node<Key, Value>;
+
+        // Number of slots, a power of two
+        uint64_t m_capacity;
+        uint64_t m_node_capacity;
+        uint64_t m_stripe_count;
+
+        std::atomic_bool m_stale{false};
+        std::atomic_uint64_t m_size{0};
+
+        // List of the free nodes, it is only used by the server
+        std::atomic_flag m_free_lock = ATOMIC_FLAG_INIT;
+        uint32_t m_free_head{NIL};
+        uint32_t m_unused_nodes{0};
+
+        Segment(uint64_t capacity, uint64_t node_capacity, uint64_t stripe_count) :
+            m_capacity{capacity}, m_node_capacity{node_capacity}, m_stripe_count{stripe_count}, m_unused_nodes{static_cast<uint32_t>(node_capacity)} {}
+
+        static std::size_t bytes(uint64_t capacity, uint64_t node_capacity, uint64_t stripe_count) {
+            return stripes_offset() + stripe_count * sizeof(Stripe) + slots_bytes(capacity) + node_capacity * sizeof(Node);
+        }
+
+        Stripe* stripes() { return reinterpret_cast<Stripe*>(reinterpret_cast<char*>(this) + stripes_offset()); }
+
+        std::atomic_uint32_t* slots() { return reinterpret_cast<std::atomic_uint32_t*>(stripes() + m_stripe_count); }
+
+        Node& node(uint32_t offset) {
+            auto nodes = reinterpret_cast<Node*>(reinterpret_cast<char*>(slots()) + slots_bytes(m_capacity));
+            return nodes[offset - 1];
+        }
+
+        std::size_t index(uint64_t hashed) const { return hashed & (m_capacity - 1); }
+
+        Stripe& stripe(uint64_t hashed) { return stripes()[hashed & (m_stripe_count - 1)]; }
+
+        /***
+         * Look for the key, either with the stripe held by the server or inside an
+         * optimistic read. At most `m_node_capacity` nodes are visited, so a torn read
+         * cannot loop forever on nodes being recycled.
+         */
+        std::optional<Value> find(uint64_t hashed, const Key& key) {
+            uint32_t offset = slots()[index(hashed)].load(std::memory_order_acquire);
+            for (uint64_t steps = 0; offset != NIL && offset <= m_node_capacity && steps < m_node_capacity; steps++) {
+                Node& n = node(offset);
+                if (n.m_hash == hashed && n.m_key == key) {
+                    return std::optional{n.m_value};
+                }
+                offset = n.m_next.load(std::memory_order_acquire);
+            }
+            return {};
+        }
+
+        /***
+         * Lockless lookup validated against the stripe's version and the segment's staleness.
+         * @return None if it could not be validated within the given attempts, otherwise the lookup's result.
+         */
+        std::optional<std::optional<Value>> optimistic_find(uint64_t hashed, const Key& key, int attempts) {
+
+            Stripe& s = stripe(hashed);
+
+            for (int attempt = 0; attempt < attempts; attempt++) {
+
+                auto version = s.m_version.load(std::memory_order_acquire);
+                if (version & 1) {
+                    continue;
+                }
+
+                auto value = find(hashed, key);
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (s.m_version.load(std::memory_order_relaxed) == version && !m_stale.load(std::memory_order_relaxed)) {
+                    return std::optional{value};
+                }
+            }
+
+            return {};
+        }
+
+    private:
+
+        static constexpr std::size_t stripes_offset() {
+            return (sizeof(Segment) + alignof(Stripe) - 1) / alignof(Stripe) * alignof(Stripe);
+        }
+
+        static std::size_t slots_bytes(uint64_t capacity) {
+            auto bytes = capacity * sizeof(std::atomic_uint32_t);
+            return (bytes + alignof(Node) - 1) / alignof(Node) * alignof(Node);
+        }
+    };
+
+    /***
+     * Map a shared memory object entirely.
+     * @return The mapped address and its size, or nullptr if the object does not exist.
+     */
+    inline std::pair<void*, std::size_t> map(const char* name, int flags) {
+
+        int fd;
+        if ((fd = shm_open(name, flags, S_IRUSR | S_IWUSR)) == -1) {
+            return {nullptr, 0};
+        }
+
+        struct stat st{};
+        if (fstat(fd, &st) == -1 || st.st_size == 0) {
+            close(fd);
+            return {nullptr, 0};
+        }
+
+        int protection = (flags & O_ACCMODE) == O_RDONLY ? PROT_READ : PROT_READ | PROT_WRITE;
+        void* addr = mmap(nullptr, st.st_size, protection, MAP_SHARED, fd, 0);
+        close(fd);
+
+        if (addr == MAP_FAILED) {
+            return {nullptr, 0};
+        }
+
+        return {addr, static_cast<std::size_t>(st.st_size)};
+    }
+
+    /***
+     * Client side of the table: one-sided reads straight from the shared memory, without
+     * any message to the server. The segments are mapped read-only.
+     */
+    template <typename Key, typename Value, typename Hash = hashing::Default<Key>>
+    class Reader {
+
+    public:
+
+        // How many times a read is retried before giving up (the caller then asks the server)
+        static constexpr int MAX_OPTIMISTIC_ATTEMPTS = 8;
+
+        Reader() = default;
+
+        ~Reader() {
+            unmap_segment();
+            if (m_control != nullptr) {
+                munmap(m_control, sizeof(Control));
+            }
+        }
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        /***
+         * @return False if the server does not export its table.
+         */
+        bool attach() {
+            auto [addr, size] = map(CONTROL_SHM_FILENAME, O_RDONLY);
+            if (addr == nullptr) {
+                return false;
+            }
+            m_control = reinterpret_cast<Control*>(addr);
+            return remap();
+        }
+
+        /***
+         * @return None if the read could not be validated because of concurrent writers,
+         * otherwise the value (if any).
+         */
+        std::optional<std::optional<Value>> get(const Key& key) {
+
+            // The table has grown meanwhile
+            if ((m_segment == nullptr || m_segment->m_stale.load(std::memory_order_acquire)) && !remap()) {
+                return {};
+            }
+
+            return m_segment->optimistic_find(Hash{}(key), key, MAX_OPTIMISTIC_ATTEMPTS);
+        }
+
+    private:
+
+        using Segment = shm_table::Segment<Key, Value>;
+
+        Control* m_control{nullptr};
+        Segment* m_segment{nullptr};
+        std::size_t m_segment_bytes{0};
+
+        bool remap() {
+            unmap_segment();
+
+            auto name = segment_name(m_control->m_generation.load(std::memory_order_acquire));
+            auto [addr, size] = map(name.c_str(), O_RDONLY);
+            if (addr == nullptr) {
+                return false;
+            }
+
+            m_segment = reinterpret_cast<Segment*>(addr);
+            m_segment_bytes = size;
+            return true;
+        }
+
+        void unmap_segment() {
+            if (m_segment != nullptr) {
+                munmap(m_segment, m_segment_bytes);
+                m_segment = nullptr;
+            }
+        }
+    };
+
+}
+
+#endif //ASSIGNMENT_2_SHMTABLE_HPP
@@ -0,0 +1,235 @@
+#ifndef ASSIGNMENT_2_STATS_HPP
+#define ASSIGNMENT_2_STATS_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+namespace stats {
+
+    #ifdef __APPLE__
+    static constexpr const char* SHM_FILENAME = "/tmp/shm-stats";
+    #else
+    static constexpr const char* SHM_FILENAME = "/shm-stats";
+    #endif
+
+    // Bumped whenever the layout of `Segment` changes
+    static constexpr uint64_t MAGIC = 0x5354415453000004ull;
+
+    // The request types, in the order of `protocol::RequestMessage::Type`
+    static constexpr std::array<const char*, 9> OPS = {
+        "read", "insert", "remove", "flush", "compare_and_swap", "fetch_add", "append", "get_and_set", "scan"
+    };
+
+    static constexpr size_t MAX_WORKERS = 256;
+
+    // As many as the `HashTable`'s stripes can grow to
+    static constexpr size_t MAX_STRIPES = 1 << 14;
+
+    /***
+     * A histogram with a bounded relative error, in the style of HdrHistogram: the values are
+     * counted exactly up to SUB_BUCKETS, then each power of two is split into SUB_BUCKETS
+     * buckets (about 3% of error). Recording a value is a single relaxed increment.
+     */
+    class Histogram {
+
+    public:
+
+        static constexpr unsigned SUB_BITS = 5;
+        static constexpr uint64_t SUB_BUCKETS = 1ull << SUB_BITS;
+
+        // The values are clamped below 2^MAX_MAGNITUDE (in nanoseconds, about 18 minutes)
+        static constexpr unsigned MAX_MAGNITUDE = 40;
+        static constexpr size_t BUCKETS = (MAX_MAGNITUDE - SUB_BITS + 1) * SUB_BUCKETS;
+
+        void record(uint64_t value) noexcept {
+            m_counts[index(value)].fetch_add(1, std::memory_order_relaxed);
+            m_count.fetch_add(1, std::memory_order_relaxed);
+            m_sum.fetch_add(value, std::memory_order_relaxed);
+        }
+
+        static size_t index(uint64_t value) noexcept {
+            value = std::min<uint64_t>(value, (uint64_t{1} << MAX_MAGNITUDE) - 1);
+            if (value < SUB_BUCKETS) {
+                return value;
+            }
+            unsigned shift = std::bit_width(value) - 1 - SUB_BITS;
+            return (shift + 1) * SUB_BUCKETS + ((value >> shift) - SUB_BUCKETS);
+        }
+
+        /***
+         * The largest value counted by the bucket.
+         */
+        static uint64_t highest(size_t index) noexcept {
+            if (index < SUB_BUCKETS) {
+                return index;
+            }
+            unsigned shift = index / SUB_BUCKETS - 1;
+            return (((index % SUB_BUCKETS) + SUB_BUCKETS + 1) << shift) - 1;
+        }
+
+        struct Summary {
+            uint64_t m_count{0};
+            double m_mean{0};
+            uint64_t m_p50{0};
+            uint64_t m_p90{0};
+            uint64_t m_p99{0};
+            uint64_t m_p999{0};
+            uint64_t m_max{0};
+        };
+
+        /***
+         * A copy of the counts of one or more histograms, to summarize the values recorded
+         * between two snapshots.
+         */
+        struct Snapshot {
+            std::array<uint64_t, BUCKETS> m_counts{};
+            uint64_t m_sum{0};
+
+            void add(const Histogram& histogram) noexcept {
+                for (size_t i = 0; i < BUCKETS; i++) {
+                    m_counts[i] += histogram.m_counts[i].load(std::memory_order_relaxed);
+                }
+                m_sum += histogram.m_sum.load(std::memory_order_relaxed);
+            }
+        };
+
+        /***
+         * The percentiles of the values recorded so far, read while they are being recorded:
+         * the result is approximate, but it never blocks (nor slows down) the recorders.
+         */
+        Summary summarize() const noexcept {
+            Snapshot snapshot{};
+            snapshot.add(*this);
+            return summarize(snapshot, Snapshot{});
+        }
+
+        /***
+         * The percentiles of the values recorded after `since` and before `until`.
+         */
+        static Summary summarize(const Snapshot& until, const Snapshot& since) noexcept {
+
+            std::array<uint64_t, BUCKETS> counts{};
+            uint64_t count = 0;
+            for (size_t i = 0; i < BUCKETS; i++) {
+                counts[i] = until.m_counts[i] - std::min(since.m_counts[i], until.m_counts[i]);
+                count += counts[i];
+            }
+
+            Summary summary{};
+            summary.m_count = count;
+            if (count == 0) {
+                return summary;
+            }
+            summary.m_mean = static_cast<double>(until.m_sum - std::min(since.m_sum, until.m_sum)) / static_cast<double>(count);
+
+            std::array<std::pair<double, uint64_t*>, 4> percentiles = {{
+                {0.50, &summary.m_p50}, {0.90, &summary.m_p90}, {0.99, &summary.m_p99}, {0.999, &summary.m_p999}
+            }};
+
+            uint64_t seen = 0;
+            size_t next = 0;
+            for (size_t i = 0; i < BUCKETS; i++) {
+                if (counts[i] == 0) {
+                    continue;
+                }
+                seen += counts[i];
+                while (next < percentiles.size() && static_cast<double>(seen) >= percentiles[next].first * static_cast<double>(count)) {
+                    *percentiles[next++].second = highest(i);
+                }
+                summary.m_max = highest(i);
+            }
+
+            return summary;
+        }
+
+    private:
+        std::array<std::atomic_uint64_t, BUCKETS> m_counts{};
+        std::atomic_uint64_t m_count{0};
+        std::atomic_uint64_t m_sum{0};
+    };
+
+    /***
+     * The latencies of a request type, in nanoseconds: from the enqueue to the dequeue, from
+     * the dequeue until the worker is done with it, and the two together.
+     */
+    struct OpStats {
+        Histogram m_queue_wait{};
+        Histogram m_service{};
+        Histogram m_end_to_end{};
+    };
+
+    /***
+     * Updated by its worker only, on its own cache lines.
+     */
+    struct alignas(64) WorkerStats {
+        std::atomic_uint64_t m_requests{0};
+        std::atomic_uint64_t m_hits{0};
+        std::atomic_uint64_t m_misses{0};
+        // Time spent serving requests, in nanoseconds
+        std::atomic_uint64_t m_busy_ns{0};
+    };
+
+    /***
+     * How many times the writers (or the readers falling back to the lock) waited for a
+     * stripe of the table, and for how long in total.
+     */
+    struct StripeStats {
+        std::atomic_uint64_t m_waits{0};
+        std::atomic_uint64_t m_wait_ns{0};
+    };
+
+    /***
+     * The statistics published by the server in their own shared memory segment: the
+     * workers update them with relaxed atomics, the readers (e.g. `server-stats`) map the
+     * segment read-only, so they can never disturb the server.
+     */
+    struct Segment {
+
+        uint64_t m_magic{MAGIC};
+        uint64_t m_workers{0};
+
+        // On the deadline clock, when the server started and when the periodic fields
+        // (the table's and the stripes' ones) have been published last
+        std::atomic_uint64_t m_started_at{0};
+        std::atomic_uint64_t m_updated_at{0};
+
+        std::array<OpStats, OPS.size()> m_ops{};
+
+        // How many requests were left in the queue behind each dequeued one
+        Histogram m_queue_depth{};
+
+        std::array<WorkerStats, MAX_WORKERS> m_worker_stats{};
+
+        //region Elastic pool
+        // The workers serving requests, out of `m_workers` (the pool's maximum)
+        std::atomic_uint64_t m_active_workers{0};
+        uint64_t m_min_workers{0};
+        // Grown because the queue stayed deep, or because the waits exceeded the target
+        std::atomic_uint64_t m_grows_on_depth{0};
+        std::atomic_uint64_t m_grows_on_wait{0};
+        // Shrunk because the workers stayed idle
+        std::atomic_uint64_t m_shrinks{0};
+        //endregion
+
+        // Responses dropped because their client did not make room for them in its queue
+        std::atomic_uint64_t m_dropped_responses{0};
+
+        //region Published periodically
+        std::atomic_uint64_t m_pairs{0};
+        std::atomic_uint64_t m_capacity{0};
+        std::atomic_uint64_t m_memory_usage{0};
+        std::atomic_uint64_t m_lock_waits{0};
+        std::atomic_uint64_t m_lock_wait_ns{0};
+        std::atomic_uint64_t m_stripes{0};
+        std::array<StripeStats, MAX_STRIPES> m_stripe_stats{};
+        //endregion
+    };
+
+}
+
+#endif
@@ -0,0 +1,296 @@
+#ifndef ASSIGNMENT_2_TRACE_HPP
+#define ASSIGNMENT_2_TRACE_HPP
+
+/***
+ * Tracing of the requests' lifecycle, compiled in with `-DTRACING=ON` only: otherwise the
+ * `TRACE_*` macros expand to nothing, their arguments included.
+ *
+ * Compiled in, each stage of a request (the client enqueueing it, a worker serving it and
+ * operating on the table, the worker enqueueing the response, the client waiting for it)
+ * is a USDT probe of the `shm_queue` provider, a `nop` until `perf`/bpftrace attach to it.
+ * With `SHM_TRACE=<dir>` in the environment, the stages are also timestamped into rings
+ * owned by the threads, and dumped at exit as Chrome trace JSON (`<dir>/trace-<pid>.json`,
+ * opened by Perfetto as well): the server's and the clients' files share the same clock,
+ * merge them with `jq -s add <dir>/trace-*.json`.
+ */
+
+#ifdef TRACING
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TRACE_PROBE(probe, id, type) DTRACE_PROBE2(shm_queue, probe, static_cast<uint64_t>(id), static_cast<unsigned>(type))
+#else
+#define TRACE_PROBE(probe, id, type) do {} while (false)
+#endif
+
+#include "Common.hpp"
+
+namespace tracing {
+
+    /***
+     * The timestamp of an event: the TSC where available, it is cheaper than `clock_gettime`
+     * and it is shared by all the cores (and processes) on the machines with an invariant
+     * TSC. The ticks are converted to the deadline clock when dumped.
+     */
+    inline uint64_t ticks() noexcept {
+        #if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+        #else
+        return deadline::now();
+        #endif
+    }
+
+    /***
+     * Identify a request across processes: the client's identifier and its request's one.
+     */
+    inline uint64_t trace_id(int client_id, uint64_t request_id) noexcept {
+        return (static_cast<uint64_t>(client_id) << 48) | (request_id & ((1ull << 48) - 1));
+    }
+
+    enum class Phase : uint8_t {
+        Span,
+        // The request (or the response) leaves the thread, and it is picked up by another one
+        FlowStart,
+        FlowEnd
+    };
+
+    struct Event {
+        // A string literal
+        const char* m_name;
+        uint64_t m_start;
+        uint64_t m_end;
+        uint64_t m_id;
+        uint32_t m_type;
+        Phase m_phase;
+    };
+
+    /***
+     * The events of a thread, overwritten once full: the most recent ones are kept. Only
+     * its thread writes into it, the events are read at exit.
+     */
+    struct Ring {
+
+        static constexpr size_t CAPACITY = 1 << 15;
+
+        // The oldest events the dump skips when the ring wrapped: they could be overwritten
+        // while being read, by a thread still running
+        static constexpr size_t SLACK = CAPACITY / 16;
+
+        std::array<Event, CAPACITY> m_events{};
+        std::atomic_size_t m_next{0};
+        uint32_t m_tid{0};
+    };
+
+    class Tracer {
+
+    public:
+
+        static Tracer& instance() {
+            // Never destroyed: the threads may still be tracing while the process exits
+            static Tracer* tracer = new Tracer();
+            return *tracer;
+        }
+
+        /***
+         * Whether the events are recorded (`SHM_TRACE` is set), the probes are there anyway.
+         */
+        static bool enabled() noexcept {
+            static const bool enabled = std::getenv("SHM_TRACE") != nullptr;
+            return enabled;
+        }
+
+        void record(const Event& event) noexcept {
+            Ring& ring = thread_ring();
+            size_t next = ring.m_next.load(std::memory_order_relaxed);
+            ring.m_events[next % Ring::CAPACITY] = event;
+            ring.m_next.store(next + 1, std::memory_order_release);
+        }
+
+        void set_process_name(const char* name) {
+            std::lock_guard<std::mutex> lock{m_mutex};
+            m_process_name = name;
+        }
+
+    private:
+
+        std::mutex m_mutex{};
+        std::vector<std::shared_ptr<Ring>> m_rings{};
+        std::string m_process_name{};
+
+        // Both clocks read together, at startup
+        uint64_t m_ticks_at_start{0};
+        uint64_t m_ns_at_start{0};
+
+        Tracer() {
+            m_ticks_at_start = ticks();
+            m_ns_at_start = deadline::now();
+            if (enabled()) {
+                std::atexit([]() { Tracer::instance().dump(); });
+            }
+        }
+
+        /***
+         * The ring of the current thread, registered on its first event. It outlives the
+         * thread, its events are dumped at exit.
+         */
+        Ring& thread_ring() {
+            static thread_local Ring* ring = [this]() {
+                auto owned = std::make_shared<Ring>();
+                std::lock_guard<std::mutex> lock{m_mutex};
+                owned->m_tid = static_cast<uint32_t>(m_rings.size() + 1);
+                m_rings.push_back(owned);
+                return owned.get();
+            }();
+            return *ring;
+        }
+
+        /***
+         * Write the events of all the threads, as Chrome trace JSON.
+         */
+        void dump() {
+
+            // The ticks are converted with the frequency measured over the whole run
+            uint64_t ticks_at_end = ticks();
+            uint64_t ns_at_end = deadline::now();
+            double ns_per_tick = ticks_at_end == m_ticks_at_start ? 1.0 :
+                static_cast<double>(ns_at_end - m_ns_at_start) / static_cast<double>(ticks_at_end - m_ticks_at_start);
+
+            auto to_us = [&](uint64_t t) {
+                double ns = static_cast<double>(m_ns_at_start) + static_cast<double>(static_cast<int64_t>(t - m_ticks_at_start)) * ns_per_tick;
+                return ns / 1e3;
+            };
+
+            const char* dir = std::getenv("SHM_TRACE");
+            std::string path = std::string{*dir != '\0' ? dir : "."} + "/trace-" + std::to_string(getpid()) + ".json";
+
+            std::FILE* file = std::fopen(path.c_str(), "w");
+            if (file == nullptr) {
+                std::perror("[trace] :: cannot write the trace");
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock{m_mutex};
+
+            int pid = getpid();
+            std::fprintf(file, "[{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}}",
+                         pid, m_process_name.empty() ? "process" : m_process_name.c_str());
+
+            size_t events = 0;
+            for (auto& ring: m_rings) {
+
+                size_t next = ring->m_next.load(std::memory_order_acquire);
+                size_t from = next > Ring::CAPACITY ? next - Ring::CAPACITY + Ring::SLACK : 0;
+
+                for (size_t i = from; i < next; i++) {
+                    const Event& event = ring->m_events[i % Ring::CAPACITY];
+                    switch (event.m_phase) {
+                        case Phase::Span:
+                            std::fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"request\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                                               "\"pid\":%d,\"tid\":%u,\"args\":{\"id\":\"%#lx\",\"type\":%u}}",
+                                         event.m_name, to_us(event.m_start), to_us(event.m_end) - to_us(event.m_start),
+                                         pid, ring->m_tid, event.m_id, event.m_type);
+                            break;
+                        case Phase::FlowStart:
+                        case Phase::FlowEnd:
+                            std::fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":%s,\"id\":\"%#lx\",\"ts\":%.3f,"
+                                               "\"pid\":%d,\"tid\":%u}",
+                                         event.m_name, event.m_name, event.m_phase == Phase::FlowStart ? "\"s\"" : "\"f\",\"bp\":\"e\"",
+                                         event.m_id, to_us(event.m_start), pid, ring->m_tid);
+                            break;
+                    }
+                    events++;
+                }
+            }
+
+            std::fprintf(file, "]\n");
+            std::fclose(file);
+            std::fprintf(stderr, "[trace] :: %lu events written to %s\n", events, path.c_str());
+        }
+    };
+
+    /***
+     * A stage of a request, recorded once the scope ends.
+     * @tparam OnEnd Fires the probe marking the stage's end.
+     */
+    template <typename OnEnd>
+    class Span {
+
+    public:
+
+        Span(const char* name, uint64_t id, uint32_t type, OnEnd on_end) noexcept :
+            m_name{name}, m_id{id}, m_type{type}, m_start{Tracer::enabled() ? ticks() : 0}, m_on_end{on_end} {}
+
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+        ~Span() {
+            m_on_end();
+            if (Tracer::enabled()) {
+                Tracer::instance().record(Event{m_name, m_start, ticks(), m_id, m_type, Phase::Span});
+            }
+        }
+
+    private:
+        const char* m_name;
+        uint64_t m_id;
+        uint32_t m_type;
+        uint64_t m_start;
+        OnEnd m_on_end;
+    };
+
+    inline void flow(Phase phase, const char* name, uint64_t id) noexcept {
+        if (Tracer::enabled()) {
+            uint64_t now = ticks();
+            Tracer::instance().record(Event{name, now, now, id, 0, phase});
+        }
+    }
+
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+// The stage lasts until the end of the scope: the probes `<stage>_begin` and `<stage>_end`
+// fire at its ends, with the request's trace id and type as arguments
+#define TRACE_SPAN(stage, id, type) \
+    TRACE_PROBE(stage##_begin, id, type); \
+    tracing::Span TRACE_CONCAT(trace_span_, __LINE__){#stage, id, static_cast<uint32_t>(type), [&]() { TRACE_PROBE(stage##_end, id, type); }}
+
+// A flow arrow, from the thread handing a request (or a response) over to the thread picking it up
+#define TRACE_FLOW_START(name, id) tracing::flow(tracing::Phase::FlowStart, name, id)
+#define TRACE_FLOW_END(name, id) tracing::flow(tracing::Phase::FlowEnd, name, id)
+
+#define TRACE_PROCESS_NAME(name) \
+    do { \
+        if (tracing::Tracer::enabled()) { \
+            tracing::Tracer::instance().set_process_name(name); \
+        } \
+    } while (false)
+
+#else
+
+#define TRACE_SPAN(stage, id, type) do {} while (false)
+#define TRACE_FLOW_START(name, id) do {} while (false)
+#define TRACE_FLOW_END(name, id) do {} while (false)
+#define TRACE_PROCESS_NAME(name) do {} while (false)
+
+#endif
+
+#endif //ASSIGNMENT_2_TRACE_HPP
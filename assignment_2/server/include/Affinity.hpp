@@ -0,0 +1,167 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/***
+ * Placement of the workers on the CPUs. Pinning is supported on Linux only, elsewhere
+ * the threads are left to the scheduler.
+ */
+namespace affinity {
+
+    /***
+     * Hint the CPU that the thread is spinning: it frees resources for the sibling
+     * hyper-thread, and it avoids the pipeline flush once the spin ends.
+     */
+    inline void cpu_relax() noexcept {
+        #if defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+        #elif defined(__aarch64__)
+        asm volatile("yield");
+        #endif
+    }
+
+    /***
+     * Parse a list of CPUs in the kernel's format, e.g. "0-3,8,10-11".
+     * @return None if the list is malformed.
+     */
+    inline std::optional<std::vector<int>> parse_cpu_list(const std::string& list) {
+
+        std::vector<int> cpus{};
+        size_t begin = 0;
+
+        while (begin <= list.size()) {
+
+            size_t end = std::min(list.find(',', begin), list.size());
+            std::string range = list.substr(begin, end - begin);
+
+            try {
+                size_t dash = range.find('-');
+                size_t parsed = 0;
+                int first = std::stoi(range, &parsed);
+                int last = first;
+                if (dash != std::string::npos) {
+                    if (parsed != dash) {
+                        return {};
+                    }
+                    last = std::stoi(range.substr(dash + 1), &parsed);
+                    parsed += dash + 1;
+                }
+                if (parsed != range.size() || first < 0 || last < first) {
+                    return {};
+                }
+                for (int cpu = first; cpu <= last; cpu++) {
+                    cpus.push_back(cpu);
+                }
+            }
+            catch (const std::logic_error& e) {
+                return {};
+            }
+
+            begin = end + 1;
+        }
+
+        return cpus;
+    }
+
+    /***
+     * The CPUs the process is allowed to run on.
+     */
+    inline std::vector<int> allowed_cpus() {
+
+        std::vector<int> cpus{};
+
+        #ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &set)) {
+                    cpus.push_back(cpu);
+                }
+            }
+            return cpus;
+        }
+        #endif
+
+        for (unsigned cpu = 0; cpu < std::max(std::thread::hardware_concurrency(), 1u); cpu++) {
+            cpus.push_back(static_cast<int>(cpu));
+        }
+        return cpus;
+    }
+
+    /***
+     * The NUMA node of the CPU, as exposed by sysfs (0 if unknown).
+     */
+    inline int numa_node(int cpu) {
+
+        std::error_code error{};
+        std::filesystem::directory_iterator it{"/sys/devices/system/cpu/cpu" + std::to_string(cpu), error};
+
+        for (; !error && it != std::filesystem::directory_iterator{}; it.increment(error)) {
+            std::string name = it->path().filename().string();
+            if (name.rfind("node", 0) == 0 && name.size() > 4 && std::all_of(name.begin() + 4, name.end(), ::isdigit)) {
+                return std::stoi(name.substr(4));
+            }
+        }
+
+        return 0;
+    }
+
+    /***
+     * Order the CPUs by NUMA node, keeping the given order within each node: consecutive
+     * workers run on the same node, and share its caches and memory.
+     */
+    inline std::vector<int> numa_order(std::vector<int> cpus) {
+        std::vector<std::pair<int, int>> nodes{};
+        for (int cpu: cpus) {
+            nodes.emplace_back(numa_node(cpu), cpu);
+        }
+        std::stable_sort(nodes.begin(), nodes.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+        for (size_t i = 0; i < nodes.size(); i++) {
+            cpus[i] = nodes[i].second;
+        }
+        return cpus;
+    }
+
+    /***
+     * Restrict the thread to the given CPUs.
+     * @return False if it cannot be done (or it is not supported).
+     */
+    inline bool pin_thread(pthread_t thread, const std::vector<int>& cpus) {
+
+        #ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu: cpus) {
+            if (cpu < CPU_SETSIZE) {
+                CPU_SET(cpu, &set);
+            }
+        }
+        return CPU_COUNT(&set) != 0 && pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+        #else
+        return false;
+        #endif
+    }
+
+    /***
+     * Restrict the calling thread to the given CPUs.
+     * @return False if it cannot be done (or it is not supported).
+     */
+    inline bool pin_current_thread(const std::vector<int>& cpus) {
+        return pin_thread(pthread_self(), cpus);
+    }
+
+}
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Common.hpp"
+
+namespace bulk_load {
+
+    /***
+     * A seed file mapped in memory, read-only. The file is text, a pair per line: the key,
+     * a space (or a tab), then the value up to the end of the line. Empty lines are skipped.
+     */
+    class Mapped {
+
+    public:
+
+        explicit Mapped(const std::string& path) {
+
+            int fd;
+            if ((fd = ::open(path.c_str(), O_RDONLY)) == -1) {
+                return;
+            }
+
+            struct stat st{};
+            if (fstat(fd, &st) == -1) {
+                close(fd);
+                return;
+            }
+
+            m_valid = true;
+            if (st.st_size == 0) {
+                close(fd);
+                return;
+            }
+
+            void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+
+            if (addr == MAP_FAILED) {
+                m_valid = false;
+                return;
+            }
+
+            m_addr = static_cast<const char*>(addr);
+            m_size = st.st_size;
+
+            // The whole file is going to be read, by several threads at once
+            madvise(addr, m_size, MADV_WILLNEED);
+        }
+
+        ~Mapped() {
+            if (m_addr != nullptr) {
+                munmap(const_cast<char*>(m_addr), m_size);
+            }
+        }
+
+        Mapped(const Mapped&) = delete;
+        Mapped& operator=(const Mapped&) = delete;
+
+        bool is_valid() const { return m_valid; }
+
+        std::string_view text() const { return {m_addr, m_size}; }
+
+        /***
+         * The part of the text assigned to the i-th of n readers, made of whole lines.
+         */
+        std::string_view chunk(std::size_t i, std::size_t n) const {
+            return text().substr(line_start(m_size * i / n), line_start(m_size * (i + 1) / n) - line_start(m_size * i / n));
+        }
+
+    private:
+        const char* m_addr{nullptr};
+        std::size_t m_size{0};
+        bool m_valid{false};
+
+        // The start of the first line at or after the offset
+        std::size_t line_start(std::size_t offset) const {
+            if (offset == 0 || offset >= m_size) {
+                return std::min(offset, m_size);
+            }
+            auto newline = static_cast<const char*>(std::memchr(m_addr + offset - 1, '\n', m_size - offset + 1));
+            return newline == nullptr ? m_size : newline - m_addr + 1;
+        }
+    };
+
+    /***
+     * Visit the (key, value) pairs of the lines of the text.
+     */
+    template <typename Visit>
+    void for_each_line(std::string_view text, Visit visit) {
+
+        while (!text.empty()) {
+
+            auto end = text.find('\n');
+            auto line = text.substr(0, end);
+            text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+
+            if (!line.empty() && line.back() == '\r') {
+                line.remove_suffix(1);
+            }
+            if (line.empty()) {
+                continue;
+            }
+
+            auto separator = line.find_first_of(" \t");
+            auto key = line.substr(0, separator);
+            auto value = separator == std::string_view::npos ? std::string_view{} : line.substr(separator + 1);
+            visit(key, value);
+        }
+    }
+
+    /***
+     * How many lines the file holds (an upper bound of its pairs), to presize the table
+     * before loading it.
+     */
+    inline uint64_t count(const std::string& path) {
+        Mapped mapped{path};
+        auto text = mapped.text();
+        auto lines = static_cast<uint64_t>(std::count(text.begin(), text.end(), '\n'));
+        return lines + (!text.empty() && text.back() != '\n');
+    }
+
+    /***
+     * What a load did with the file's lines.
+     */
+    struct Loaded {
+        // New pairs
+        uint64_t m_inserted{0};
+        // Pairs whose key was already in the table (or earlier in the file): the value is replaced
+        uint64_t m_replaced{0};
+        // Lines skipped, since the key or the value cannot be parsed
+        uint64_t m_malformed{0};
+    };
+
+    template <typename Key, typename Value>
+    struct Entry {
+        std::size_t m_hash;
+        Key m_key;
+        Value m_value;
+    };
+
+    /***
+     * Insert the file's pairs into the table, with the given number of threads. Each thread
+     * parses a chunk of the file, splitting its pairs by the table's partitions; then each
+     * thread inserts the pairs of its own partition, without any locking. The tables that
+     * cannot be partitioned are loaded with their usual (locked) inserts instead.
+     * With a key repeated in the file the last pair wins, unless the table is not partitioned.
+     * The lines that cannot be parsed (e.g. not a number, with integer keys) are skipped.
+     * @return What has been loaded, or None if the file is missing.
+     */
+    template <typename Key, typename Value, typename Table>
+    std::optional<Loaded> load(Table& table, const std::string& path, unsigned threads) {
+
+        Mapped mapped{path};
+        if (!mapped.is_valid()) {
+            return {};
+        }
+
+        threads = std::max(1u, threads);
+
+        // None if malformed
+        auto parse_pair = [](std::string_view key_text, std::string_view value_text) -> std::optional<Entry<Key, Value>> {
+            Entry<Key, Value> entry{};
+            if (!text::parse(key_text, entry.m_key) || !text::parse(value_text, entry.m_value)) {
+                return {};
+            }
+            return entry;
+        };
+
+        std::vector<std::thread> loaders{};
+        std::vector<Loaded> loaded(threads);
+
+        if constexpr (requires { table.partition(std::size_t{}, std::size_t{}); }) {
+
+            using Hash = typename Table::hasher;
+
+            // partitions[reader][owner]: the pairs parsed by a reader for the owner's partition
+            std::vector<std::vector<std::vector<Entry<Key, Value>>>> partitions(threads, std::vector<std::vector<Entry<Key, Value>>>(threads));
+
+            for (unsigned t = 0; t < threads; t++) {
+                loaders.emplace_back([&, t]() {
+                    for_each_line(mapped.chunk(t, threads), [&](std::string_view key_text, std::string_view value_text) {
+                        auto entry = parse_pair(key_text, value_text);
+                        if (!entry) {
+                            loaded[t].m_malformed++;
+                            return;
+                        }
+                        entry->m_hash = Hash{}(entry->m_key);
+                        partitions[t][table.partition(entry->m_hash, threads)].push_back(entry.value());
+                    });
+                });
+            }
+
+            for (auto& loader: loaders) {
+                loader.join();
+            }
+            loaders.clear();
+
+            for (unsigned t = 0; t < threads; t++) {
+                loaders.emplace_back([&, t]() {
+                    // The readers in order, so the last pair of a repeated key wins
+                    for (unsigned reader = 0; reader < threads; reader++) {
+                        auto& entries = partitions[reader][t];
+                        auto inserted = table.insert_unlocked(entries.begin(), entries.end());
+                        loaded[t].m_inserted += inserted;
+                        loaded[t].m_replaced += entries.size() - inserted;
+                        std::vector<Entry<Key, Value>>{}.swap(entries);
+                    }
+                });
+            }
+
+            for (auto& loader: loaders) {
+                loader.join();
+            }
+        }
+        else {
+
+            for (unsigned t = 0; t < threads; t++) {
+                loaders.emplace_back([&, t]() {
+                    for_each_line(mapped.chunk(t, threads), [&](std::string_view key_text, std::string_view value_text) {
+                        auto entry = parse_pair(key_text, value_text);
+                        if (!entry) {
+                            loaded[t].m_malformed++;
+                        }
+                        else if (table.insert(entry->m_key, entry->m_value)) {
+                            loaded[t].m_replaced++;
+                        }
+                        else {
+                            loaded[t].m_inserted++;
+                        }
+                    });
+                });
+            }
+
+            for (auto& loader: loaders) {
+                loader.join();
+            }
+        }
+
+        return std::accumulate(loaded.begin(), loaded.end(), Loaded{}, [](Loaded total, const Loaded& part) {
+            total.m_inserted += part.m_inserted;
+            total.m_replaced += part.m_replaced;
+            total.m_malformed += part.m_malformed;
+            return total;
+        });
+    }
+
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "Common.hpp"
+
+namespace epoch {
+
+    /***
+     * Epoch-based memory reclamation. Readers announce the epoch they started in,
+     * writers retire the memory they unlinked instead of freeing it, and a retired
+     * pointer is freed only once every reader that could still see it has left.
+     *
+     * Entering a read section writes only to the thread's own slot, hence readers
+     * on different cores never bounce a shared cache line.
+     */
+    class Domain {
+
+    public:
+
+        static constexpr std::size_t MAX_THREADS = 256;
+
+        // Epoch announced by a thread outside any read section
+        static constexpr uint64_t IDLE = UINT64_MAX;
+
+        // How many retired pointers are collected before trying to reclaim them
+        static constexpr std::size_t RECLAIM_THRESHOLD = 64;
+
+        static Domain& instance() {
+            // Never destroyed: worker threads may still be reading while the process exits
+            static Domain* domain = new Domain();
+            return *domain;
+        }
+
+        void enter() noexcept {
+            ThreadSlot& slot = thread_slot();
+            if (slot.m_depth++ == 0) {
+                m_slots[slot.m_index].m_epoch.store(m_epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+                // The announcement must be visible before reading any shared pointer
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+            }
+        }
+
+        void leave() noexcept {
+            ThreadSlot& slot = thread_slot();
+            if (--slot.m_depth == 0) {
+                m_slots[slot.m_index].m_epoch.store(IDLE, std::memory_order_release);
+            }
+        }
+
+        /***
+         * Free the pointer once no reader can access it anymore. The pointer must
+         * already be unreachable for the readers entering from now on.
+         * @param ptr
+         * @param deleter
+         */
+        void retire(void* ptr, void (*deleter)(void*)) {
+
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            uint64_t retired_epoch = m_epoch.fetch_add(1);
+
+            std::vector<Retired> reclaimable{};
+            {
+                std::lock_guard<std::mutex> lock{m_retired_mutex};
+                m_retired.push_back(Retired{ptr, deleter, retired_epoch});
+
+                if (m_retired.size() >= RECLAIM_THRESHOLD) {
+                    collect(reclaimable);
+                }
+            }
+
+            for (auto& retired: reclaimable) {
+                retired.m_deleter(retired.m_ptr);
+            }
+        }
+
+        template <typename T>
+        void retire(T* ptr) {
+            retire(ptr, [](void* p) { delete reinterpret_cast<T*>(p); });
+        }
+
+    private:
+
+        struct alignas(64) Slot {
+            std::atomic_uint64_t m_epoch{IDLE};
+            std::atomic_bool m_used{false};
+        };
+
+        struct Retired {
+            void* m_ptr;
+            void (*m_deleter)(void*);
+            uint64_t m_epoch;
+        };
+
+        /***
+         * Slot owned by the current thread, released when the thread exits.
+         */
+        struct ThreadSlot {
+            std::size_t m_index;
+            std::size_t m_depth{0};
+
+            ThreadSlot() : m_index{Domain::instance().acquire_slot()} {}
+            ~ThreadSlot() { Domain::instance().m_slots[m_index].m_used = false; }
+        };
+
+        std::atomic_uint64_t m_epoch{0};
+        std::array<Slot, MAX_THREADS> m_slots{};
+
+        std::mutex m_retired_mutex{};
+        std::vector<Retired> m_retired{};
+
+        Domain() = default;
+
+        static ThreadSlot& thread_slot() {
+            static thread_local ThreadSlot slot{};
+            return slot;
+        }
+
+        std::size_t acquire_slot() {
+            for (std::size_t i = 0; i < MAX_THREADS; i++) {
+                bool expected = false;
+                if (m_slots[i].m_used.compare_exchange_strong(expected, true)) {
+                    return i;
+                }
+            }
+            panic("[epoch] :: too many threads registered to the epoch domain");
+        }
+
+        /***
+         * Move the reclaimable pointers out of the retired list, with the list's mutex held.
+         */
+        void collect(std::vector<Retired>& reclaimable) {
+
+            uint64_t oldest = IDLE;
+            for (auto& slot: m_slots) {
+                oldest = std::min(oldest, slot.m_epoch.load());
+            }
+
+            // A reader that entered in the epoch a pointer was retired in (or before) may still hold it
+            auto it = std::partition(m_retired.begin(), m_retired.end(), [oldest](const Retired& retired) {
+                return retired.m_epoch >= oldest;
+            });
+
+            reclaimable.assign(it, m_retired.end());
+            m_retired.erase(it, m_retired.end());
+        }
+    };
+
+    /***
+     * RAII read section: the memory reachable while the guard is alive is not freed.
+     */
+    class Guard {
+    public:
+        Guard() noexcept { Domain::instance().enter(); }
+        ~Guard() { Domain::instance().leave(); }
+
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+    };
+
+}
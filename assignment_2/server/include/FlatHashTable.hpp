@@ -0,0 +1,460 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <new>
+#include <optional>
+#include <shared_mutex>
+#include <atomic>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "Epoch.hpp"
+
+namespace flat {
+
+    //region Control bytes
+    // A full slot stores the 7 lowest bits of its hash, the other states have the high bit set.
+    static constexpr int8_t EMPTY = -128;
+    static constexpr int8_t DELETED = -2;
+    //endregion
+
+    static constexpr std::size_t GROUP_SIZE = 16;
+
+    /***
+     * A group of 16 control bytes, matched all at once with SSE2 compares
+     * (byte by byte on the platforms without it).
+     */
+    struct Group {
+
+        #ifdef __SSE2__
+        __m128i m_ctrl;
+
+        explicit Group(const int8_t* ctrl) : m_ctrl{_mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl))} {}
+
+        uint32_t match(int8_t h2) const {
+            return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(m_ctrl, _mm_set1_epi8(h2))));
+        }
+
+        // EMPTY and DELETED are the only control bytes with the high bit set
+        uint32_t match_empty_or_deleted() const {
+            return static_cast<uint32_t>(_mm_movemask_epi8(m_ctrl));
+        }
+        #else
+        int8_t m_ctrl[GROUP_SIZE];
+
+        explicit Group(const int8_t* ctrl) {
+            std::memcpy(m_ctrl, ctrl, GROUP_SIZE);
+        }
+
+        uint32_t match(int8_t h2) const {
+            uint32_t mask = 0;
+            for (std::size_t i = 0; i < GROUP_SIZE; i++) {
+                mask |= static_cast<uint32_t>(m_ctrl[i] == h2) << i;
+            }
+            return mask;
+        }
+
+        uint32_t match_empty_or_deleted() const {
+            uint32_t mask = 0;
+            for (std::size_t i = 0; i < GROUP_SIZE; i++) {
+                mask |= static_cast<uint32_t>(m_ctrl[i] < 0) << i;
+            }
+            return mask;
+        }
+        #endif
+
+        uint32_t match_empty() const {
+            return match(EMPTY);
+        }
+    };
+
+    /***
+     * Finalizer spreading the hash over all the bits: the low 7 bits are stored in the
+     * control bytes, the high ones select the shard and the first probed group.
+     */
+    inline uint64_t mix(uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+}
+
+/***
+ * Open-addressing hash table in the Swiss-table style: one control byte per slot, groups
+ * of 16 slots probed at once, keys and values stored inline in flat arrays (no pointer
+ * chasing). It offers the same interface of `HashTable`, hence it can be used as `Server`'s table.
+ *
+ * The table is split in shards, each one protected like a `HashTable` stripe: writers take
+ * the shard's mutex, readers are optimistic and validate against the shard's version.
+ */
+template <typename Key, typename Value, typename Hash = hashing::Default<Key>>
+class FlatHashTable {
+
+public:
+
+    FlatHashTable(std::size_t initial_capacity = 1 << 3) {
+        auto capacity = std::bit_ceil(std::max<std::size_t>(initial_capacity / SHARDS, flat::GROUP_SIZE));
+        for (auto& shard: this->m_shards) {
+            shard.m_arrays = Arrays::make(capacity);
+        }
+    }
+
+    ~FlatHashTable() {
+        for (auto& shard: this->m_shards) {
+            Arrays::destroy(shard.m_arrays.load());
+        }
+    }
+
+    FlatHashTable(const FlatHashTable&) = delete;
+    FlatHashTable& operator=(const FlatHashTable&) = delete;
+
+    std::size_t size() const {
+        return this->m_size;
+    }
+
+    std::optional<Value> insert(Key key, Value value) noexcept {
+        return upsert(std::move(key), [&value](const std::optional<Value>&) {
+            return std::optional{std::move(value)};
+        });
+    }
+
+    /***
+     * Read-modify-write the value indexed by the key atomically, under the shard's mutex.
+     * @param modify Invoked with the current value (None if missing), it returns the value
+     * to store, or None to leave the table unchanged.
+     * @return The previous value.
+     */
+    template <typename Modify>
+    std::optional<Value> update(const Key& key, Modify modify) noexcept {
+        return upsert(Key{key}, modify);
+    }
+
+    /***
+     * Get the value indexed by the key, if contained. (Read-Only operation)
+     * @param key
+     * @return A copy of the value stored inside the hashtable, otherwise
+     * a None option.
+     */
+    std::optional<Value> get(const Key& key) noexcept {
+
+        auto hashed = flat::mix(Hash{}(key));
+        Shard& shard = shard_for(hashed);
+
+        epoch::Guard guard{};
+
+        for (int attempt = 0; attempt < MAX_OPTIMISTIC_ATTEMPTS; attempt++) {
+
+            auto version = shard.m_version.load(std::memory_order_acquire);
+            if (version & 1) {
+                continue;
+            }
+
+            std::optional<Value> value{};
+            Arrays* arrays = shard.m_arrays.load(std::memory_order_acquire);
+            if (auto index = arrays->find(hashed, key)) {
+                value = arrays->slots()[index.value()].m_value;
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (shard.m_version.load(std::memory_order_relaxed) == version) {
+                return value;
+            }
+        }
+
+        // Too many writers on the shard, let's queue behind them
+        std::shared_lock<std::shared_timed_mutex> reader_lock{shard.m_mutex};
+        Arrays* arrays = shard.m_arrays.load();
+        if (auto index = arrays->find(hashed, key)) {
+            return arrays->slots()[index.value()].m_value;
+        }
+        return {};
+    }
+
+    std::optional<std::pair<Key, Value>> remove(const Key &key) noexcept {
+
+        auto hashed = flat::mix(Hash{}(key));
+        Shard& shard = shard_for(hashed);
+
+        epoch::Guard guard{};
+        WriteSection section{shard};
+
+        Arrays* arrays = shard.m_arrays.load(std::memory_order_relaxed);
+
+        if (auto index = arrays->find(hashed, key)) {
+            Slot& slot = arrays->slots()[index.value()];
+            auto removed = std::pair{std::move(slot.m_key), std::move(slot.m_value)};
+            arrays->erase(index.value());
+            this->m_size--;
+            return std::optional{removed};
+        }
+
+        return {};
+    }
+
+    bool has(const Key& key) noexcept {
+        return get(key).has_value();
+    }
+
+    std::size_t capacity() const {
+        std::size_t capacity = 0;
+        for (auto& shard: this->m_shards) {
+            capacity += shard.m_arrays.load()->m_capacity;
+        }
+        return capacity;
+    }
+
+    /***
+     * Visit all the pairs, a shard at a time under its reader lock. It is not an atomic
+     * snapshot: the pairs written meanwhile may or may not be visited.
+     * @param visit Invoked with each (key, value) pair.
+     */
+    template <typename Visit>
+    void for_each(Visit visit) {
+        for (auto& shard: this->m_shards) {
+            std::shared_lock<std::shared_timed_mutex> reader_lock{shard.m_mutex};
+            Arrays* arrays = shard.m_arrays.load();
+            for (std::size_t i = 0; i < arrays->m_capacity; i++) {
+                if (arrays->ctrl()[i] >= 0) {
+                    visit(arrays->slots()[i].m_key, arrays->slots()[i].m_value);
+                }
+            }
+        }
+    }
+
+private:
+
+    template <typename Modify>
+    std::optional<Value> upsert(Key key, Modify modify) noexcept {
+
+        auto hashed = flat::mix(Hash{}(key));
+        Shard& shard = shard_for(hashed);
+
+        epoch::Guard guard{};
+        WriteSection section{shard};
+
+        Arrays* arrays = shard.m_arrays.load(std::memory_order_relaxed);
+
+        auto existing = arrays->find(hashed, key);
+
+        std::optional<Value> current{};
+        if (existing) {
+            current = arrays->slots()[existing.value()].m_value;
+        }
+
+        std::optional<Value> updated = modify(current);
+        if (!updated) {
+            return current;
+        }
+
+        if (existing) {
+            // We find an existing entry, we replace its value
+            arrays->slots()[existing.value()].m_value = std::move(updated.value());
+            return current;
+        }
+
+        std::size_t index = arrays->find_insert_slot(hashed);
+
+        // Reusing a deleted slot doesn't consume the growth budget
+        if (arrays->m_growth_left == 0 && arrays->ctrl()[index] == flat::EMPTY) {
+            arrays = rehash(shard, arrays);
+            index = arrays->find_insert_slot(hashed);
+        }
+
+        arrays->put(index, hashed, std::move(key), std::move(updated.value()));
+        this->m_size++;
+
+        return {};
+    }
+
+    struct Slot {
+        Key m_key;
+        Value m_value;
+    };
+
+    /***
+     * Control bytes and slots of a shard, in a single allocation. The arrays are never
+     * resized in place: a rehash builds new ones and retires the old ones, since optimistic
+     * readers may still be probing them.
+     */
+    struct alignas(std::max_align_t) Arrays {
+
+        // Number of slots: a power of two, multiple of the group size
+        std::size_t m_capacity;
+        // How many empty slots can still be filled before exceeding the maximum load
+        std::size_t m_growth_left;
+        std::size_t m_size{0};
+
+        int8_t* ctrl() { return reinterpret_cast<int8_t*>(this + 1); }
+
+        Slot* slots() { return reinterpret_cast<Slot*>(ctrl() + slots_offset(m_capacity)); }
+
+        static std::size_t slots_offset(std::size_t capacity) {
+            return (capacity + alignof(Slot) - 1) / alignof(Slot) * alignof(Slot);
+        }
+
+        static Arrays* make(std::size_t capacity) {
+            void* memory = ::operator new(sizeof(Arrays) + slots_offset(capacity) + capacity * sizeof(Slot));
+            auto arrays = new(memory) Arrays{capacity, capacity / 8 * 7};
+            std::memset(arrays->ctrl(), flat::EMPTY, capacity);
+            return arrays;
+        }
+
+        static void destroy(void* ptr) {
+            auto arrays = reinterpret_cast<Arrays*>(ptr);
+            for (std::size_t i = 0; i < arrays->m_capacity; i++) {
+                if (arrays->ctrl()[i] >= 0) {
+                    std::destroy_at(&arrays->slots()[i]);
+                }
+            }
+            arrays->~Arrays();
+            ::operator delete(ptr);
+        }
+
+        static int8_t h2(uint64_t hashed) { return static_cast<int8_t>(hashed & 0x7F); }
+
+        /***
+         * Visit the groups in the probe sequence of the hash (a triangular sequence,
+         * which visits all the groups since their number is a power of two).
+         * @param visit Returns true to stop the probing.
+         */
+        template <typename Visit>
+        void probe(uint64_t hashed, Visit visit) {
+            std::size_t groups_mask = m_capacity / flat::GROUP_SIZE - 1;
+            std::size_t group = (hashed >> 7) & groups_mask;
+            for (std::size_t i = 0; i <= groups_mask; i++) {
+                if (visit(group * flat::GROUP_SIZE)) {
+                    return;
+                }
+                group = (group + i + 1) & groups_mask;
+            }
+        }
+
+        /***
+         * @return The index of the slot holding the key, if any.
+         */
+        std::optional<std::size_t> find(uint64_t hashed, const Key& key) {
+            std::optional<std::size_t> found{};
+            probe(hashed, [&](std::size_t offset) {
+                flat::Group group{ctrl() + offset};
+                for (uint32_t mask = group.match(h2(hashed)); mask != 0; mask &= mask - 1) {
+                    std::size_t index = offset + std::countr_zero(mask);
+                    if (slots()[index].m_key == key) {
+                        found = index;
+                        return true;
+                    }
+                }
+                // An empty slot ends the probe sequence of the key
+                return group.match_empty() != 0;
+            });
+            return found;
+        }
+
+        /***
+         * @return The index of the first empty or deleted slot in the probe sequence.
+         */
+        std::size_t find_insert_slot(uint64_t hashed) {
+            std::size_t index = 0;
+            probe(hashed, [&](std::size_t offset) {
+                uint32_t mask = flat::Group{ctrl() + offset}.match_empty_or_deleted();
+                if (mask != 0) {
+                    index = offset + std::countr_zero(mask);
+                    return true;
+                }
+                return false;
+            });
+            return index;
+        }
+
+        void put(std::size_t index, uint64_t hashed, Key&& key, Value&& value) {
+            if (ctrl()[index] == flat::EMPTY) {
+                m_growth_left--;
+            }
+            new(&slots()[index]) Slot{std::move(key), std::move(value)};
+            ctrl()[index] = h2(hashed);
+            m_size++;
+        }
+
+        void erase(std::size_t index) {
+            ctrl()[index] = flat::DELETED;
+            std::destroy_at(&slots()[index]);
+            m_size--;
+        }
+    };
+
+    /***
+     * A shard: the mutex serializes the writers, the version lets the readers validate
+     * what they read without taking the mutex (odd while a writer is active).
+     */
+    struct alignas(64) Shard {
+        std::shared_timed_mutex m_mutex{};
+        std::atomic_uint64_t m_version{0};
+        std::atomic<Arrays*> m_arrays{nullptr};
+    };
+
+    struct WriteSection {
+
+        Shard& m_shard;
+
+        explicit WriteSection(Shard& shard) : m_shard{shard} {
+            m_shard.m_mutex.lock();
+            m_shard.m_version.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        ~WriteSection() {
+            m_shard.m_version.fetch_add(1, std::memory_order_release);
+            m_shard.m_mutex.unlock();
+        }
+    };
+
+    static constexpr std::size_t SHARDS = 64;
+
+    // How many times a reader retries before falling back to the reader lock
+    static constexpr int MAX_OPTIMISTIC_ATTEMPTS = 8;
+
+    std::array<Shard, SHARDS> m_shards{};
+    std::atomic_size_t m_size{0};
+
+    Shard& shard_for(uint64_t hashed) {
+        // The high bits: the low ones are used inside the shard
+        return this->m_shards[hashed >> (64 - std::countr_zero(SHARDS))];
+    }
+
+    /***
+     * Rebuild the shard's arrays without the deleted slots, doubling the capacity if
+     * they are more than half full, with the shard's writer lock held.
+     * @return The new arrays.
+     */
+    Arrays* rehash(Shard& shard, Arrays* arrays) {
+
+        std::size_t capacity = arrays->m_size * 2 >= arrays->m_capacity ? arrays->m_capacity * 2 : arrays->m_capacity;
+        Arrays* rehashed = Arrays::make(capacity);
+
+        for (std::size_t i = 0; i < arrays->m_capacity; i++) {
+            if (arrays->ctrl()[i] >= 0) {
+                Slot& slot = arrays->slots()[i];
+                auto hashed = flat::mix(Hash{}(slot.m_key));
+                rehashed->put(rehashed->find_insert_slot(hashed), hashed, Key{slot.m_key}, Value{slot.m_value});
+            }
+        }
+
+        shard.m_arrays.store(rehashed, std::memory_order_release);
+        epoch::Domain::instance().retire(arrays, &Arrays::destroy);
+
+        return rehashed;
+    }
+
+};
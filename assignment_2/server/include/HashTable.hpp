@@ -1,147 +1,504 @@
 #pragma once
 
+#include <algorithm>
+#include <bit>
 #include <cstddef>
-#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <optional>
 #include <functional>
 #include <shared_mutex>
 #include <atomic>
+#include <thread>
 
-template <typename Key, typename Value>
+#include "Common.hpp"
+#include "Epoch.hpp"
+#include "SlabPool.hpp"
+
+/***
+ * @tparam Hash The hash policy, chosen at compile time: `hashing::Default<Key>` by default
+ * (the word-at-a-time hash for `MyString`, `hashing::Mix64` for integers), or e.g. `hashing::Fnv1a`.
+ * @tparam Allocator The upstream allocator of the buckets' chains, stateless: the short chains are
+ * carved out of its slabs by the table's pools, the longer ones are allocated by it directly.
+ */
+template <typename Key, typename Value, typename Hash = hashing::Default<Key>, typename Allocator = std::allocator<std::byte>>
 class HashTable {
-    
+
 public:
 
-    HashTable(std::size_t initial_capacity = 1 << 3) : m_capacity{initial_capacity}, m_init_capacity{initial_capacity} {
-        this->m_table.resize(this->m_capacity);
-        this->m_locks.resize(this->m_init_capacity);
-        for (auto& ptr: this->m_locks) {
-            ptr = std::make_unique<std::shared_timed_mutex>();
+    using hasher = Hash;
+
+    /***
+     * @param initial_capacity Rounded up to a power of two, the table never shrinks below it.
+     */
+    HashTable(std::size_t initial_capacity = 1 << 3) {
+        auto capacity = std::bit_ceil(std::max<std::size_t>(initial_capacity, 1));
+        this->m_min_capacity = capacity;
+        this->m_state = new State{Table::make(capacity, &this->m_chain_bytes), nullptr};
+        this->m_stripes = Stripes::make(std::min(capacity, MAX_STRIPES));
+    }
+
+    ~HashTable() {
+        State* state = this->m_state.load();
+        Table::destroy(state->m_current);
+        if (state->m_old != nullptr) {
+            Table::destroy(state->m_old);
         }
+        delete state;
+        delete this->m_stripes.load();
     }
 
+    HashTable(const HashTable&) = delete;
+    HashTable& operator=(const HashTable&) = delete;
+
     std::size_t size() const {
         return this->m_size;
     }
 
-    std::optional<Value> insert(Key key, Value value) noexcept {
+    /***
+     * @param expires_at When the pair expires, on the `deadline` clock (`deadline::NONE` if never).
+     */
+    std::optional<Value> insert(Key key, Value value, uint64_t expires_at = deadline::NONE) noexcept {
+        return upsert(std::move(key), expires_at, [&value](const std::optional<Value>&) {
+            return std::optional{std::move(value)};
+        });
+    }
 
-        resize();
+    /***
+     * Read-modify-write the value indexed by the key atomically, under the stripe's writer
+     * lock. The expiration of an existing pair is kept.
+     * @param modify Invoked with the current value (None if missing), it returns the value
+     * to store, or None to leave the table unchanged.
+     * @return The previous value.
+     */
+    template <typename Modify>
+    std::optional<Value> update(const Key& key, Modify modify) noexcept {
+        return upsert(Key{key}, KEEP_EXPIRATION, modify);
+    }
+
+    /***
+     * Get the value indexed by the key, if contained. (Read-Only operation)
+     * The lookup is optimistic: it takes no lock and it writes no shared memory,
+     * it is retried if a writer modified the stripe in the meanwhile.
+     * @param key
+     * @return A copy of the value stored inside the hashtable, otherwise
+     * a None option.
+     */
+    std::optional<Value> get(const Key& key) noexcept {
+
+        auto hashed = Hash{}(key);
+
+        std::optional<Value> value{};
+        if (optimistic_read(hashed, [&]() { value = find(hashed, key); })) {
+            return value;
+        }
+
+        // Too many writers on the stripe, let's queue behind them
+        return get_shared(key);
+    }
+
+    /***
+     * Same as `get`, but reading under the stripe's reader lock.
+     */
+    std::optional<Value> get_shared(const Key& key) noexcept {
+
+        auto hashed = Hash{}(key);
 
-        auto hashed = std::hash<Key>{}(key);
+        epoch::Guard guard{};
+        auto reader_lock = lock_stripe<std::shared_lock<std::shared_timed_mutex>>(hashed);
+
+        return find(hashed, key);
+    }
+
+    /***
+     * The stripe guarding the key right now: a hint to order a batch of operations by stripe,
+     * so consecutive ones lock the same stripe, since the stripes change as the table resizes.
+     */
+    std::size_t stripe_of(const Key& key) const noexcept {
+        epoch::Guard guard{};
+        return Hash{}(key) & (this->m_stripes.load(std::memory_order_acquire)->m_count - 1);
+    }
+
+    std::optional<std::pair<Key, Value>> remove(const Key &key) noexcept {
+
+        auto hashed = Hash{}(key);
+        std::optional<std::pair<Key, Value>> removed{};
 
         {
-            std::lock_guard<std::shared_timed_mutex> writer_lock{*this->m_locks[hashed % this->m_locks.size()]};
+            epoch::Guard guard{};
+            WriteSection section{*this, hashed};
 
-            // Does the element exists already?
-            Buckets& buckets = this->m_table[hashed % this->m_capacity];
-            auto existing = std::find_if(buckets.begin(), buckets.end(), [&key](const Bucket& b) {
-                return b.m_key == key;
-            });
+            Bucket* existing = find_bucket_or_free(writable_table(hashed)->slot(hashed), hashed, key).first;
 
-            if (existing != buckets.end()) {
-                // We find an existing entry, we replace the bucket key and value
-                auto old_value = std::move(existing->m_value);
-                existing->m_value = value;
-                existing->m_key = key;
+            if (existing != nullptr) {
 
-                return std::optional{old_value};
+                auto val = std::move(existing->m_value);
+                auto k = std::move(existing->m_key);
+
+                existing->m_status = Bucket::Status::Free;
+                this->m_size--;
+                this->m_freed++;
+
+                // An expired pair is dropped all the same, as if it were missing
+                if (deadline::expired(existing->m_expires_at)) {
+                    this->m_expirations++;
+                }
+                else {
+                    removed = std::optional{std::pair{k, val}};
+                }
             }
+        }
 
-            // Let's append a new bucket to the bucket list, looking for a free one
-            auto free_bucket = std::find_if(buckets.begin(), buckets.end(), [](const Bucket& b) {
-                return b.m_status == Bucket::Status::Free;
-            });
+        resize();
+        help_migration();
 
-            if (free_bucket != buckets.end()) {
-                // Let us reuse the existing bucket, instead creating a new one
-                free_bucket->m_status = Bucket::Status::Occupied;
-                free_bucket->m_key = std::move(key);
-                free_bucket->m_value = std::move(value);
+        return removed;
+    }
+
+    /***
+     * Check if the value indexed by key is contained inside the map. (Read-Only operation)
+     * @param key
+     * @return True if the values is contained, false otherwise.
+     */
+    bool has(const Key& key) noexcept {
+        return get(key).has_value();
+    }
+
+    std::size_t capacity() const {
+        return this->m_state.load()->m_current->m_capacity;
+    }
+
+    //region Cache mode
+
+    /***
+     * Bound the memory used by the table: past the limit, the writers evict the pairs not
+     * read recently (CLOCK: the pairs read since the hand's last pass get a second chance).
+     * @param bytes Zero to disable the limit.
+     */
+    void set_memory_limit(std::size_t bytes) {
+        this->m_memory_limit = bytes;
+    }
+
+    /***
+     * Approximate memory used by the slots and by the buckets' chains.
+     */
+    std::size_t memory_usage() const {
+        epoch::Guard guard{};
+        State* state = this->m_state.load();
+        std::size_t slots = state->m_current->m_capacity + (state->m_old != nullptr ? state->m_old->m_capacity : 0);
+        return this->m_chain_bytes + slots * SLOT_BYTES;
+    }
+
+    /***
+     * How many pairs have been evicted, and how many have been dropped since expired.
+     */
+    std::size_t evictions() const {
+        return this->m_evictions;
+    }
+
+    std::size_t expirations() const {
+        return this->m_expirations;
+    }
+
+    //endregion
+
+    //region Compaction
+
+    /***
+     * Compact the chains of the next slots, each one with its stripe's writer lock held: the
+     * buckets freed by the removes are dropped, so the lookups stop scanning them and their
+     * memory is given back. Meant to be called a few slots at a time by a background thread,
+     * never by more than one at once. A pass starts by shrinking the table if it is underloaded,
+     * and a rehash in progress is helped first (as many old slots as the given ones), so that
+     * a table keeps shrinking even when no writer comes by.
+     * @return True once a whole pass over the table is complete.
+     */
+    bool compact(std::size_t slots) {
+
+        epoch::Guard guard{};
+
+        if (this->m_compaction_hand == 0 && !is_rehashing()) {
+            resize();
+        }
+
+        State* state = this->m_state.load(std::memory_order_acquire);
+        if (state->m_old != nullptr) {
+            for (std::size_t i = 0; i < slots; i += MIGRATION_BATCH) {
+                help_migration();
             }
-            else {
-                buckets.push_back(Bucket{std::move(key), std::move(value)});
+            return false;
+        }
+
+        if (this->m_compaction_hand == 0) {
+            // The buckets freed from now on are left to the next pass
+            this->m_freed = 0;
+        }
+
+        for (std::size_t i = 0; i < slots; i++) {
+
+            std::size_t index = this->m_compaction_hand++;
+            if (index >= state->m_current->m_capacity) {
+                this->m_compaction_hand = 0;
+                return true;
             }
 
+            // Peek at the slot first: the write section would invalidate the stripe's optimistic
+            // readers, for nothing if the slot has no buckets to drop
+            if (!compactable(state->m_current->m_slots[index].load(std::memory_order_acquire))) {
+                continue;
+            }
+
+            WriteSection section{*this, index};
+            if (this->m_state.load() == state) {
+                compact_slot(state->m_current, index);
+            }
         }
 
-        this->m_size++;
+        return false;
+    }
 
-        return {};
+    /***
+     * Is there anything to compact: enough pairs removed since the last pass (a fraction of
+     * the pairs left, see COMPACTION_RATIO), a pass or a rehash to complete, or a table to shrink?
+     */
+    bool compaction_pending() const {
+        std::size_t freed = this->m_freed;
+        if ((freed != 0 && freed * COMPACTION_RATIO >= this->m_size) || this->m_compaction_hand != 0 || is_rehashing()) {
+            return true;
+        }
+        std::size_t capacity = this->capacity();
+        return target_capacity(capacity) < capacity;
     }
 
     /***
-     * Get the value indexed by the key, if contained. (Read-Only operation)
-     * @param key
-     * @return A pointer to the value stored inside the hashtable, otherwise
-     * a None option.
+     * How many bytes have been given back, by compacting the chains and by shrinking the table.
+     * The chains given back to the pools reach the upstream allocator once their slabs are empty.
      */
-    std::optional<Value*> get(Key key) noexcept {
+    std::size_t reclaimed_bytes() const {
+        return this->m_reclaimed_bytes;
+    }
 
-        auto hashed = std::hash<Key>{}(key);
-        {
-            std::shared_lock<std::shared_timed_mutex> reader_lock{*this->m_locks[hashed % this->m_locks.size()]};
+    /***
+     * The memory held by the pools' slabs (shared by the tables of the same type), the
+     * short chains in use included.
+     */
+    static std::size_t slab_bytes() {
+        std::size_t bytes = 0;
+        for (std::size_t capacity = Table::INITIAL_CHAIN_CAPACITY; capacity <= MAX_POOLED_CAPACITY; capacity *= 2) {
+            for (std::size_t shard = 0; shard < POOL_SHARDS; shard++) {
+                bytes += chain_pool(capacity, shard).slab_bytes();
+            }
+        }
+        return bytes;
+    }
+
+    //endregion
+
+    //region Statistics
+
+    /***
+     * How many times a thread had to wait for a stripe's lock, and for how long in total
+     * (in nanoseconds), since the table has been created.
+     */
+    uint64_t lock_waits() const {
+        return this->m_lock_waits;
+    }
+
+    uint64_t lock_wait_ns() const {
+        return this->m_lock_wait_ns;
+    }
+
+    /***
+     * Visit the waits of each current stripe: the counters restart when the stripes are
+     * replaced by a rehash.
+     * @param visit Invoked with the stripe's index, its waits and their total time.
+     * @return How many stripes there are.
+     */
+    template <typename Visit>
+    std::size_t for_each_stripe_wait(Visit visit) {
+        epoch::Guard guard{};
+        Stripes* stripes = this->m_stripes.load(std::memory_order_acquire);
+        for (std::size_t i = 0; i < stripes->m_count; i++) {
+            visit(i, stripes->m_stripes[i].m_waits.load(std::memory_order_relaxed), stripes->m_stripes[i].m_wait_ns.load(std::memory_order_relaxed));
+        }
+        return stripes->m_count;
+    }
+
+    //endregion
+
+    /***
+     * Visit all the pairs, a stripe at a time under its reader lock, so the writers are
+     * blocked only while their own stripe is visited. It is not an atomic snapshot: the
+     * pairs written meanwhile may or may not be visited. No rehash starts until it returns.
+     * @param visit Invoked with each (key, value, expiration) of the pairs not expired.
+     */
+    template <typename Visit>
+    void for_each(Visit visit) {
+
+        std::lock_guard<std::mutex> resize_lock{this->m_resize_mutex};
+
+        // The pairs must be in a single table: complete the rehash in progress, if any
+        while (this->is_rehashing()) {
+            help_migration();
+            std::this_thread::yield();
+        }
+
+        epoch::Guard guard{};
+
+        Table* table = this->m_state.load()->m_current;
+        std::size_t stripes = this->m_stripes.load()->m_count;
+
+        for (std::size_t stripe = 0; stripe < stripes; stripe++) {
 
-            Buckets& buckets = this->m_table[hashed % this->m_capacity];
+            auto reader_lock = lock_stripe<std::shared_lock<std::shared_timed_mutex>>(stripe);
 
-            for (auto &bucket: buckets) {
-                if (bucket.m_key == key) {
-                    return std::optional{&bucket.m_value};
+            // The slots sharing the stripe
+            for (std::size_t index = stripe; index < table->m_capacity; index += stripes) {
+                if (Chain* chain = table->m_slots[index].load()) {
+                    for (Bucket& bucket: *chain) {
+                        if (bucket.m_status == Bucket::Status::Occupied && !deadline::expired(bucket.m_expires_at)) {
+                            visit(bucket.m_key, bucket.m_value, bucket.m_expires_at);
+                        }
+                    }
                 }
             }
         }
-
-        return {};
     }
 
-    std::optional<std::pair<Key, Value>> remove(Key &key) noexcept {
+    /***
+     * Visit the pairs of the slots at the cursor, with their stripe's reader lock held, in
+     * the style of Redis' SCAN: the cursor counts over the slot indexes with their bits
+     * reversed, so a scan started before a rehash neither misses nor restarts any slot
+     * after it. The pairs present for the whole scan are visited at least once, the ones
+     * written meanwhile may or may not be visited, and some may be visited twice.
+     * @param cursor Zero to start a scan, otherwise what the previous call returned.
+     * @param visit Invoked with each (key, value) pair.
+     * @return The cursor to continue from, zero once the scan is complete.
+     */
+    template <typename Visit>
+    uint64_t scan(uint64_t cursor, Visit visit) {
 
-        auto hashed = std::hash<Key>{}(key);
-        {
-            std::lock_guard<std::shared_timed_mutex> writer_lock{*this->m_locks[hashed % this->m_locks.size()]};
+        epoch::Guard guard{};
 
-            Buckets& buckets = this->m_table[hashed % this->m_capacity];
-            auto existing = std::find_if(buckets.begin(), buckets.end(), [&key](const Bucket& b) {
-                return b.m_key == key;
-            });
+        // While rehashing, the slots of the larger table expanding the one of the smaller
+        // table are visited together: they hold the same low bits, hence the same stripe.
+        auto reader_lock = lock_stripe<std::shared_lock<std::shared_timed_mutex>>(cursor);
 
-            if (existing != buckets.end()) {
+        auto visit_slot = [&visit](Table* table, std::size_t index) {
+            if (Chain* chain = table->m_slots[index].load()) {
+                for (Bucket& bucket: *chain) {
+                    if (bucket.m_status == Bucket::Status::Occupied && !deadline::expired(bucket.m_expires_at)) {
+                        visit(bucket.m_key, bucket.m_value);
+                    }
+                }
+            }
+        };
 
-                auto val = std::move(existing->m_value);
-                auto k = std::move(existing->m_key);
+        State* state = this->m_state.load(std::memory_order_acquire);
+        Table* small = state->m_current;
+        Table* large = state->m_old;
 
-                existing->m_status = Bucket::Status::Free;
+        if (large == nullptr) {
+            uint64_t mask = small->m_capacity - 1;
+            visit_slot(small, cursor & mask);
+            return next_cursor(cursor, mask);
+        }
 
-                return std::optional{std::pair{key, val}};
-            }
+        if (small->m_capacity > large->m_capacity) {
+            std::swap(small, large);
         }
 
-        this->m_size--;
+        uint64_t small_mask = small->m_capacity - 1;
+        uint64_t large_mask = large->m_capacity - 1;
 
-        return {};
+        visit_slot(small, cursor & small_mask);
+        do {
+            visit_slot(large, cursor & large_mask);
+            cursor = next_cursor(cursor, large_mask);
+        } while (cursor & (small_mask ^ large_mask));
+
+        return cursor;
     }
 
+    //region Bulk load
+
     /***
-     * Check if the value indexed by key is contained inside the map. (Read-Only operation)
-     * @param key
-     * @return True if the values is contained, false otherwise.
+     * The partition of a hash among the given number: the keys of different partitions
+     * never share a stripe, hence a slot (see `insert_unlocked`).
      */
-    bool has(Key& key) noexcept {
+    std::size_t partition(std::size_t hashed, std::size_t partitions) const {
+        return (hashed & (this->m_stripes.load()->m_count - 1)) % partitions;
+    }
 
-        auto hashed = std::hash<Key>{}(key);
-        std::shared_lock<std::shared_timed_mutex> reader_lock{*(this->m_locks[hashed % this->m_locks.size()])};
+    /***
+     * Insert the pairs without taking the stripes' locks, to load the table before serving
+     * it: several threads can insert at once, as long as each one inserts the pairs of its
+     * own partition only. The table is not resized meanwhile, it should be presized.
+     * @param begin, end The pairs, with their hash (`m_hash`, computed with `hasher`), `m_key` and `m_value`.
+     * @return How many new pairs have been inserted.
+     */
+    template <typename Iterator>
+    std::size_t insert_unlocked(Iterator begin, Iterator end) noexcept {
 
-        Buckets& buckets = this->m_table[hashed % this->m_capacity];
+        epoch::Guard guard{};
+        std::size_t inserted = 0;
 
-        auto found = std::find_if(buckets.begin(), buckets.end(), [=](const Bucket& b) {
-            return b.m_key == key;
-        });
+        for (auto it = begin; it != end; ++it) {
+
+            Table* table = writable_table(it->m_hash);
+            auto [existing, free_bucket] = find_bucket_or_free(table->slot(it->m_hash), it->m_hash, it->m_key);
+
+            if (existing != nullptr) {
+                existing->m_value = it->m_value;
+                existing->m_expires_at = deadline::NONE;
+                continue;
+            }
+
+            if (free_bucket != nullptr) {
+                *free_bucket = Bucket{it->m_hash, Key{it->m_key}, Value{it->m_value}};
+            }
+            else {
+                table->append(it->m_hash, Bucket{it->m_hash, Key{it->m_key}, Value{it->m_value}});
+            }
+            inserted++;
+        }
+
+        // A single update of the shared counter
+        this->m_size += inserted;
+
+        return inserted;
+    }
 
-        return (found != buckets.end());
+    //endregion
+
+    /***
+     * Is a rehash still migrating buckets from the previous table?
+     */
+    bool is_rehashing() const {
+        return this->m_state.load()->m_old != nullptr;
     }
 
 private:
 
+    // The benchmark's baseline, `get_locked`, is not part of the API
+    friend struct HashTableBench;
+
+    /***
+     * Same as `get_shared`, without entering the epoch: the bare reader-locked lookup, the
+     * baseline the optimistic one is benchmarked against. Only while the table is not resizing
+     * and its chains don't grow, nothing keeps the stripes and the chains from being freed.
+     */
+    std::optional<Value> get_locked(const Key& key) noexcept {
+
+        auto hashed = Hash{}(key);
+
+        auto reader_lock = lock_stripe<std::shared_lock<std::shared_timed_mutex>>(hashed);
+
+        return find(hashed, key);
+    }
+
     struct Bucket {
 
         // Status of the current Bucket
@@ -152,47 +509,826 @@ private:
             Free
         };
 
+        // The full hash of the key: compared before the key, and reused when rehashing
+        std::size_t m_hash;
         Key m_key;
         Value m_value;
         Status m_status;
 
-        Bucket(Key&& key, Value&& value) : m_key{std::move(key)}, m_value{std::move(value)}, m_status{Status::Occupied} {}
+        // When the pair expires (`deadline::NONE` if never), it is dropped lazily
+        uint64_t m_expires_at;
+
+        // CLOCK reference bit, set by the readers (through an `atomic_ref`)
+        uint8_t m_referenced{0};
+
+        Bucket(std::size_t hash, Key&& key, Value&& value, uint64_t expires_at = deadline::NONE) :
+            m_hash{hash}, m_key{std::move(key)}, m_value{std::move(value)}, m_status{Status::Occupied}, m_expires_at{expires_at} {}
+
+        bool holds(std::size_t hash, const Key& key) const {
+            return m_status == Status::Occupied && m_hash == hash && m_key == key;
+        }
     };
 
-    using Buckets = std::vector<Bucket>;
-    using Mutex = std::unique_ptr<std::shared_timed_mutex>;
+    using ChainPool = slab::Pool<Allocator>;
+    using ByteAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<std::byte>;
+
+    /***
+     * The list of buckets of a slot. Its storage is never reallocated in place: a chain
+     * that has to grow is copied, and the old one is retired to the epoch domain, since
+     * optimistic readers may still be scanning it.
+     * It is aligned as its buckets only, so that it fits the blocks of any upstream allocator.
+     */
+    struct alignas(Bucket) Chain {
+
+        uint32_t m_capacity;
+        // The pool shard the chain has been allocated from, if pooled
+        uint32_t m_shard;
+        std::atomic_size_t m_size{0};
+
+        Chain(std::size_t capacity, std::size_t shard) : m_capacity{static_cast<uint32_t>(capacity)}, m_shard{static_cast<uint32_t>(shard)} {}
+
+        Bucket* begin() { return reinterpret_cast<Bucket*>(this + 1); }
+        Bucket* end() { return begin() + m_size.load(std::memory_order_relaxed); }
+
+        /***
+         * @param capacity A power of two, at least INITIAL_CHAIN_CAPACITY.
+         * @param shard Which shard of the pools to allocate from, if pooled.
+         */
+        static Chain* make(std::size_t capacity, std::size_t shard) {
+            void* memory = capacity <= MAX_POOLED_CAPACITY ?
+                           chain_pool(capacity, shard).allocate() : ByteAllocator{}.allocate(bytes(capacity));
+            return new(memory) Chain(capacity, shard);
+        }
+
+        static void destroy(void* ptr) {
+            auto chain = reinterpret_cast<Chain*>(ptr);
+            std::size_t capacity = chain->m_capacity, shard = chain->m_shard;
+            std::destroy(chain->begin(), chain->end());
+            chain->~Chain();
+            if (capacity <= MAX_POOLED_CAPACITY) {
+                chain_pool(capacity, shard).deallocate(ptr);
+            }
+            else {
+                ByteAllocator{}.deallocate(static_cast<std::byte*>(ptr), bytes(capacity));
+            }
+        }
+
+        static constexpr std::size_t bytes(std::size_t capacity) {
+            return sizeof(Chain) + capacity * sizeof(Bucket);
+        }
+
+        std::size_t bytes() const {
+            return bytes(m_capacity);
+        }
+
+        /***
+         * Copy of the chain with twice its capacity.
+         */
+        Chain* grow() {
+            Chain* grown = Chain::make(m_capacity * 2, m_shard);
+            std::uninitialized_copy(begin(), end(), grown->begin());
+            grown->m_size.store(m_size.load());
+            return grown;
+        }
+
+        /***
+         * Copy of the chain with its occupied buckets only, in the smallest capacity fitting them.
+         */
+        Chain* compacted(std::size_t occupied) {
+            Chain* copy = Chain::make(std::bit_ceil(std::max(occupied, Table::INITIAL_CHAIN_CAPACITY)), m_shard);
+            Bucket* out = copy->begin();
+            for (Bucket& bucket: *this) {
+                if (bucket.m_status == Bucket::Status::Occupied) {
+                    new(out++) Bucket{bucket};
+                }
+            }
+            copy->m_size.store(occupied);
+            return copy;
+        }
+    };
+
+    struct Table {
+
+        std::size_t m_capacity;
+        std::unique_ptr<std::atomic<Chain*>[]> m_slots;
+
+        // The memory held by the chains of the table's owner
+        std::atomic_size_t* m_chain_bytes;
+
+        // While the table is being rehashed: which slots have been moved to the new table,
+        // how many of them, and the next slot to be moved by a helper.
+        std::unique_ptr<std::atomic_bool[]> m_migrated;
+        std::atomic_size_t m_migrated_count{0};
+        std::atomic_size_t m_migration_cursor{0};
+
+        static constexpr std::size_t INITIAL_CHAIN_CAPACITY = 2;
+
+        // The capacity is a power of two
+        std::size_t index(std::size_t hashed) const { return hashed & (m_capacity - 1); }
+
+        Chain* slot(std::size_t hashed) { return m_slots[index(hashed)].load(std::memory_order_acquire); }
+
+        bool is_migrated(std::size_t hashed) const { return m_migrated[index(hashed)].load(std::memory_order_acquire); }
+
+        /***
+         * Append the bucket to the slot's chain, with the stripe's writer lock held.
+         */
+        void append(std::size_t hashed, Bucket&& bucket) {
+
+            auto& slot = m_slots[index(hashed)];
+            Chain* chain = slot.load(std::memory_order_relaxed);
+
+            if (chain == nullptr) {
+                // Chains are allocated lazily, on the first insertion in the slot
+                chain = Chain::make(INITIAL_CHAIN_CAPACITY, hashed & (POOL_SHARDS - 1));
+                *m_chain_bytes += chain->bytes();
+                slot.store(chain, std::memory_order_release);
+            }
+            else if (chain->m_size == chain->m_capacity) {
+                Chain* grown = chain->grow();
+                *m_chain_bytes += grown->bytes() - chain->bytes();
+                slot.store(grown, std::memory_order_release);
+                epoch::Domain::instance().retire(chain, &Chain::destroy);
+                chain = grown;
+            }
+
+            new(chain->end()) Bucket{std::move(bucket)};
+            chain->m_size.store(chain->m_size.load() + 1, std::memory_order_release);
+        }
+
+        /***
+         * Replace the slot's chain with the given one (nullptr to empty the slot), with
+         * the stripe's writer lock held. The old chain is retired.
+         */
+        void replace(std::size_t index, Chain* chain) {
+            Chain* old = m_slots[index].load(std::memory_order_relaxed);
+            *m_chain_bytes += (chain != nullptr ? chain->bytes() : 0);
+            *m_chain_bytes -= old->bytes();
+            m_slots[index].store(chain, std::memory_order_release);
+            epoch::Domain::instance().retire(old, &Chain::destroy);
+        }
+
+        static Table* make(std::size_t capacity, std::atomic_size_t* chain_bytes) {
+            return new Table{
+                .m_capacity = capacity,
+                .m_slots = std::make_unique<std::atomic<Chain*>[]>(capacity),
+                .m_chain_bytes = chain_bytes,
+                .m_migrated = std::make_unique<std::atomic_bool[]>(capacity)
+            };
+        }
+
+        static void destroy(void* ptr) {
+            auto table = reinterpret_cast<Table*>(ptr);
+            for (std::size_t i = 0; i < table->m_capacity; i++) {
+                if (Chain* chain = table->m_slots[i].load()) {
+                    *table->m_chain_bytes -= chain->bytes();
+                    Chain::destroy(chain);
+                }
+            }
+            delete table;
+        }
+    };
+
+    /***
+     * The tables currently in use: while a rehash is in progress, the slots of the old
+     * table that have not been migrated yet are still the authoritative ones.
+     */
+    struct State {
+        Table* m_current;
+        Table* m_old;
+    };
+
+    /***
+     * A lock stripe: the mutex serializes the writers, the version lets the readers
+     * validate what they read without taking the mutex (odd while a writer is active).
+     * Each stripe lives on its own cache line.
+     */
+    struct alignas(64) Stripe {
+        std::shared_timed_mutex m_mutex{};
+        std::atomic_uint64_t m_version{0};
+        // How many times a thread had to wait for the mutex, and for how long (in nanoseconds)
+        std::atomic_uint64_t m_waits{0};
+        std::atomic_uint64_t m_wait_ns{0};
+    };
+
+    /***
+     * The set of stripes, its size is a power of two dividing the table's capacity: the
+     * buckets of an old slot and of the two new slots it is split into (or of the two old
+     * slots merged into a new one) share the stripe.
+     */
+    struct Stripes {
+
+        std::size_t m_count;
+        std::unique_ptr<Stripe[]> m_stripes;
 
-    std::vector<Buckets> m_table{};
-    std::vector<Mutex> m_locks{};
+        Stripe& at(std::size_t hashed) { return m_stripes[hashed & (m_count - 1)]; }
+
+        static Stripes* make(std::size_t count) {
+            return new Stripes{count, std::make_unique<Stripe[]>(count)};
+        }
+    };
+
+    /***
+     * RAII writer section on the stripe of the given hash, with an epoch guard held.
+     */
+    struct WriteSection {
+
+        Stripe& m_stripe;
+
+        WriteSection(HashTable& table, std::size_t hashed) : m_stripe{table.lock_stripe(hashed)} {
+            m_stripe.m_version.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        ~WriteSection() {
+            m_stripe.m_version.fetch_add(1, std::memory_order_release);
+            m_stripe.m_mutex.unlock();
+        }
+    };
+
+    std::atomic<State*> m_state{nullptr};
+    std::atomic<Stripes*> m_stripes{nullptr};
+
+    // Held by the thread starting a rehash
+    std::mutex m_resize_mutex{};
 
     std::atomic_size_t m_size{0};
-    std::size_t m_capacity{0};
-    std::size_t m_init_capacity{0};
+    std::size_t m_min_capacity;
+
+    // The waits for the stripes' mutexes, of all the stripes so far (see `Stripe`)
+    std::atomic_uint64_t m_lock_waits{0};
+    std::atomic_uint64_t m_lock_wait_ns{0};
+
+    //region Compaction
+    // The buckets freed since the last compaction pass started
+    std::atomic_size_t m_freed{0};
+    std::atomic_size_t m_reclaimed_bytes{0};
+    // The next slot to compact, only moved by the compacting thread
+    std::size_t m_compaction_hand{0};
+    //endregion
+
+    //region Cache mode
+    std::atomic_size_t m_memory_limit{0};
+    std::atomic_size_t m_chain_bytes{0};
+    // The CLOCK hand, the next slot to sweep
+    std::atomic_size_t m_clock_hand{0};
+    std::atomic_size_t m_evictions{0};
+    std::atomic_size_t m_expirations{0};
+    //endregion
 
     static constexpr float MAX_LOAD = 0.75f;
 
+    // A compaction pass starts once the buckets freed since the previous one reach 1/COMPACTION_RATIO
+    // of the pairs: a pass peeks at every slot, a single remove is not worth it
+    static constexpr std::size_t COMPACTION_RATIO = 8;
+
+    // The table halves below this load: far enough from MAX_LOAD that a halved table does
+    // not grow back at the next few inserts (hysteresis)
+    static constexpr float MIN_LOAD = MAX_LOAD / 4;
+
+    // The chains up to this capacity are allocated from the pools, a pool per capacity and shard
+    static constexpr std::size_t MAX_POOLED_CAPACITY = 16;
+
+    // The pools are sharded like the stripes, by the low bits of the hash: the writers of
+    // a stripe allocate from the same shard, the ones of different stripes rarely share it.
+    static constexpr std::size_t POOL_SHARDS = 64;
+
     /***
-     * Resize the current hashtable capacity if we exceed the MAX_LOAD factor.
+     * The pool of the chains of the given capacity, in the given shard. The pools are shared
+     * by the tables of the same type.
+     */
+    static ChainPool& chain_pool(std::size_t capacity, std::size_t shard) {
+
+        static constexpr std::size_t CLASSES = std::countr_zero(MAX_POOLED_CAPACITY / Table::INITIAL_CHAIN_CAPACITY) + 1;
+
+        // Never destroyed: the epoch domain may still free retired chains while the process exits
+        static std::deque<ChainPool>* pools = []() {
+            auto pools = new std::deque<ChainPool>{};
+            for (std::size_t size_class = 0; size_class < CLASSES; size_class++) {
+                for (std::size_t i = 0; i < POOL_SHARDS; i++) {
+                    pools->emplace_back(Chain::bytes(Table::INITIAL_CHAIN_CAPACITY << size_class));
+                }
+            }
+            return pools;
+        }();
+
+        std::size_t size_class = std::countr_zero(capacity / Table::INITIAL_CHAIN_CAPACITY);
+        return (*pools)[size_class * POOL_SHARDS + shard];
+    }
+
+    // The memory of a slot, besides its chain
+    static constexpr std::size_t SLOT_BYTES = sizeof(std::atomic<Chain*>) + sizeof(std::atomic_bool);
+
+    // How many slots a writer sweeps at most, looking for pairs to evict
+    static constexpr std::size_t EVICTION_STEPS = 64;
+
+    // The stripes grow together with the table, up to this many
+    static constexpr std::size_t MAX_STRIPES = 1 << 14;
+
+    // How many old slots a writer migrates, besides its own, while a rehash is in progress
+    static constexpr std::size_t MIGRATION_BATCH = 4;
+
+    // How many times a reader retries before falling back to the reader lock
+    static constexpr int MAX_OPTIMISTIC_ATTEMPTS = 8;
+
+    /***
+     * Exclusively lock the stripe of the given hash, with an epoch guard held.
+     */
+    Stripe& lock_stripe(std::size_t hashed) {
+        while (true) {
+            Stripes* stripes = this->m_stripes.load(std::memory_order_acquire);
+            Stripe& stripe = stripes->at(hashed);
+            if (!stripe.m_mutex.try_lock()) {
+                uint64_t begin = deadline::now();
+                stripe.m_mutex.lock();
+                record_wait(stripe, deadline::now() - begin);
+            }
+            // The stripes could have been replaced while we were waiting
+            if (this->m_stripes.load(std::memory_order_acquire) == stripes) {
+                return stripe;
+            }
+            stripe.m_mutex.unlock();
+        }
+    }
+
+    /***
+     * Same as `lock_stripe`, through a lock object (e.g. a reader lock).
+     */
+    template <typename Lock>
+    Lock lock_stripe(std::size_t hashed) {
+        while (true) {
+            Stripes* stripes = this->m_stripes.load(std::memory_order_acquire);
+            Stripe& stripe = stripes->at(hashed);
+            Lock lock{stripe.m_mutex, std::try_to_lock};
+            if (!lock.owns_lock()) {
+                uint64_t begin = deadline::now();
+                lock.lock();
+                record_wait(stripe, deadline::now() - begin);
+            }
+            if (this->m_stripes.load(std::memory_order_acquire) == stripes) {
+                return lock;
+            }
+        }
+    }
+
+    /***
+     * Account a wait for the stripe's mutex: only the contended acquisitions pay for it.
+     */
+    void record_wait(Stripe& stripe, uint64_t wait_ns) {
+        stripe.m_waits.fetch_add(1, std::memory_order_relaxed);
+        stripe.m_wait_ns.fetch_add(wait_ns, std::memory_order_relaxed);
+        this->m_lock_waits.fetch_add(1, std::memory_order_relaxed);
+        this->m_lock_wait_ns.fetch_add(wait_ns, std::memory_order_relaxed);
+    }
+
+    /***
+     * Run the read function without locks, validating it against the stripe's version.
+     * @return False if the read could not be validated.
+     */
+    template <typename ReadFn>
+    bool optimistic_read(std::size_t hashed, ReadFn read) noexcept {
+
+        epoch::Guard guard{};
+
+        for (int attempt = 0; attempt < MAX_OPTIMISTIC_ATTEMPTS; attempt++) {
+
+            // Replaced stripes are left with an odd version, the loop then reloads them
+            Stripe& stripe = this->m_stripes.load(std::memory_order_acquire)->at(hashed);
+
+            auto version = stripe.m_version.load(std::memory_order_acquire);
+            if (version & 1) {
+                // A writer is modifying the stripe
+                continue;
+            }
+
+            read();
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (stripe.m_version.load(std::memory_order_relaxed) == version) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /***
+     * The table holding the key's slot, from a reader's point of view.
+     */
+    Table* readable_table(std::size_t hashed) {
+        State* state = this->m_state.load(std::memory_order_acquire);
+        if (state->m_old != nullptr && !state->m_old->is_migrated(hashed)) {
+            return state->m_old;
+        }
+        return state->m_current;
+    }
+
+    /***
+     * The table to be modified for the key, with the stripe's writer lock held:
+     * the key's old slot is migrated first, if a rehash is in progress.
+     */
+    Table* writable_table(std::size_t hashed) {
+        State* state = this->m_state.load(std::memory_order_acquire);
+        if (state->m_old != nullptr && !state->m_old->is_migrated(hashed)) {
+            migrate_slot(state, state->m_old->index(hashed));
+        }
+        return state->m_current;
+    }
+
+    /***
+     * Increment the cursor's reversed bits, within the mask of the table.
+     */
+    static uint64_t next_cursor(uint64_t cursor, uint64_t mask) {
+        cursor |= ~mask;
+        cursor = reverse_bits(cursor) + 1;
+        return reverse_bits(cursor);
+    }
+
+    static uint64_t reverse_bits(uint64_t v) {
+        v = ((v >> 1) & 0x5555555555555555ull) | ((v & 0x5555555555555555ull) << 1);
+        v = ((v >> 2) & 0x3333333333333333ull) | ((v & 0x3333333333333333ull) << 2);
+        v = ((v >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((v & 0x0F0F0F0F0F0F0F0Full) << 4);
+        return __builtin_bswap64(v);
+    }
+
+    // Passed to `upsert` to keep the expiration of an existing pair
+    static constexpr uint64_t KEEP_EXPIRATION = UINT64_MAX;
+
+    template <typename Modify>
+    std::optional<Value> upsert(Key key, uint64_t expires_at, Modify modify) noexcept {
+
+        resize();
+
+        auto hashed = Hash{}(key);
+
+        {
+            epoch::Guard guard{};
+            WriteSection section{*this, hashed};
+
+            // A single pass over the chain, looking for the key and for a free bucket
+            Table* table = writable_table(hashed);
+            auto [existing, free_bucket] = find_bucket_or_free(table->slot(hashed), hashed, key);
+
+            bool expired = existing != nullptr && deadline::expired(existing->m_expires_at);
+
+            std::optional<Value> current{};
+            if (existing != nullptr && !expired) {
+                current = existing->m_value;
+            }
+
+            std::optional<Value> updated = modify(current);
+            if (!updated) {
+                return current;
+            }
+
+            if (existing != nullptr) {
+                // We find an existing entry (possibly expired), we replace the bucket value
+                existing->m_value = std::move(updated.value());
+                if (expires_at != KEEP_EXPIRATION || expired) {
+                    existing->m_expires_at = expires_at == KEEP_EXPIRATION ? deadline::NONE : expires_at;
+                }
+
+                return current;
+            }
+
+            expires_at = expires_at == KEEP_EXPIRATION ? deadline::NONE : expires_at;
+
+            if (free_bucket != nullptr) {
+                // Let us reuse the existing bucket, instead creating a new one
+                free_bucket->m_key = std::move(key);
+                free_bucket->m_value = std::move(updated.value());
+                free_bucket->m_hash = hashed;
+                free_bucket->m_expires_at = expires_at;
+                std::atomic_ref<uint8_t>{free_bucket->m_referenced}.store(0, std::memory_order_relaxed);
+                free_bucket->m_status = Bucket::Status::Occupied;
+            }
+            else {
+                table->append(hashed, Bucket{hashed, std::move(key), std::move(updated.value()), expires_at});
+            }
+
+        }
+
+        this->m_size++;
+
+        help_migration();
+
+        if (this->m_memory_limit != 0 && memory_usage() > this->m_memory_limit) {
+            evict();
+        }
+
+        return {};
+    }
+
+    /***
+     * Look for the occupied bucket holding the key and for the first free bucket of the
+     * chain, in a single pass, with the stripe's writer lock held.
+     * @return The bucket holding the key, otherwise the free bucket to reuse (if any).
+     */
+    static std::pair<Bucket*, Bucket*> find_bucket_or_free(Chain* chain, std::size_t hashed, const Key& key) noexcept {
+
+        Bucket* free_bucket = nullptr;
+
+        if (chain == nullptr) {
+            return {nullptr, nullptr};
+        }
+
+        for (Bucket& bucket: *chain) {
+            if (bucket.m_status == Bucket::Status::Free) {
+                if (free_bucket == nullptr) {
+                    free_bucket = &bucket;
+                }
+            }
+            else if (bucket.m_hash == hashed && bucket.m_key == key) {
+                return {&bucket, nullptr};
+            }
+        }
+
+        return {nullptr, free_bucket};
+    }
+
+    /***
+     * Look for the key, either under the stripe's lock or inside an optimistic read.
+     */
+    std::optional<Value> find(std::size_t hashed, const Key& key) noexcept {
+
+        Chain* chain = readable_table(hashed)->slot(hashed);
+        if (chain == nullptr) {
+            return {};
+        }
+
+        // The size is clamped, in case of a torn optimistic read
+        std::size_t size = std::min<std::size_t>(chain->m_size.load(std::memory_order_acquire), chain->m_capacity);
+
+        for (std::size_t i = 0; i < size; i++) {
+            Bucket& bucket = chain->begin()[i];
+            if (bucket.holds(hashed, key)) {
+                if (deadline::expired(bucket.m_expires_at)) {
+                    return {};
+                }
+                // Don't dirty the cache line if the bit is already set
+                std::atomic_ref<uint8_t> referenced{bucket.m_referenced};
+                if (this->m_memory_limit != 0 && !referenced.load(std::memory_order_relaxed)) {
+                    referenced.store(1, std::memory_order_relaxed);
+                }
+                return std::optional{bucket.m_value};
+            }
+        }
+
+        return {};
+    }
+
+    /***
+     * The capacity the table should have for its size: double the current one past
+     * MAX_LOAD, half of it below MIN_LOAD (but never below the initial capacity).
+     */
+    std::size_t target_capacity(std::size_t capacity) const {
+        std::size_t size = this->m_size;
+        if (size + 1 > capacity * MAX_LOAD) {
+            return capacity * 2;
+        }
+        if (capacity > this->m_min_capacity && size < capacity * MIN_LOAD) {
+            return capacity / 2;
+        }
+        return capacity;
+    }
+
+    /***
+     * Start a rehash if we exceed the MAX_LOAD factor, or if we fall below MIN_LOAD. The new
+     * table is only allocated here, the buckets are moved a few slots at a time by the
+     * following writes (and by the compacting thread).
      */
     void resize() {
-        // Should we resize the hash-table? Let's start locking all the locks
-        // before going on.
-        for (Mutex& mutex: this->m_locks) {
-            mutex->lock();
+
+        epoch::Guard guard{};
+
+        State* state = this->m_state.load();
+        if (state->m_old != nullptr || target_capacity(state->m_current->m_capacity) == state->m_current->m_capacity) {
+            return;
+        }
+
+        // Somebody else is already starting the rehash
+        std::unique_lock<std::mutex> resize_lock{this->m_resize_mutex, std::try_to_lock};
+        if (!resize_lock.owns_lock()) {
+            return;
+        }
+
+        state = this->m_state.load();
+        std::size_t capacity = target_capacity(state->m_current->m_capacity);
+        if (state->m_old != nullptr || capacity == state->m_current->m_capacity) {
+            return;
+        }
+
+        auto resized = new State{Table::make(capacity, &this->m_chain_bytes), state->m_current};
+
+        // The stripes follow the smaller of the two tables: growing, the stripes double
+        // with the old table; shrinking, they must halve before the rehash starts, since two
+        // old slots of different stripes are merged into the same new slot. As it changes the
+        // stripe of the keys, all the old stripes are held while replacing them, and the new
+        // state is published under them too, so no writer sees it with the old stripes.
+        Stripes* stripes = this->m_stripes.load();
+        std::size_t count = std::min(std::min(capacity, state->m_current->m_capacity), MAX_STRIPES);
+        if (stripes->m_count == count) {
+            this->m_state.store(resized, std::memory_order_release);
+            epoch::Domain::instance().retire(state);
+            return;
+        }
+
+        for (std::size_t i = 0; i < stripes->m_count; i++) {
+            stripes->m_stripes[i].m_mutex.lock();
+        }
+
+        this->m_stripes.store(Stripes::make(count), std::memory_order_release);
+        this->m_state.store(resized, std::memory_order_release);
+
+        // Optimistic readers still looking at the old stripes must retry
+        for (std::size_t i = 0; i < stripes->m_count; i++) {
+            stripes->m_stripes[i].m_version.fetch_add(1, std::memory_order_release);
+            stripes->m_stripes[i].m_mutex.unlock();
+        }
+
+        epoch::Domain::instance().retire(state);
+        epoch::Domain::instance().retire(stripes);
+    }
+
+    /***
+     * Move the buckets of an old slot to the current table, with the slot's stripe
+     * writer lock held. The old chain is retired, so the memory of the old table is
+     * released a slot at a time instead of all at once.
+     */
+    void migrate_slot(State* state, std::size_t index) {
+
+        Table* old = state->m_old;
+
+        if (Chain* chain = old->m_slots[index].load()) {
+            for (Bucket& bucket: *chain) {
+                if (bucket.m_status == Bucket::Status::Occupied) {
+                    state->m_current->append(bucket.m_hash, Bucket{bucket});
+                }
+            }
+            old->replace(index, nullptr);
+        }
+
+        old->m_migrated[index].store(true, std::memory_order_release);
+
+        // The last migrated slot completes the rehash
+        if (++old->m_migrated_count == old->m_capacity) {
+            if (old->m_capacity > state->m_current->m_capacity) {
+                this->m_reclaimed_bytes += (old->m_capacity - state->m_current->m_capacity) * SLOT_BYTES;
+            }
+            this->m_state.store(new State{state->m_current, nullptr}, std::memory_order_release);
+            epoch::Domain::instance().retire(state);
+            epoch::Domain::instance().retire(old, &Table::destroy);
+        }
+    }
+
+    /***
+     * Migrate a batch of old slots, if a rehash is in progress.
+     */
+    void help_migration() {
+
+        epoch::Guard guard{};
+
+        State* state = this->m_state.load(std::memory_order_acquire);
+        if (state->m_old == nullptr) {
+            return;
+        }
+
+        for (std::size_t i = 0; i < MIGRATION_BATCH; i++) {
+
+            std::size_t index = state->m_old->m_migration_cursor++;
+            if (index >= state->m_old->m_capacity) {
+                return;
+            }
+
+            // All the keys of the old slot map to the stripe of its index
+            WriteSection section{*this, index};
+            if (!state->m_old->m_migrated[index].load()) {
+                migrate_slot(state, index);
+            }
+        }
+    }
+
+    /***
+     * Move the CLOCK hand over the slots until the memory is back within the limit, or
+     * after a few steps: the following writers carry on from there.
+     */
+    void evict() {
+
+        for (std::size_t step = 0; step < EVICTION_STEPS && memory_usage() > this->m_memory_limit; step++) {
+
+            epoch::Guard guard{};
+
+            State* state = this->m_state.load(std::memory_order_acquire);
+            if (state->m_old != nullptr) {
+                // Sweep a single table: complete the rehash first
+                help_migration();
+                continue;
+            }
+
+            std::size_t index = this->m_clock_hand++ & (state->m_current->m_capacity - 1);
+
+            WriteSection section{*this, index};
+            if (this->m_state.load() == state) {
+                sweep_slot(state->m_current, index);
+            }
+        }
+    }
+
+    /***
+     * Evict the slot's expired pairs and the ones not read since the last sweep, clearing
+     * the others' reference bit, with the stripe's writer lock held. The chain is then
+     * compacted, so the evicted buckets give their memory back.
+     */
+    void sweep_slot(Table* table, std::size_t index) {
+
+        Chain* chain = table->m_slots[index].load();
+        if (chain == nullptr) {
+            return;
+        }
+
+        std::size_t occupied = 0;
+
+        for (Bucket& bucket: *chain) {
+
+            if (bucket.m_status != Bucket::Status::Occupied) {
+                continue;
+            }
+
+            std::atomic_ref<uint8_t> referenced{bucket.m_referenced};
+
+            if (deadline::expired(bucket.m_expires_at)) {
+                this->m_expirations++;
+            }
+            else if (!referenced.load(std::memory_order_relaxed)) {
+                this->m_evictions++;
+            }
+            else {
+                // Second chance
+                referenced.store(0, std::memory_order_relaxed);
+                occupied++;
+                continue;
+            }
+
+            bucket.m_status = Bucket::Status::Free;
+            this->m_size--;
+        }
+
+        if (occupied == 0) {
+            this->m_reclaimed_bytes += chain->bytes();
+            table->replace(index, nullptr);
+        }
+        else if (occupied * 2 <= chain->m_capacity && chain->m_capacity > Table::INITIAL_CHAIN_CAPACITY) {
+            Chain* compacted = chain->compacted(occupied);
+            this->m_reclaimed_bytes += chain->bytes() - compacted->bytes();
+            table->replace(index, compacted);
+        }
+    }
+
+    /***
+     * Would `compact_slot` drop any of the chain's buckets? Also called without the stripe's
+     * lock, as a hint, within an epoch guard.
+     */
+    static bool compactable(Chain* chain) {
+
+        if (chain == nullptr) {
+            return false;
         }
 
-        // If the new size is going to be more than the actual capacity
-        // scaled by the MAX_LOAD factor, then we should resize the hashtable.
-        if (this->m_size + 1 > this->m_capacity * MAX_LOAD) {
-            // Double the capacity
-            this->m_capacity *= 2;
-            this->m_table.resize(this->m_capacity);
+        // The size is clamped, in case the chain is peeked at without the lock
+        std::size_t size = std::min<std::size_t>(chain->m_size.load(std::memory_order_acquire), chain->m_capacity);
+        std::size_t occupied = 0;
+        for (std::size_t i = 0; i < size; i++) {
+            occupied += chain->begin()[i].m_status == Bucket::Status::Occupied;
         }
 
-        // Release all the locks in the same order.
-        for (Mutex& mutex: this->m_locks) {
-            mutex->unlock();
+        return occupied == 0 || size - occupied >= occupied;
+    }
+
+    /***
+     * Drop the slot's free buckets, with the stripe's writer lock held, once they are at
+     * least as many as the occupied ones: fewer are left to be reused by the inserts.
+     */
+    void compact_slot(Table* table, std::size_t index) {
+
+        Chain* chain = table->m_slots[index].load();
+        if (chain == nullptr) {
+            return;
+        }
+
+        std::size_t occupied = 0;
+        for (Bucket& bucket: *chain) {
+            occupied += bucket.m_status == Bucket::Status::Occupied;
+        }
+
+        if (occupied == 0) {
+            this->m_reclaimed_bytes += chain->bytes();
+            table->replace(index, nullptr);
+        }
+        else if (chain->m_size - occupied >= occupied) {
+            Chain* compacted = chain->compacted(occupied);
+            this->m_reclaimed_bytes += chain->bytes() - compacted->bytes();
+            table->replace(index, compacted);
         }
     }
 
-};
\ No newline at end of file
+};
@@ -0,0 +1,357 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+// The least severe level compiled in: 0 debug, 1 info, 2 warning, 3 error, 4 off.
+// The records of the less severe levels are removed at compile time, with their arguments.
+#ifndef LOG_LEVEL
+#define LOG_LEVEL 1
+#endif
+
+namespace logging {
+
+    enum class Level : uint8_t {
+        Debug,
+        Info,
+        Warning,
+        Error,
+        Off
+    };
+
+    constexpr Level LEVEL = static_cast<Level>(LOG_LEVEL);
+
+    constexpr bool enabled(Level level) {
+        return level >= LEVEL && level != Level::Off;
+    }
+
+    constexpr const char* name(Level level) {
+        switch (level) {
+            case Level::Debug: return "debug";
+            case Level::Info: return "info";
+            case Level::Warning: return "warning";
+            default: return "error";
+        }
+    }
+
+    /***
+     * A record waiting to be printed: the format is not applied by the thread logging it,
+     * the arguments are copied (the strings by value) and formatted later by the log thread.
+     */
+    struct Record {
+
+        static constexpr std::size_t SIZE = 256;
+
+        // Instantiated for the types of the record's arguments
+        void (*m_print)(std::FILE*, const Record&);
+        // A string literal
+        const char* m_format;
+        Level m_level;
+
+        std::byte m_payload[SIZE - 2 * sizeof(void*) - sizeof(Level)];
+    };
+
+    static_assert(sizeof(Record) <= Record::SIZE);
+
+    // The strings are truncated to this many characters
+    constexpr std::size_t MAX_STRING = 100;
+
+    template <typename T>
+    constexpr bool is_string = std::is_same_v<T, const char*>;
+
+    // How an argument is copied into a record: the strings (and the char arrays) as `const char*`
+    template <typename T>
+    using Stored = std::conditional_t<std::is_same_v<std::decay_t<T>, char*>, const char*, std::decay_t<T>>;
+
+    template <typename T>
+    constexpr std::size_t stored_size() {
+        if constexpr (is_string<T>) {
+            return sizeof(uint16_t) + MAX_STRING + 1;
+        }
+        else {
+            static_assert(std::is_arithmetic_v<T> || std::is_pointer_v<T>, "log arguments are numbers or strings");
+            return sizeof(T);
+        }
+    }
+
+    template <typename T>
+    void store(std::byte*& out, const T& arg) {
+        if constexpr (is_string<T>) {
+            auto length = static_cast<uint16_t>(strnlen(arg, MAX_STRING));
+            std::memcpy(out, &length, sizeof(length));
+            std::memcpy(out + sizeof(length), arg, length);
+            out[sizeof(length) + length] = std::byte{0};
+            out += sizeof(length) + length + 1;
+        }
+        else {
+            std::memcpy(out, &arg, sizeof(T));
+            out += sizeof(T);
+        }
+    }
+
+    template <typename T>
+    T load(const std::byte*& in) {
+        if constexpr (is_string<T>) {
+            uint16_t length;
+            std::memcpy(&length, in, sizeof(length));
+            auto text = reinterpret_cast<const char*>(in + sizeof(length));
+            in += sizeof(length) + length + 1;
+            return text;
+        }
+        else {
+            T value;
+            std::memcpy(&value, in, sizeof(T));
+            in += sizeof(T);
+            return value;
+        }
+    }
+
+    inline void print_prefix(std::FILE* stream, Level level) {
+        std::fprintf(stream, "[server][%s] :: ", name(level));
+    }
+
+    template <typename... Args>
+    void print_formatted(std::FILE* stream, const char* format, Args... args) {
+        if constexpr (sizeof...(Args) == 0) {
+            std::fputs(format, stream);
+        }
+        else {
+            std::fprintf(stream, format, args...);
+        }
+    }
+
+    template <typename... Args>
+    void print(std::FILE* stream, const Record& record) {
+        [[maybe_unused]] const std::byte* in = record.m_payload;
+        // A braced list is evaluated left to right, as the arguments have been stored
+        std::tuple<Args...> args{load<Args>(in)...};
+        print_prefix(stream, record.m_level);
+        std::apply([&](auto... values) { print_formatted(stream, record.m_format, values...); }, args);
+    }
+
+    /***
+     * The records of a thread: it is the only producer, the log thread the only consumer,
+     * hence no lock is taken. A record is dropped when the ring is full, the logging thread
+     * never waits.
+     */
+    struct Ring {
+
+        static constexpr std::size_t CAPACITY = 1024;
+
+        std::array<Record, CAPACITY> m_records{};
+
+        alignas(64) std::atomic_size_t m_head{0};
+        alignas(64) std::atomic_size_t m_tail{0};
+        std::atomic_size_t m_dropped{0};
+        // Set once the owner thread exits, the ring is discarded once drained
+        std::atomic_bool m_orphaned{false};
+    };
+
+    class Logger {
+
+    public:
+
+        // How long the log thread sleeps when there is nothing to print
+        static constexpr std::chrono::milliseconds DRAIN_INTERVAL{5};
+
+        static Logger& instance() {
+            // Never destroyed: the threads may still be logging while the process exits
+            static Logger* logger = new Logger();
+            return *logger;
+        }
+
+        template <typename... Args>
+        void append(Level level, const char* format, const Args&... args) {
+
+            static_assert((stored_size<Args>() + ... + 0) <= sizeof(Record::m_payload), "too many log arguments");
+
+            Ring& ring = thread_ring();
+
+            std::size_t tail = ring.m_tail.load(std::memory_order_relaxed);
+            if (tail - ring.m_head.load(std::memory_order_acquire) == Ring::CAPACITY) {
+                ring.m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+
+            Record& record = ring.m_records[tail % Ring::CAPACITY];
+            record.m_print = &print<Args...>;
+            record.m_format = format;
+            record.m_level = level;
+
+            [[maybe_unused]] std::byte* out = record.m_payload;
+            (store(out, args), ...);
+
+            ring.m_tail.store(tail + 1, std::memory_order_release);
+        }
+
+        /***
+         * Print a record right away, after the records still buffered: the warnings and
+         * the errors are rare, and they often precede an exit.
+         */
+        template <typename... Args>
+        void write(Level level, const char* format, const Args&... args) {
+            std::lock_guard<std::mutex> lock{m_drain_mutex};
+            drain_locked();
+            std::fflush(stdout);
+            std::FILE* stream = level >= Level::Error ? stderr : stdout;
+            print_prefix(stream, level);
+            print_formatted(stream, format, args...);
+            std::fflush(stream);
+        }
+
+        /***
+         * Print the buffered records of all the threads.
+         */
+        void flush() {
+            std::lock_guard<std::mutex> lock{m_drain_mutex};
+            drain_locked();
+            std::fflush(stdout);
+        }
+
+        /***
+         * The log thread, started with the first record: to place it on the CPUs, since it
+         * does not inherit the placement decided after it started.
+         */
+        std::thread::native_handle_type native_handle() const {
+            return m_thread;
+        }
+
+    private:
+
+        std::mutex m_rings_mutex{};
+        std::vector<std::shared_ptr<Ring>> m_rings{};
+
+        // Held while draining, by the log thread or by a `flush`
+        std::mutex m_drain_mutex{};
+
+        std::thread::native_handle_type m_thread{};
+
+        Logger() {
+            std::thread thread{[this]() { this->drain_loop(); }};
+            m_thread = thread.native_handle();
+            thread.detach();
+        }
+
+        /***
+         * The ring of the current thread, registered on its first record.
+         */
+        Ring& thread_ring() {
+
+            struct Owner {
+                std::shared_ptr<Ring> m_ring{std::make_shared<Ring>()};
+
+                Owner() {
+                    Logger& logger = Logger::instance();
+                    std::lock_guard<std::mutex> lock{logger.m_rings_mutex};
+                    logger.m_rings.push_back(m_ring);
+                }
+
+                ~Owner() { m_ring->m_orphaned = true; }
+            };
+
+            static thread_local Owner owner{};
+            return *owner.m_ring;
+        }
+
+        [[noreturn]] void drain_loop() {
+            while (true) {
+                std::size_t printed;
+                {
+                    std::lock_guard<std::mutex> lock{m_drain_mutex};
+                    printed = drain_locked();
+                }
+                if (printed != 0) {
+                    std::fflush(stdout);
+                }
+                else {
+                    std::this_thread::sleep_for(DRAIN_INTERVAL);
+                }
+            }
+        }
+
+        /***
+         * Print the records of all the rings, with the drain mutex held.
+         * @return How many records have been printed.
+         */
+        std::size_t drain_locked() {
+
+            std::vector<std::shared_ptr<Ring>> rings{};
+            {
+                std::lock_guard<std::mutex> lock{m_rings_mutex};
+                rings = m_rings;
+            }
+
+            std::size_t printed = 0;
+
+            for (auto& ring: rings) {
+
+                bool orphaned = ring->m_orphaned.load(std::memory_order_acquire);
+
+                std::size_t head = ring->m_head.load(std::memory_order_relaxed);
+                std::size_t tail = ring->m_tail.load(std::memory_order_acquire);
+
+                printed += tail - head;
+                for (; head != tail; head++) {
+                    const Record& record = ring->m_records[head % Ring::CAPACITY];
+                    record.m_print(stdout, record);
+                }
+                ring->m_head.store(head, std::memory_order_release);
+
+                if (std::size_t dropped = ring->m_dropped.exchange(0, std::memory_order_relaxed)) {
+                    print_prefix(stdout, Level::Warning);
+                    std::fprintf(stdout, "log: %lu records dropped, the log thread could not keep up\n", dropped);
+                }
+
+                if (orphaned) {
+                    std::lock_guard<std::mutex> lock{m_rings_mutex};
+                    std::erase(m_rings, ring);
+                }
+            }
+
+            return printed;
+        }
+    };
+
+    /***
+     * Only type-checks the format against the arguments, it is never called.
+     */
+    [[gnu::format(printf, 1, 2)]] inline void check_format(const char*, ...) {}
+
+    template <typename... Args>
+    void log(Level level, const char* format, const Args&... args) {
+        if (level >= Level::Warning) {
+            Logger::instance().write(level, format, Stored<Args>(args)...);
+        }
+        else {
+            Logger::instance().append<Stored<Args>...>(level, format, args...);
+        }
+    }
+
+}
+
+#define LOG_AT(level, ...) \
+    do { \
+        if constexpr (logging::enabled(level)) { \
+            if (false) { \
+                logging::check_format(__VA_ARGS__); \
+            } \
+            logging::log(level, __VA_ARGS__); \
+        } \
+    } while (false)
+
+#define LOG_DEBUG(...) LOG_AT(logging::Level::Debug, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(logging::Level::Info, __VA_ARGS__)
+#define LOG_WARNING(...) LOG_AT(logging::Level::Warning, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(logging::Level::Error, __VA_ARGS__)
@@ -1,22 +1,49 @@
 #ifndef ASSIGNMENT_2_SERVER_HPP
 #define ASSIGNMENT_2_SERVER_HPP
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cerrno>
+#include <condition_variable>
 #include <csignal>
+#include <memory>
+#include <mutex>
 
 #include <cstdlib>
+#include <string>
 #include <thread>
 #include <type_traits>
+#include <vector>
 
 #include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#include "Affinity.hpp"
 #include "HashTable.hpp"
+#include "FlatHashTable.hpp"
+#include "ShmHashTable.hpp"
+#include "Snapshot.hpp"
+#include "BulkLoad.hpp"
+#include "WriteAheadLog.hpp"
+#include "Log.hpp"
 #include "Common.hpp"
+#include "Doorbell.hpp"
 #include "Protocol.hpp"
+#include "Stats.hpp"
+#include "Trace.hpp"
 
-template<typename Key, typename Value>
+/***
+ * @tparam Table The hash table storing the pairs: the chained `HashTable` by default,
+ * or any table with the same interface (e.g. `FlatHashTable`, or `ShmHashTable` to let the
+ * clients read it directly).
+ */
+template<typename Key, typename Value, typename Table = HashTable<Key, Value>>
 class Server {
 
     using ShmQueue = protocol::SharedMessageQueue<Key, Value>;
@@ -24,50 +51,475 @@ class Server {
 public:
     Server(std::size_t workers, size_t initial_capacity) : m_hashtable(initial_capacity) {
         m_threads.resize(workers);
+        m_outboxes.resize(workers);
+        m_active_workers = workers;
+        for (auto& fd: this->m_client_doorbells) {
+            fd = -1;
+        }
     }
 
     void start() {
 
-        // The server MUST initialize the shared memory area...
-        init_shared_queue();
+        keep_off_worker_cpus();
+        check_oversubscription();
+
+        open();
+
+        if (!this->m_snapshot_path.empty()) {
+            this->m_snapshot_thread = std::thread{[this]() { this->snapshot_loop(); }};
+            this->m_snapshot_thread.detach();
+        }
+
+        if (this->m_cache_mode) {
+            this->m_report_thread = std::thread{[this]() { this->report_loop(); }};
+            this->m_report_thread.detach();
+        }
+
+        if constexpr (requires { this->m_hashtable.compact(std::size_t{}); }) {
+            this->m_compaction_thread = std::thread{[this]() { this->compaction_loop(); }};
+            this->m_compaction_thread.detach();
+        }
+
+        // The other workers of an elastic pool are started once it grows
+        std::size_t workers = this->m_active_workers.load();
+        this->m_spawned_workers = workers;
+
+        LOG_INFO("starting server with %lu workers...\n", workers);
+
+        for (unsigned worker_id = 0; worker_id < workers; worker_id++) {
+            spawn_worker(worker_id);
+        }
+
+        if (this->m_elastic) {
+            LOG_INFO("elastic pool: between %lu and %lu workers\n", this->m_min_workers, this->m_threads.size());
+            this->m_pool_thread = std::thread{[this]() { this->pool_loop(); }};
+            this->m_pool_thread.detach();
+        }
+
+        for (unsigned worker_id = 0; worker_id < workers; worker_id++) {
+            this->m_threads[worker_id].detach();
+        }
+
+        wait_for_shutdown();
+    }
+
+    /***
+     * Run as a cache bounded to the given memory: the table evicts the pairs not read
+     * recently, and the hit/miss/eviction counters are reported periodically.
+     * @return False if the table does not support eviction.
+     */
+    bool enable_cache(std::size_t max_memory) {
+        if constexpr (requires { this->m_hashtable.set_memory_limit(max_memory); }) {
+            this->m_hashtable.set_memory_limit(max_memory);
+            this->m_cache_mode = true;
+            return true;
+        }
+        return false;
+    }
+
+    //region Workers' placement
+
+    /***
+     * Pin each worker to one of the CPUs, once started: the list is ordered by NUMA node, so
+     * consecutive workers run on the same node, and it is reused from the start if there
+     * are more workers than CPUs (with a warning). The other threads of the server, the log
+     * thread included, are kept off these CPUs, if the process is allowed to run anywhere else.
+     */
+    void pin_workers(const std::vector<int>& cpus) {
+        this->m_worker_cpus = affinity::numa_order(cpus);
+    }
+
+    /***
+     * Let the workers spin on the request queue instead of sleeping in its condition
+     * variable: no wake-up latency, at the cost of a CPU per worker (pin them).
+     */
+    void enable_busy_poll() {
+        this->m_busy_poll = true;
+    }
+
+    //endregion
 
-        std::fprintf(stdout, "[server][info] :: starting server with %lu workers...\n", this->m_threads.size());
+    //region Elastic pool
 
-        unsigned worker_id = 0;
+    /***
+     * Size the pool of workers to the load, between `min_workers` and `max_workers`: it grows
+     * while the request queue stays deep, or while the requests wait longer than `target_wait`
+     * to be dequeued (at the 99th percentile, ignored if zero), and it shrinks once the workers
+     * stayed idle for a while. The workers given to the constructor (clamped between the two
+     * bounds) are started at first, the others on demand; the retired workers are parked.
+     */
+    void enable_elastic_pool(std::size_t min_workers, std::size_t max_workers, std::chrono::microseconds target_wait) {
+        max_workers = std::clamp<std::size_t>(max_workers, 1, stats::MAX_WORKERS);
+        min_workers = std::clamp<std::size_t>(min_workers, 1, max_workers);
+        this->m_active_workers = std::clamp(this->m_threads.size(), min_workers, max_workers);
+        this->m_min_workers = min_workers;
+        this->m_target_wait = target_wait;
+        this->m_threads.resize(max_workers);
+        this->m_outboxes.resize(max_workers);
+        this->m_elastic = true;
+    }
+
+    //endregion
+
+    //region Snapshots
+
+    /***
+     * Write a snapshot of the table to the file every `interval`, in background, once started.
+     */
+    void enable_snapshots(std::string path, std::chrono::seconds interval) {
+        this->m_snapshot_path = std::move(path);
+        this->m_snapshot_interval = interval;
+    }
+
+    /***
+     * Write a snapshot of the table to the file.
+     * @return False if it could not be written.
+     */
+    bool take_snapshot(const std::string& path) {
+
+        // The records logged from now on are replayed on top of this snapshot
+        auto segment = this->m_wal ? this->m_wal->rotate() : 0;
+
+        auto begin = std::chrono::steady_clock::now();
+        auto written = snapshot::write<Key, Value>(this->m_hashtable, path);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+
+        if (written == -1) {
+            LOG_ERROR("cannot write the snapshot to %s\n", path.c_str());
+            return false;
+        }
+
+        if (this->m_wal) {
+            this->m_wal->compact(segment);
+        }
+
+        LOG_INFO("snapshot of %ld pairs written to %s in %.3fs\n", written, path.c_str(), elapsed.count());
+        return true;
+    }
 
-        for (auto &th: this->m_threads) {
-            th = std::thread{[this, worker_id]() { this->loop(worker_id); }};
-            worker_id++;
+    /***
+     * Load the pairs of a snapshot into the table, in parallel with a thread per worker.
+     * @return False if the snapshot is missing or invalid.
+     */
+    bool restore_snapshot(const std::string& path) {
+
+        auto begin = std::chrono::steady_clock::now();
+        auto loaded = snapshot::load<Key, Value>(this->m_hashtable, path, std::max<std::size_t>(this->m_threads.size(), 1));
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+
+        if (loaded == -1) {
+            LOG_ERROR("cannot load a snapshot from %s: missing, corrupt, or written with other key and value types\n", path.c_str());
+            return false;
+        }
+
+        LOG_INFO("restored %ld pairs from %s in %.3fs (%.0f keys/s)\n",
+                     loaded, path.c_str(), elapsed.count(), static_cast<double>(loaded) / elapsed.count());
+        return true;
+    }
+
+    //endregion
+
+    /***
+     * Load the pairs of a seed file (see `bulk_load::Mapped`) into the table, in parallel
+     * with a thread per worker and without per-pair locking. To be invoked before `start`;
+     * the pairs are not logged to the write-ahead log. The malformed lines are skipped, and
+     * reported.
+     * @return False if the file is missing.
+     */
+    bool bulk_load(const std::string& path) {
+
+        auto begin = std::chrono::steady_clock::now();
+        auto loaded = bulk_load::load<Key, Value>(this->m_hashtable, path, std::max<std::size_t>(this->m_threads.size(), 1));
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+
+        if (!loaded) {
+            LOG_ERROR("cannot load the pairs from %s\n", path.c_str());
+            return false;
         }
 
-        for (auto &th: this->m_threads) {
-            th.join();
+        if (loaded->m_malformed != 0) {
+            LOG_WARNING("skipped %lu malformed lines of %s\n", loaded->m_malformed, path.c_str());
         }
+
+        uint64_t pairs = loaded->m_inserted + loaded->m_replaced;
+        LOG_INFO("loaded %lu distinct pairs from %s (%lu repeated keys replaced) in %.3fs (%.0f keys/s)\n",
+                     loaded->m_inserted, path.c_str(), loaded->m_replaced, elapsed.count(), static_cast<double>(pairs) / elapsed.count());
+        return true;
+    }
+
+    /***
+     * Log the inserts and removes to `<path>.<n>` before acknowledging them, after replaying
+     * the records already logged (the log thread starts with the server). To be invoked
+     * before `start`, after restoring the snapshot.
+     * @return False if the log has been written with other key and value types.
+     */
+    bool enable_wal(const std::string& path) {
+
+        this->m_wal = std::make_unique<Wal>(path, this->m_threads.size(), [this](DurableAnswer& pending) { return this->acknowledge_durable(pending); });
+
+        auto begin = std::chrono::steady_clock::now();
+        auto replayed = this->m_wal->replay([this](typename Wal::Op op, const Key& key, const Value& value, uint64_t expires_at) {
+            switch (op) {
+                case Wal::Op::Insert:
+                    // Only the tables with expirations accept the inserts with one
+                    if constexpr (EXPIRATIONS) {
+                        this->m_hashtable.insert(key, value, expires_at);
+                    }
+                    else {
+                        this->m_hashtable.insert(key, value);
+                    }
+                    break;
+                case Wal::Op::Update:
+                    this->m_hashtable.update(key, [&value](const std::optional<Value>&) { return std::optional{value}; });
+                    break;
+                case Wal::Op::Remove:
+                    this->m_hashtable.remove(key);
+                    break;
+            }
+        });
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+
+        if (!replayed) {
+            LOG_ERROR("cannot replay the log from %s: written with other key and value types\n", path.c_str());
+            return false;
+        }
+
+        LOG_INFO("replayed %lu logged writes from %s in %.3fs\n", replayed.value(), path.c_str(), elapsed.count());
+        return true;
+    }
+
+    /***
+     * Initialize the shared memory area and start accepting doorbell registrations,
+     * without spawning any worker. Used directly when the server is driven by an
+     * external event loop through `request_doorbell_fd` and `poll_requests`.
+     */
+    void open() {
+
+        TRACE_PROCESS_NAME("server");
+
+        // The server MUST initialize the shared memory area... and the statistics' segment,
+        // before starting any of the threads using them
+        init_shared_queue();
+        init_stats_segment();
+
+        if (this->m_wal) {
+            this->m_wal->open();
+        }
+
+        this->m_stats_thread = std::thread{[this]() { this->stats_loop(); }};
+        this->m_stats_thread.detach();
+
+        // Listen to the request doorbell: as long as nobody polls it, it is rung once at most
+        this->m_shared_queue->m_request_pending = false;
+
+        this->m_doorbell_thread = std::thread{[this]() { this->doorbell_registry_loop(); }};
+        this->m_doorbell_thread.detach();
+    }
+
+    /***
+     * Descriptor that becomes readable when clients enqueue new requests.
+     */
+    int request_doorbell_fd() const {
+        return this->m_request_doorbell.wait_fd();
+    }
+
+    /***
+     * Serve all the requests currently enqueued, without blocking.
+     * @param worker_id The id used to tag the log lines and to account the statistics,
+     * distinct for each thread polling at the same time.
+     * @return How many requests have been served.
+     */
+    size_t poll_requests(unsigned worker_id = 0) {
+
+        // Re-arm the doorbell before looking at the queue: a request enqueued from now
+        // on rings it again, the ones enqueued before are served by this poll.
+        this->m_request_doorbell.drain();
+        this->m_shared_queue->m_request_pending = false;
+
+        size_t served = 0;
+        std::array<ReqMessage, BATCH_SIZE> requests{};
+        std::array<Dequeued, BATCH_SIZE> dequeued{};
+        while (size_t count = this->m_shared_queue->try_receive_requests(requests.data(), dequeued.data(), BATCH_SIZE)) {
+            serve_batch(worker_id, requests.data(), dequeued.data(), count);
+            served += count;
+        }
+
+        return served;
     }
 
 private:
+    // As many as the workers there can be, started or not
     std::vector<std::thread> m_threads{};
     ShmQueue *m_shared_queue{nullptr};
 
-    HashTable<Key, Value> m_hashtable;
+    //region Doorbells
+    std::thread m_doorbell_thread{};
+    Doorbell m_request_doorbell{};
+    // The descriptors used to ring the clients' doorbells, indexed by client id
+    std::array<std::atomic_int, ShmQueue::MAX_CLIENTS> m_client_doorbells{};
+    //endregion
+
+    Table m_hashtable;
+
+    //region Durability
+    // A request answered by the log thread, once the writes it depends on are durable
+    struct DurableAnswer {
+        typename ShmQueue::ReqMessage m_request;
+        typename ShmQueue::ResMessage m_response;
+        // When the log thread first tried to answer, if it did
+        uint64_t m_first_attempt{0};
+    };
+
+    using Wal = WriteAheadLog<Key, Value, DurableAnswer>;
+    std::unique_ptr<Wal> m_wal{};
+
+    // Writes of the same key are logged in the order they are applied
+    static constexpr std::size_t LOG_STRIPES = 256;
+    std::array<std::mutex, LOG_STRIPES> m_log_stripes{};
+    //endregion
+
+    //region Cache mode
+    bool m_cache_mode{false};
+    std::thread m_report_thread{};
+
+    static constexpr std::chrono::seconds REPORT_INTERVAL{10};
+    //endregion
+
+    //region Statistics
+    // Inside its own shared memory segment, read-only for everybody else
+    stats::Segment* m_stats{nullptr};
+    std::thread m_stats_thread{};
+
+    // How often the table's statistics are published
+    static constexpr std::chrono::seconds STATS_INTERVAL{1};
+    //endregion
+
+    //region Workers' placement
+    std::vector<int> m_worker_cpus{};
+    bool m_busy_poll{false};
+
+    // How many times a busy-polling worker finds the queue empty before yielding its CPU,
+    // in case it shares it with other threads
+    static constexpr std::size_t BUSY_POLL_SPINS = 1024;
+    //endregion
+
+    //region Elastic pool
+    bool m_elastic{false};
+    std::thread m_pool_thread{};
+    std::size_t m_min_workers{0};
+    std::chrono::microseconds m_target_wait{0};
+
+    // The workers with a smaller id serve the requests, the others are parked (or not started yet)
+    std::atomic_size_t m_active_workers{0};
+    // Written by the pool's thread only, once the server started
+    std::size_t m_spawned_workers{0};
+    std::mutex m_pool_mutex{};
+    std::condition_variable m_pool_resized{};
+
+    // How often the load is sampled
+    static constexpr std::chrono::milliseconds POOL_INTERVAL{100};
+    // The pool grows after the queue stayed deep (or the waits above the target) this many samples in a row...
+    static constexpr std::size_t GROW_SAMPLES = 3;
+    // ... and it shrinks after the workers stayed idle this many samples in a row
+    static constexpr std::size_t SHRINK_SAMPLES = 50;
+    // The workers are idle if they are busy less than this fraction of the time
+    static constexpr double IDLE_UTILIZATION = 0.25;
+    //endregion
+
+    //region Compaction
+    std::thread m_compaction_thread{};
+
+    static constexpr std::chrono::seconds COMPACTION_INTERVAL{1};
+    // How many slots are compacted at once, between two yields to the workers
+    static constexpr std::size_t COMPACTION_BATCH = 1024;
+    //endregion
+
+    //region Snapshots
+    std::thread m_snapshot_thread{};
+    std::string m_snapshot_path{};
+    std::chrono::seconds m_snapshot_interval{0};
+    //endregion
 
     using ReqMessage = typename ShmQueue::ReqMessage;
     using ResMessage = typename ShmQueue::ResMessage;
+    using Dequeued = typename ShmQueue::Requests::Dequeued;
 
-    inline ReqMessage read_next_message() {
-        return this->m_shared_queue->receive_request();
-    }
+    // Whether the table lets the pairs expire
+    static constexpr bool EXPIRATIONS = requires (Table& table, Key key, Value value) { table.insert(key, value, uint64_t{}); };
+
+    //region Batching
+    // How many requests a worker dequeues at once
+    static constexpr std::size_t BATCH_SIZE = 16;
+
+    struct PendingResponse {
+        ResMessage m_response;
+        uint64_t m_deadline;
+        typename ReqMessage::Type m_type;
+    };
+
+    /***
+     * The responses of the batch a worker is serving, published once it is done.
+     */
+    struct Outbox {
+        bool m_batching{false};
+        std::vector<PendingResponse> m_pending{};
+        // The responses for the same client, enqueued at once
+        std::vector<ResMessage> m_run{};
+    };
+
+    std::vector<Outbox> m_outboxes{};
+    //endregion
+
+    //region Flushes
+    /***
+     * A client's flush waiting for its asynchronous writes still being applied by the other
+     * workers: the worker applying the last of them answers it.
+     */
+    struct ParkedFlush {
+        std::mutex m_mutex{};
+        std::optional<ReqMessage> m_request{};
+        // The writes it waits for, 0 if none is parked: checked before taking the mutex
+        std::atomic_uint64_t m_sequence{0};
+    };
+
+    std::array<ParkedFlush, ShmQueue::MAX_CLIENTS> m_parked_flushes{};
+    //endregion
+
+    // How long a response waits at most for room in its client's queue
+    static constexpr std::chrono::milliseconds RESPONSE_WAIT{100};
+
+    // Rung by SIGINT, the main thread shuts the server down: the handler itself only writes
+    // into it, the cleanup and the exit handlers (the trace dump) are not async-signal-safe
+    Doorbell m_shutdown_doorbell{};
+    static inline int shutdown_ring_fd = -1;
 
     static void sigint_handler(int signal) {
+        Doorbell::ring(shutdown_ring_fd);
+    }
+    static void sigkill_handler(int signal) {
         if (shm_unlink(protocol::SHM_FILENAME) == -1) {
             panic("[server] :: error while invoking `shm_unlink`");
         }
-        std::exit(EXIT_SUCCESS);
     }
-    static void sigkill_handler(int signal) {
+
+    /***
+     * Wait for SIGINT, then remove the shared segments and exit from the main thread, with
+     * the workers still running.
+     */
+    [[noreturn]] void wait_for_shutdown() {
+
+        pollfd pfd{.fd = this->m_shutdown_doorbell.wait_fd(), .events = POLLIN, .revents = 0};
+        while (poll(&pfd, 1, -1) == -1 && errno == EINTR) {}
+
+        unlink(protocol::DOORBELL_SOCKET);
+        if constexpr (requires { Table::unlink_shared_memory(); }) {
+            Table::unlink_shared_memory();
+        }
+        shm_unlink(stats::SHM_FILENAME);
         if (shm_unlink(protocol::SHM_FILENAME) == -1) {
             panic("[server] :: error while invoking `shm_unlink`");
         }
+        std::exit(EXIT_SUCCESS);
     }
 
     void init_shared_queue() {
@@ -75,6 +527,7 @@ private:
         int fd;
         char *addr;
 
+        shutdown_ring_fd = this->m_shutdown_doorbell.ring_fd();
         std::signal(SIGINT, Server::sigint_handler);
         std::signal(SIGKILL, Server::sigkill_handler);
 
@@ -96,76 +549,1015 @@ private:
         addr = reinterpret_cast<char*>(mmap_addr);
 
         this->m_shared_queue = new(addr) ShmQueue();
+        this->m_shared_queue->m_expirations = EXPIRATIONS;
+    }
+
+    /***
+     * Create the statistics' segment: the server maps it read-write, the readers read-only.
+     */
+    void init_stats_segment() {
+
+        int fd;
+
+        if ((fd = shm_open(stats::SHM_FILENAME, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) == -1) {
+            panic("[server] :: error while invoking shm_open on the statistics' segment");
+        }
+
+        if (ftruncate(fd, sizeof(stats::Segment)) == -1) {
+            panic("[server] :: error while invoking ftruncate on the statistics' segment");
+        }
+
+        void* addr = mmap(nullptr, sizeof(stats::Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            panic("[server] :: error while invoking mmap on the statistics' segment");
+        }
+
+        close(fd);
+
+        this->m_stats = new(addr) stats::Segment();
+        this->m_stats->m_workers = std::max<std::size_t>(this->m_threads.size(), 1);
+        this->m_stats->m_active_workers = this->m_active_workers.load();
+        this->m_stats->m_min_workers = this->m_elastic ? this->m_min_workers : this->m_active_workers.load();
+        this->m_stats->m_started_at = deadline::now();
+        this->m_stats->m_updated_at = this->m_stats->m_started_at.load();
+    }
+
+    stats::WorkerStats& worker_stats(unsigned worker_id) {
+        return this->m_stats->m_worker_stats[worker_id % stats::MAX_WORKERS];
+    }
+
+    /***
+     * Publish the statistics that are not updated by the workers: the table's size and the
+     * waits for its stripes' locks.
+     */
+    [[noreturn]] void stats_loop() {
+        while (true) {
+            std::this_thread::sleep_for(STATS_INTERVAL);
+
+            this->m_stats->m_pairs.store(this->m_hashtable.size(), std::memory_order_relaxed);
+            this->m_stats->m_capacity.store(this->m_hashtable.capacity(), std::memory_order_relaxed);
+            if constexpr (requires { this->m_hashtable.memory_usage(); }) {
+                this->m_stats->m_memory_usage.store(this->m_hashtable.memory_usage(), std::memory_order_relaxed);
+            }
+
+            if constexpr (requires { this->m_hashtable.lock_waits(); }) {
+                this->m_stats->m_lock_waits.store(this->m_hashtable.lock_waits(), std::memory_order_relaxed);
+                this->m_stats->m_lock_wait_ns.store(this->m_hashtable.lock_wait_ns(), std::memory_order_relaxed);
+
+                auto stripes = this->m_hashtable.for_each_stripe_wait([this](std::size_t stripe, uint64_t waits, uint64_t wait_ns) {
+                    if (stripe < stats::MAX_STRIPES) {
+                        this->m_stats->m_stripe_stats[stripe].m_waits.store(waits, std::memory_order_relaxed);
+                        this->m_stats->m_stripe_stats[stripe].m_wait_ns.store(wait_ns, std::memory_order_relaxed);
+                    }
+                });
+                this->m_stats->m_stripes.store(std::min(stripes, stats::MAX_STRIPES), std::memory_order_relaxed);
+            }
+
+            this->m_stats->m_updated_at.store(deadline::now(), std::memory_order_release);
+        }
+    }
+
+    /***
+     * Accept doorbell registrations: a client sends its client id together with the
+     * descriptor of its response doorbell, the server answers with the descriptor of
+     * the request doorbell.
+     */
+    [[noreturn]] void doorbell_registry_loop() {
+
+        int sock;
+
+        if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+            panic("[server] :: error while invoking socket");
+        }
+
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, protocol::DOORBELL_SOCKET, sizeof(addr.sun_path) - 1);
+
+        unlink(protocol::DOORBELL_SOCKET);
+        if (bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1) {
+            panic("[server] :: error while invoking bind on the doorbell socket");
+        }
+
+        if (listen(sock, ShmQueue::MAX_CLIENTS) == -1) {
+            panic("[server] :: error while invoking listen on the doorbell socket");
+        }
+
+        while (true) {
+
+            int conn = accept(sock, nullptr, nullptr);
+            if (conn == -1) {
+                continue;
+            }
+
+            int client_id = -1;
+            int fd = Doorbell::receive_fd(conn, &client_id);
+
+            if (fd != -1 && client_id >= 0 && client_id < static_cast<int>(ShmQueue::MAX_CLIENTS)) {
+                // A previous client with the same id could have left its descriptor behind
+                int old_fd = this->m_client_doorbells[client_id].exchange(fd);
+                if (old_fd != -1) {
+                    close(old_fd);
+                }
+                Doorbell::send_fd(conn, this->m_request_doorbell.ring_fd(), client_id);
+                LOG_INFO("registered doorbell for client#%d\n", client_id);
+            }
+            else if (fd != -1) {
+                close(fd);
+            }
+
+            close(conn);
+        }
+    }
+
+    [[noreturn]] void report_loop() {
+        while (true) {
+            std::this_thread::sleep_for(REPORT_INTERVAL);
+
+            uint64_t hits = 0, misses = 0;
+            for (std::size_t i = 0; i < std::min<std::size_t>(this->m_stats->m_workers, stats::MAX_WORKERS); i++) {
+                hits += this->m_stats->m_worker_stats[i].m_hits.load(std::memory_order_relaxed);
+                misses += this->m_stats->m_worker_stats[i].m_misses.load(std::memory_order_relaxed);
+            }
+
+            if constexpr (requires { this->m_hashtable.evictions(); }) {
+                LOG_INFO("cache: %lu pairs, %lu bytes, %lu hits, %lu misses, %lu evictions, %lu expired\n",
+                             this->m_hashtable.size(), this->m_hashtable.memory_usage(), hits, misses,
+                             this->m_hashtable.evictions(), this->m_hashtable.expirations());
+            }
+        }
+    }
+
+    /***
+     * Compact the table in background, a batch of slots at a time, after some pairs have
+     * been removed, and report how much memory has been given back.
+     */
+    [[noreturn]] void compaction_loop() {
+        while (true) {
+            std::this_thread::sleep_for(COMPACTION_INTERVAL);
+
+            if (!this->m_hashtable.compaction_pending()) {
+                continue;
+            }
+
+            auto reclaimed = this->m_hashtable.reclaimed_bytes();
+            while (!this->m_hashtable.compact(COMPACTION_BATCH)) {
+                std::this_thread::yield();
+            }
+
+            if (this->m_hashtable.reclaimed_bytes() != reclaimed) {
+                LOG_INFO("compaction: %lu bytes reclaimed (%lu in total), %lu pairs, capacity %lu, %lu bytes in use, %lu bytes of slabs\n",
+                             this->m_hashtable.reclaimed_bytes() - reclaimed, this->m_hashtable.reclaimed_bytes(),
+                             this->m_hashtable.size(), this->m_hashtable.capacity(), this->m_hashtable.memory_usage(),
+                             Table::slab_bytes());
+            }
+        }
+    }
+
+    [[noreturn]] void snapshot_loop() {
+        while (true) {
+            std::this_thread::sleep_for(this->m_snapshot_interval);
+            take_snapshot(this->m_snapshot_path);
+        }
     }
 
     [[noreturn]] void loop(unsigned worker_id) {
 
-        std::fprintf(stdout, "[server][info] :: worker#{%u}: starting main loop...\n", worker_id);
+        LOG_DEBUG("worker#{%u}: starting main loop...\n", worker_id);
+
+        std::array<ReqMessage, BATCH_SIZE> requests{};
+        std::array<Dequeued, BATCH_SIZE> dequeued{};
 
         while (true) {
 
-            std::fprintf(stdout, "[server][info] :: worker#{%u}: ready to read next message...\n", worker_id);
-             auto incoming_message = this->read_next_message();
+            park_while_retired(worker_id);
 
-            switch (incoming_message.m_type) {
-                case ReqMessage::Type::Read: {
+            LOG_DEBUG("worker#{%u}: ready to read next messages...\n", worker_id);
+            size_t count = this->m_shared_queue->receive_requests(requests.data(), dequeued.data(), BATCH_SIZE);
 
-                    ResMessage answer(incoming_message.m_from_client_id);
-                    std::fprintf(stdout, "[server][info] :: worker#{%u}: read key{%s}\n", worker_id, incoming_message.m_key.data);
+            serve_batch(worker_id, requests.data(), dequeued.data(), count);
+        }
+    }
 
-                    if (auto val = m_hashtable.get(incoming_message.m_key)) {
-                        std::fprintf(stdout, "[server][info] :: worker#{%u}: read key{%s}: success value{%s}!\n", worker_id, incoming_message.m_key.data, val.value()->data);
-                        std::memcpy(&answer.m_value, &val.value()->data, sizeof(Value));
-                        answer.m_type = ResMessage::Type::SuccessfulRead;
-                    }
-                    else {
-                        std::fprintf(stdout, "[server][info] :: worker#{%u}: read key{%s}: fail!\n", worker_id, incoming_message.m_key.data);
-                        answer.m_type = ResMessage::Type::FailedRead;
-                    }
+    /***
+     * Like `loop`, spinning on the queue while it is empty: the queue's mutex is taken
+     * only once it looks non-empty, so the spinning workers don't slow the clients down.
+     */
+    [[noreturn]] void busy_poll_loop(unsigned worker_id) {
 
-                    m_shared_queue->answer_pending_request(answer);
+        LOG_DEBUG("worker#{%u}: starting busy-poll loop...\n", worker_id);
 
-                    break;
+        std::array<ReqMessage, BATCH_SIZE> requests{};
+        std::array<Dequeued, BATCH_SIZE> dequeued{};
+        std::size_t spins = 0;
+
+        while (true) {
+
+            park_while_retired(worker_id);
+
+            if (this->m_shared_queue->requests_pending()) {
+                if (size_t count = this->m_shared_queue->try_receive_requests(requests.data(), dequeued.data(), BATCH_SIZE)) {
+                    serve_batch(worker_id, requests.data(), dequeued.data(), count);
+                    spins = 0;
+                    continue;
+                }
+            }
+
+            if (++spins % BUSY_POLL_SPINS == 0) {
+                std::this_thread::yield();
+            }
+            else {
+                affinity::cpu_relax();
+            }
+        }
+    }
+
+    void spawn_worker(unsigned worker_id) {
+        this->m_threads[worker_id] = std::thread{[this, worker_id]() {
+            pin_worker(worker_id);
+            if (this->m_busy_poll) {
+                this->busy_poll_loop(worker_id);
+            }
+            else {
+                this->loop(worker_id);
+            }
+        }};
+    }
+
+    /***
+     * Park the worker while the pool is smaller than its id, until it grows again. A worker
+     * retired while waiting for requests serves the next batch it gets before parking.
+     */
+    void park_while_retired(unsigned worker_id) {
+
+        if (worker_id < this->m_active_workers.load(std::memory_order_relaxed)) {
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock{this->m_pool_mutex};
+        LOG_DEBUG("worker#{%u}: parked\n", worker_id);
+        this->m_pool_resized.wait(lock, [&]() { return worker_id < this->m_active_workers.load(std::memory_order_relaxed); });
+        LOG_DEBUG("worker#{%u}: resumed\n", worker_id);
+    }
+
+    /***
+     * Resize the pool, starting the workers that never ran and waking up the parked ones.
+     */
+    void resize_pool(std::size_t workers) {
+        {
+            std::lock_guard<std::mutex> lock{this->m_pool_mutex};
+            this->m_active_workers.store(workers, std::memory_order_relaxed);
+        }
+        this->m_pool_resized.notify_all();
+
+        for (; this->m_spawned_workers < workers; this->m_spawned_workers++) {
+            spawn_worker(this->m_spawned_workers);
+            this->m_threads[this->m_spawned_workers].detach();
+        }
+
+        this->m_stats->m_active_workers.store(workers, std::memory_order_relaxed);
+    }
+
+    /***
+     * Sample the load of the workers every POOL_INTERVAL, from the statistics they publish:
+     * the queue depth and the waits of the requests dequeued since the previous sample, and
+     * how busy the active workers have been. The pool grows by half when the load stays high
+     * (a burst is absorbed in a few samples), and it shrinks by one worker at a time when the
+     * load stays low.
+     */
+    [[noreturn]] void pool_loop() {
+
+        using Snapshot = stats::Histogram::Snapshot;
+
+        auto sample = [this](Snapshot& depth, Snapshot& waits, uint64_t& busy_ns) {
+            depth = Snapshot{};
+            depth.add(this->m_stats->m_queue_depth);
+            waits = Snapshot{};
+            for (auto& op: this->m_stats->m_ops) {
+                waits.add(op.m_queue_wait);
+            }
+            busy_ns = 0;
+            for (std::size_t i = 0; i < this->m_threads.size(); i++) {
+                busy_ns += worker_stats(i).m_busy_ns.load(std::memory_order_relaxed);
+            }
+        };
+
+        // Large enough not to live on the stack
+        auto before = std::make_unique<std::pair<Snapshot, Snapshot>>();
+        auto after = std::make_unique<std::pair<Snapshot, Snapshot>>();
+        uint64_t busy_before = 0, busy_after = 0;
+
+        sample(before->first, before->second, busy_before);
+        uint64_t sampled_at = deadline::now();
+
+        std::size_t deep = 0, slow = 0, idle = 0;
+        uint64_t target_wait_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(this->m_target_wait).count();
+
+        while (true) {
+            std::this_thread::sleep_for(POOL_INTERVAL);
+
+            sample(after->first, after->second, busy_after);
+            uint64_t now = deadline::now();
+
+            auto depth = stats::Histogram::summarize(after->first, before->first);
+            auto waits = stats::Histogram::summarize(after->second, before->second);
+            std::size_t workers = this->m_active_workers.load(std::memory_order_relaxed);
+            double utilization = static_cast<double>(busy_after - busy_before) / static_cast<double>((now - sampled_at) * workers);
+
+            std::swap(before, after);
+            busy_before = busy_after;
+            sampled_at = now;
+
+            // More requests left behind each dequeued one than there are workers to take them
+            deep = depth.m_count != 0 && depth.m_mean > static_cast<double>(workers) ? deep + 1 : 0;
+            slow = target_wait_ns != 0 && waits.m_count != 0 && waits.m_p99 > target_wait_ns ? slow + 1 : 0;
+            idle = deep == 0 && slow == 0 && utilization < IDLE_UTILIZATION ? idle + 1 : 0;
+
+            if ((deep >= GROW_SAMPLES || slow >= GROW_SAMPLES) && workers < this->m_threads.size()) {
+                std::size_t grown = std::min(workers + (workers + 1) / 2, this->m_threads.size());
+                LOG_INFO("elastic pool: growing to %lu workers (queue depth %.1f, p99 wait %luns, utilization %.2f)\n",
+                         grown, depth.m_mean, waits.m_p99, utilization);
+                (deep >= GROW_SAMPLES ? this->m_stats->m_grows_on_depth : this->m_stats->m_grows_on_wait).fetch_add(1, std::memory_order_relaxed);
+                resize_pool(grown);
+                deep = slow = idle = 0;
+            }
+            else if (idle >= SHRINK_SAMPLES && workers > this->m_min_workers) {
+                LOG_INFO("elastic pool: shrinking to %lu workers (utilization %.2f)\n", workers - 1, utilization);
+                this->m_stats->m_shrinks.fetch_add(1, std::memory_order_relaxed);
+                resize_pool(workers - 1);
+                idle = 0;
+            }
+        }
+    }
+
+    void pin_worker(unsigned worker_id) {
+
+        if (this->m_worker_cpus.empty()) {
+            return;
+        }
+
+        int cpu = this->m_worker_cpus[worker_id % this->m_worker_cpus.size()];
+        if (affinity::pin_current_thread({cpu})) {
+            LOG_INFO("worker#{%u}: pinned to cpu %d (node %d)\n", worker_id, cpu, affinity::numa_node(cpu));
+        }
+        else {
+            LOG_WARNING("worker#{%u}: cannot be pinned to cpu %d\n", worker_id, cpu);
+        }
+    }
+
+    /***
+     * Restrict the calling thread, and the threads it starts from now on, to the CPUs not
+     * reserved to the workers (if there are any left).
+     */
+    void keep_off_worker_cpus() {
+
+        if (this->m_worker_cpus.empty()) {
+            return;
+        }
+
+        std::vector<int> others{};
+        for (int cpu: affinity::allowed_cpus()) {
+            if (std::find(this->m_worker_cpus.begin(), this->m_worker_cpus.end(), cpu) == this->m_worker_cpus.end()) {
+                others.push_back(cpu);
+            }
+        }
+
+        if (others.empty()) {
+            return;
+        }
+
+        affinity::pin_current_thread(others);
+
+        // The log thread is started by the first record, likely before the server
+        if constexpr (logging::LEVEL != logging::Level::Off) {
+            affinity::pin_thread(logging::Logger::instance().native_handle(), others);
+        }
+    }
+
+    /***
+     * Warn if the workers outnumber the CPUs they run on: they take turns on them, and the
+     * busy-polling ones burn their time slices spinning while the others wait.
+     */
+    void check_oversubscription() {
+
+        std::size_t workers = this->m_threads.size();
+        std::size_t cpus = this->m_worker_cpus.empty() ? affinity::allowed_cpus().size() : this->m_worker_cpus.size();
+
+        if (workers <= cpus) {
+            return;
+        }
+
+        if (this->m_busy_poll) {
+            LOG_WARNING("%lu busy-polling workers on %lu cpus: they spin on the same cpus, use at most %lu workers\n",
+                        workers, cpus, cpus);
+        }
+        else {
+            LOG_WARNING("%lu workers on %lu cpus, they will take turns on them\n", workers, cpus);
+        }
+    }
+
+    /***
+     * Serve a batch of requests, dequeued at once. Between the requests without a key (the
+     * flushes and the scans, which keep their place), the requests are ordered by stripe, so
+     * consecutive ones lock the same stripe while it is still in the worker's cache; the
+     * requests for the same key keep their order. The responses are published once the batch
+     * is done, the ones for the same client at once.
+     */
+    void serve_batch(unsigned worker_id, ReqMessage* requests, Dequeued* dequeued, size_t count) {
+
+        // The stripe of each request, and its index in the batch
+        std::array<std::pair<std::size_t, std::size_t>, BATCH_SIZE> order{};
+        for (size_t i = 0; i < count; i++) {
+            order[i] = {0, i};
+        }
+
+        if constexpr (requires { this->m_hashtable.stripe_of(requests[0].m_key); }) {
+            size_t begin = 0;
+            for (size_t i = 0; i <= count; i++) {
+                if (i == count || !has_key(requests[i])) {
+                    // Ties are ordered by index: the requests of a stripe keep their order
+                    std::sort(order.begin() + begin, order.begin() + i);
+                    begin = i + 1;
                 }
-                case ReqMessage::Type::Insert: {
+                else {
+                    order[i].first = this->m_hashtable.stripe_of(requests[i].m_key);
+                }
+            }
+        }
+
+        bool coalesce = worker_id < this->m_outboxes.size();
+        if (coalesce) {
+            this->m_outboxes[worker_id].m_batching = true;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            auto index = order[i].second;
+            serve(worker_id, requests[index], dequeued[index]);
+        }
 
-                    if (auto prev = m_hashtable.insert(incoming_message.m_key, incoming_message.m_value)) {
-                        std::fprintf(stdout, "[server][info] :: worker#{%u}: insert key{%s}: popped out value{%s}\n", worker_id, incoming_message.m_key.data, prev.value().data);
+        if (coalesce) {
+            this->m_outboxes[worker_id].m_batching = false;
+            publish_responses(worker_id);
+        }
+    }
+
+    static bool has_key(const ReqMessage& request) {
+        return request.m_type != ReqMessage::Type::Flush && request.m_type != ReqMessage::Type::Scan;
+    }
+
+    /***
+     * Handle the request, accounting its latencies, the depth of the queue and the time
+     * of the worker in the statistics.
+     */
+    void serve(unsigned worker_id, const ReqMessage& request, const Dequeued& dequeued) {
+
+        uint64_t dequeued_at = deadline::now();
+        {
+            TRACE_SPAN(request_serve, tracing::trace_id(request.m_from_client_id, request.m_request_id), request.m_type);
+            TRACE_FLOW_END("request", tracing::trace_id(request.m_from_client_id, request.m_request_id));
+            handle_request(worker_id, request);
+        }
+        uint64_t done_at = deadline::now();
+
+        static_assert(static_cast<std::size_t>(ReqMessage::Type::Scan) + 1 == stats::OPS.size(), "stats::OPS must follow the request types");
+
+        auto type = static_cast<std::size_t>(request.m_type);
+        if (type < stats::OPS.size()) {
+            auto& op = this->m_stats->m_ops[type];
+            op.m_queue_wait.record(dequeued_at - std::min(dequeued.m_enqueued_at, dequeued_at));
+            op.m_service.record(done_at - dequeued_at);
+            op.m_end_to_end.record(done_at - std::min(dequeued.m_enqueued_at, dequeued_at));
+        }
+        this->m_stats->m_queue_depth.record(dequeued.m_depth);
+
+        auto& worker = worker_stats(worker_id);
+        worker.m_requests.fetch_add(1, std::memory_order_relaxed);
+        worker.m_busy_ns.fetch_add(done_at - dequeued_at, std::memory_order_relaxed);
+    }
+
+    void handle_request(unsigned worker_id, ReqMessage incoming_message) {
+
+        // The client already gave up on an expired request: shed it without serving. Nobody
+        // waits for an asynchronous write, and a later `flush` acknowledges it: it is applied anyway.
+        if (!incoming_message.m_async && deadline::expired(incoming_message.m_deadline)) {
+            LOG_INFO("worker#{%u}: dropping expired request from client#%d\n", worker_id, incoming_message.m_from_client_id);
+            return;
+        }
+
+        switch (incoming_message.m_type) {
+            case ReqMessage::Type::Read: {
+
+                ResMessage answer(incoming_message.m_from_client_id);
+                LOG_INFO("worker#{%u}: read key{%s}\n", worker_id, text::format(incoming_message.m_key).m_text);
+
+                auto& counters = worker_stats(worker_id);
+
+                auto val = [&]() {
+                    TRACE_SPAN(table, tracing::trace_id(incoming_message.m_from_client_id, incoming_message.m_request_id), incoming_message.m_type);
+                    return m_hashtable.get(incoming_message.m_key);
+                }();
+
+                if (val) {
+                    counters.m_hits.fetch_add(1, std::memory_order_relaxed);
+                    LOG_INFO("worker#{%u}: read key{%s}: success value{%s}!\n", worker_id, text::format(incoming_message.m_key).m_text, text::format(val.value()).m_text);
+                    answer.m_value = val.value();
+                    answer.m_type = ResMessage::Type::SuccessfulRead;
+                }
+                else {
+                    counters.m_misses.fetch_add(1, std::memory_order_relaxed);
+                    LOG_INFO("worker#{%u}: read key{%s}: fail!\n", worker_id, text::format(incoming_message.m_key).m_text);
+                    answer.m_type = ResMessage::Type::FailedRead;
+                }
+
+                answer_request(worker_id, answer, incoming_message);
+
+                break;
+            }
+            case ReqMessage::Type::Insert: {
+
+                // The client checks it already: a pair would be stored that never expires
+                if (!EXPIRATIONS && incoming_message.m_expires_at != deadline::NONE) {
+                    LOG_WARNING("worker#{%u}: insert key{%s}: this table does not support expirations\n", worker_id, text::format(incoming_message.m_key).m_text);
+                    if (incoming_message.m_async) {
+                        async_applied(worker_id, incoming_message.m_from_client_id);
                     }
                     else {
-                        std::fprintf(stdout, "[server][info] :: worker#{%u}: insert operation key{%s}: new value{%s} registered!\n", worker_id, incoming_message.m_key.data, incoming_message.m_value.data);
+                        answer_request(worker_id, ResMessage(incoming_message.m_from_client_id, ResMessage::Type::FailedUpdate), incoming_message);
                     }
+                    break;
+                }
 
-                    if (!incoming_message.m_async) {
-                        send_acknowledgement(worker_id, incoming_message);
+                apply_write(worker_id, incoming_message, Wal::Op::Insert, [&]() {
+                    if (auto prev = insert(incoming_message)) {
+                        LOG_INFO("worker#{%u}: insert key{%s}: popped out value{%s}\n", worker_id, text::format(incoming_message.m_key).m_text, text::format(prev.value()).m_text);
                     }
+                    else {
+                        LOG_INFO("worker#{%u}: insert operation key{%s}: new value{%s} registered!\n", worker_id, text::format(incoming_message.m_key).m_text, text::format(incoming_message.m_value).m_text);
+                    }
+                });
 
-                    break;
-                }
-                case ReqMessage::Type::Remove: {
+                break;
+            }
+            case ReqMessage::Type::Remove: {
 
+                apply_write(worker_id, incoming_message, Wal::Op::Remove, [&]() {
                     if (auto _ = m_hashtable.remove(incoming_message.m_key)) {
-                        std::fprintf(stdout, "[server][info] :: worker#{%u}: remove key{%s} => success!\n", worker_id, incoming_message.m_key.data);
+                        LOG_INFO("worker#{%u}: remove key{%s} => success!\n", worker_id, text::format(incoming_message.m_key).m_text);
                     }
                     else {
-                        std::fprintf(stdout, "[server][info] :: worker#{%u}: remove key{%s} => missing key\n", worker_id, incoming_message.m_key.data);
+                        LOG_INFO("worker#{%u}: remove key{%s} => missing key\n", worker_id, text::format(incoming_message.m_key).m_text);
                     }
+                });
 
-                    if (!incoming_message.m_async) {
-                        send_acknowledgement(worker_id, incoming_message);
-                    }
+                break;
+            }
+            case ReqMessage::Type::Flush: {
 
+                // The queue is FIFO, hence the client's asynchronous writes have already been
+                // dequeued: the ones still being applied by the other workers answer it.
+                if (m_shared_queue->m_async_applied[incoming_message.m_from_client_id].load() < incoming_message.m_sequence) {
+                    park_flush(worker_id, incoming_message);
                     break;
                 }
+
+                answer_flush(worker_id, incoming_message);
+                break;
+            }
+            case ReqMessage::Type::Append:
+
+                // Integers cannot be appended to: nothing to apply, nor to log
+                if constexpr (std::is_integral_v<Value>) {
+                    LOG_INFO("worker#{%u}: append key{%s}: integer values cannot be appended to\n", worker_id, text::format(incoming_message.m_key).m_text);
+                    answer_request(worker_id, ResMessage(incoming_message.m_from_client_id, ResMessage::Type::FailedUpdate), incoming_message);
+                    break;
+                }
+                [[fallthrough]];
+            case ReqMessage::Type::CompareAndSwap:
+            case ReqMessage::Type::FetchAdd:
+            case ReqMessage::Type::GetAndSet: {
+
+                apply_update(worker_id, incoming_message);
+
+                break;
             }
+            case ReqMessage::Type::Scan: {
 
+                ResMessage answer(incoming_message.m_from_client_id);
+
+                if constexpr (requires { m_hashtable.scan(uint64_t{}, [](const Key&, const Value&) {}); }) {
+                    fill_scan_batch(incoming_message);
+                    LOG_INFO("worker#{%u}: scan batch for client#%d\n", worker_id, incoming_message.m_from_client_id);
+                }
+                else {
+                    // The table cannot be scanned
+                    answer.m_type = ResMessage::Type::FailedRead;
+                }
+
+                answer_request(worker_id, answer, incoming_message);
+
+                break;
+            }
         }
     }
 
+    /***
+     * Fill the client's scan batch with the pairs following the request's cursor, visiting
+     * the table a slot (and its stripe) at a time, without any global lock.
+     */
+    void fill_scan_batch(const ReqMessage& request) {
+
+        TRACE_SPAN(table, tracing::trace_id(request.m_from_client_id, request.m_request_id), request.m_type);
+
+        using Batch = protocol::ScanBatch<Key, Value>;
+        Batch& batch = m_shared_queue->m_scan_batches[request.m_from_client_id][request.m_batch % 2];
+
+        std::vector<typename Batch::Entry> step{};
+        uint64_t cursor = request.m_cursor;
+        uint64_t skip = request.m_skip;
+
+        batch.m_count = 0;
+
+        do {
+            step.clear();
+            uint64_t next = m_hashtable.scan(cursor, [&step](const Key& key, const Value& value) {
+                step.push_back({key, value});
+            });
+
+            // The slots could have lost some pairs since the previous batch
+            skip = std::min<uint64_t>(skip, step.size());
+
+            if (batch.m_count + (step.size() - skip) > Batch::CAPACITY) {
+                if (batch.m_count > 0) {
+                    // The next batch starts from these slots
+                    break;
+                }
+                // The slots alone don't fit a batch: they are split
+                std::copy_n(step.begin() + skip, Batch::CAPACITY, batch.m_entries.begin());
+                batch.m_count = Batch::CAPACITY;
+                skip += Batch::CAPACITY;
+                break;
+            }
+
+            std::copy(step.begin() + skip, step.end(), batch.m_entries.begin() + batch.m_count);
+            batch.m_count += step.size() - skip;
+            skip = 0;
+            cursor = next;
+
+        } while (cursor != 0 && batch.m_count < Batch::CAPACITY);
+
+        batch.m_cursor = cursor;
+        batch.m_skip = skip;
+    }
+
+    /***
+     * Insert the request's pair, with its expiration if the table supports it (otherwise the
+     * request never has one).
+     */
+    std::optional<Value> insert(const ReqMessage& incoming_message) {
+        if constexpr (EXPIRATIONS) {
+            return m_hashtable.insert(incoming_message.m_key, incoming_message.m_value, incoming_message.m_expires_at);
+        }
+        else {
+            return m_hashtable.insert(incoming_message.m_key, incoming_message.m_value);
+        }
+    }
+
+    /***
+     * Apply the write to the table and acknowledge it. With the write-ahead log, the write
+     * is logged in the same order it is applied, and the log thread acknowledges it once
+     * it is durable.
+     */
+    template <typename Apply>
+    void apply_write(unsigned worker_id, const ReqMessage& incoming_message, typename Wal::Op op, Apply apply) {
+
+        auto traced_apply = [&]() {
+            TRACE_SPAN(table, tracing::trace_id(incoming_message.m_from_client_id, incoming_message.m_request_id), incoming_message.m_type);
+            apply();
+        };
+
+        if (this->m_wal) {
+            std::lock_guard<std::mutex> lock{this->m_log_stripes[std::hash<Key>{}(incoming_message.m_key) % LOG_STRIPES]};
+            traced_apply();
+            this->m_wal->append(worker_id, op, incoming_message.m_key, incoming_message.m_value, incoming_message.m_expires_at,
+                                incoming_message.m_async ? std::nullopt : std::optional{DurableAnswer{incoming_message, ResMessage(incoming_message.m_from_client_id)}});
+        }
+        else {
+            traced_apply();
+        }
+
+        if (incoming_message.m_async) {
+            async_applied(worker_id, incoming_message.m_from_client_id);
+        }
+        else if (!this->m_wal) {
+            send_acknowledgement(worker_id, incoming_message);
+        }
+    }
+
+    /***
+     * Answer the flush: all the client's asynchronous writes it waits for have been applied.
+     * With the write-ahead log, the log thread answers it once they are durable.
+     */
+    void answer_flush(unsigned worker_id, const ReqMessage& request) {
+
+        ResMessage response(request.m_from_client_id);
+        response.m_sequence = m_shared_queue->m_async_applied[request.m_from_client_id].load();
+
+        if (this->m_wal) {
+            this->m_wal->sync(worker_id, DurableAnswer{request, response});
+            return;
+        }
+
+        LOG_INFO("worker#{%u}: flush for client#%d: %lu writes applied\n", worker_id, request.m_from_client_id, response.m_sequence);
+        answer_request(worker_id, response, request);
+    }
+
+    /***
+     * Leave the flush to the worker applying the last of the writes it waits for, instead of
+     * waiting for them. A client has a single flush in flight: a new one replaces the parked
+     * one, which the client gave up on.
+     */
+    void park_flush(unsigned worker_id, const ReqMessage& request) {
+
+        auto& parked = this->m_parked_flushes[request.m_from_client_id];
+        {
+            std::lock_guard<std::mutex> lock{parked.m_mutex};
+            parked.m_request = request;
+            parked.m_sequence.store(request.m_sequence);
+        }
+
+        // The last write could have been applied before the flush was parked
+        if (m_shared_queue->m_async_applied[request.m_from_client_id].load() >= request.m_sequence) {
+            take_parked_flush(worker_id, request.m_from_client_id);
+        }
+    }
+
+    /***
+     * Account an asynchronous write of the client as applied, and answer its parked flush if
+     * it was waiting for this write.
+     */
+    void async_applied(unsigned worker_id, int client_id) {
+        uint64_t applied = ++m_shared_queue->m_async_applied[client_id];
+        uint64_t waiting = this->m_parked_flushes[client_id].m_sequence.load();
+        if (waiting != 0 && applied >= waiting) {
+            take_parked_flush(worker_id, client_id);
+        }
+    }
+
+    /***
+     * Answer the client's parked flush, if still there (and not expired) once its writes are applied.
+     */
+    void take_parked_flush(unsigned worker_id, int client_id) {
+
+        auto& parked = this->m_parked_flushes[client_id];
+        std::optional<ReqMessage> request{};
+        {
+            std::lock_guard<std::mutex> lock{parked.m_mutex};
+            if (!parked.m_request || m_shared_queue->m_async_applied[client_id].load() < parked.m_request->m_sequence) {
+                return;
+            }
+            request.swap(parked.m_request);
+            parked.m_sequence.store(0);
+        }
+
+        if (!deadline::expired(request->m_deadline)) {
+            answer_flush(worker_id, request.value());
+        }
+    }
+
+    /***
+     * Apply a read-modify-write request atomically, under the key's stripe lock, and answer
+     * it with a single response. A resulting value is logged as an insert; with the
+     * write-ahead log the answer waits for it (or, if nothing changed, for the writes it
+     * has read) to be durable. The requests are always answered, even if sent as async.
+     */
+    void apply_update(unsigned worker_id, const ReqMessage& incoming_message) {
+
+        ResMessage answer(incoming_message.m_from_client_id);
+        std::optional<Value> stored{};
+
+        auto update = [&]() {
+            TRACE_SPAN(table, tracing::trace_id(incoming_message.m_from_client_id, incoming_message.m_request_id), incoming_message.m_type);
+            m_hashtable.update(incoming_message.m_key, [&](const std::optional<Value>& current) {
+                stored = read_modify_write(incoming_message, current, answer);
+                return stored;
+            });
+        };
+
+        if (this->m_wal) {
+            std::lock_guard<std::mutex> lock{this->m_log_stripes[std::hash<Key>{}(incoming_message.m_key) % LOG_STRIPES]};
+            update();
+            if (stored) {
+                this->m_wal->append(worker_id, Wal::Op::Update, incoming_message.m_key, stored.value(), deadline::NONE, DurableAnswer{incoming_message, answer});
+            }
+            else {
+                this->m_wal->sync(worker_id, DurableAnswer{incoming_message, answer});
+            }
+            return;
+        }
+
+        update();
+
+        LOG_INFO("worker#{%u}: update key{%s}: %s\n", worker_id, text::format(incoming_message.m_key).m_text, stored ? "applied" : "unchanged");
+        answer_request(worker_id, answer, incoming_message);
+    }
+
+    /***
+     * The value a read-modify-write request stores (None to leave it unchanged), given the
+     * current one. It fills the answer:
+     *  - CompareAndSwap: the previous value if swapped, `FailedUpdate` with the current one if it
+     *    differs from the expected one, `FailedRead` if missing;
+     *  - FetchAdd: the previous number (a missing value counts as zero), `FailedUpdate` if the
+     *    value is not a number, or the result would not fit;
+     *  - Append: the resulting value, `FailedUpdate` if it would not fit (string values only);
+     *  - GetAndSet: the previous value, `FailedRead` if missing (the value is set anyway).
+     * Nothing stored is never answered as `SuccessfulRead`.
+     */
+    static std::optional<Value> read_modify_write(const ReqMessage& request, const std::optional<Value>& current, ResMessage& answer) {
+
+        std::optional<Value> updated{};
+        answer.m_type = ResMessage::Type::SuccessfulRead;
+        answer.m_value = current.value_or(Value{});
+
+        switch (request.m_type) {
+            case ReqMessage::Type::CompareAndSwap:
+                if (!current) {
+                    answer.m_type = ResMessage::Type::FailedRead;
+                }
+                else if (current.value() == request.m_expected) {
+                    updated = request.m_value;
+                }
+                break;
+            case ReqMessage::Type::FetchAdd:
+                if ((updated = rmw::add(current, request.m_delta))) {
+                    answer.m_value = rmw::add(current, 0).value();
+                }
+                break;
+            case ReqMessage::Type::Append:
+                if constexpr (!std::is_integral_v<Value>) {
+                    if ((updated = rmw::append(current, request.m_value))) {
+                        answer.m_value = updated.value();
+                    }
+                }
+                break;
+            case ReqMessage::Type::GetAndSet:
+                updated = request.m_value;
+                if (!current) {
+                    answer.m_type = ResMessage::Type::FailedRead;
+                }
+                break;
+            default:
+                break;
+        }
+
+        if (!updated && answer.m_type == ResMessage::Type::SuccessfulRead) {
+            answer.m_type = ResMessage::Type::FailedUpdate;
+        }
+
+        return updated;
+    }
+
+    /***
+     * Answer a request whose records are durable, without waiting for room in the client's
+     * queue: the log thread answers the clients of a batch one after the other, and a client
+     * with a full queue must not delay the others. (Log thread)
+     * @return False if the client's queue is full: the answer is retried later, until the
+     * request's deadline and for RESPONSE_WAIT at most, then dropped.
+     */
+    bool acknowledge_durable(DurableAnswer& pending) {
+
+        auto& request = pending.m_request;
+        auto& response = pending.m_response;
+        response.m_request_id = request.m_request_id;
+
+        TRACE_SPAN(response_enqueue, tracing::trace_id(response.m_dest_client, response.m_request_id), request.m_type);
+
+        if (m_shared_queue->try_answer_pending_requests(response.m_dest_client, &response, 1) == 1) {
+            LOG_INFO("log: sent durable answer to client#%d!\n", request.m_from_client_id);
+            TRACE_FLOW_START("response", tracing::trace_id(response.m_dest_client, response.m_request_id));
+            ring_client(response.m_dest_client);
+            return true;
+        }
+
+        uint64_t now = deadline::now();
+        if (pending.m_first_attempt == 0) {
+            pending.m_first_attempt = now;
+        }
+
+        if (deadline::expired(request.m_deadline)) {
+            return true;
+        }
+        if (now - pending.m_first_attempt >= static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(RESPONSE_WAIT).count())) {
+            LOG_WARNING("log: dropping a durable answer for client#%d: its queue stayed full\n", request.m_from_client_id);
+            this->m_stats->m_dropped_responses.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        return false;
+    }
+
     void send_acknowledgement(unsigned worker_id, const ReqMessage &incoming_message) {
         ResMessage response(incoming_message.m_from_client_id);
-        std::fprintf(stdout, "[server][info] :: worker#{%u}: sending ack to client#%d!\n", worker_id, incoming_message.m_from_client_id);
-        m_shared_queue->answer_pending_request(response);
+        LOG_INFO("worker#{%u}: sending ack to client#%d!\n", worker_id, incoming_message.m_from_client_id);
+        answer_request(worker_id, response, incoming_message);
+    }
+
+    /***
+     * Enqueue the response inside the client's queue, ringing its doorbell if the
+     * client registered one and it is not pending already. The response is dropped
+     * if the client gave up on the request while waiting for a free slot.
+     */
+    void answer_request(ResMessage response, const ReqMessage& request) {
+        response.m_request_id = request.m_request_id;
+        publish_response(response, request.m_deadline, request.m_type);
+    }
+
+    /***
+     * Answer a request served by a worker: while the worker is serving a batch, the response
+     * is kept in its outbox until the batch is done.
+     */
+    void answer_request(unsigned worker_id, ResMessage response, const ReqMessage& request) {
+        if (worker_id < this->m_outboxes.size() && this->m_outboxes[worker_id].m_batching) {
+            response.m_request_id = request.m_request_id;
+            this->m_outboxes[worker_id].m_pending.push_back({response, request.m_deadline, request.m_type});
+            return;
+        }
+        answer_request(response, request);
+    }
+
+    /***
+     * Enqueue the response, waiting for room in the client's queue until the request's
+     * deadline, and never longer than RESPONSE_WAIT: a client that does not consume its
+     * queue (stuck, or dead) must not stall the workers. The responses dropped past
+     * RESPONSE_WAIT are counted.
+     */
+    void publish_response(const ResMessage& response, uint64_t deadline_ns, typename ReqMessage::Type type) {
+
+        TRACE_SPAN(response_enqueue, tracing::trace_id(response.m_dest_client, response.m_request_id), type);
+
+        uint64_t bound = deadline::now() + std::chrono::duration_cast<std::chrono::nanoseconds>(RESPONSE_WAIT).count();
+        if (!m_shared_queue->answer_pending_request(response, deadline_ns == deadline::NONE ? bound : std::min(deadline_ns, bound))) {
+            if (!deadline::expired(deadline_ns)) {
+                LOG_WARNING("dropping a response for client#%d: its queue stayed full\n", response.m_dest_client);
+                this->m_stats->m_dropped_responses.fetch_add(1, std::memory_order_relaxed);
+            }
+            return;
+        }
+        TRACE_FLOW_START("response", tracing::trace_id(response.m_dest_client, response.m_request_id));
+
+        ring_client(response.m_dest_client);
+    }
+
+    /***
+     * Publish the responses kept in the worker's outbox: the ones for the same client are
+     * enqueued at once, with a single wake-up and doorbell. The ones that don't fit in the
+     * client's queue are published one by one, waiting for room until their deadline.
+     */
+    void publish_responses(unsigned worker_id) {
+
+        auto& outbox = this->m_outboxes[worker_id];
+        auto& pending = outbox.m_pending;
+
+        std::stable_sort(pending.begin(), pending.end(), [](const PendingResponse& a, const PendingResponse& b) {
+            return a.m_response.m_dest_client < b.m_response.m_dest_client;
+        });
+
+        for (size_t begin = 0, end; begin < pending.size(); begin = end) {
+
+            int client = pending[begin].m_response.m_dest_client;
+
+            outbox.m_run.clear();
+            for (end = begin; end < pending.size() && pending[end].m_response.m_dest_client == client; end++) {
+                outbox.m_run.push_back(pending[end].m_response);
+            }
+
+            size_t sent;
+            {
+                TRACE_SPAN(response_enqueue, tracing::trace_id(client, outbox.m_run[0].m_request_id), pending[begin].m_type);
+                sent = m_shared_queue->try_answer_pending_requests(client, outbox.m_run.data(), outbox.m_run.size());
+            }
+            for (size_t i = 0; i < sent; i++) {
+                TRACE_FLOW_START("response", tracing::trace_id(client, outbox.m_run[i].m_request_id));
+            }
+            if (sent != 0) {
+                ring_client(client);
+            }
+
+            for (size_t i = begin + sent; i < end; i++) {
+                publish_response(pending[i].m_response, pending[i].m_deadline, pending[i].m_type);
+            }
+        }
+
+        pending.clear();
+    }
+
+    /***
+     * Ring the client's doorbell, if it registered one and it is not pending already.
+     */
+    void ring_client(int client_id) {
+        int doorbell = this->m_client_doorbells[client_id].load();
+        if (doorbell != -1 && m_shared_queue->arm_response_doorbell(client_id)) {
+            Doorbell::ring(doorbell);
+        }
     }
 };
 
@@ -0,0 +1,429 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <thread>
+#include <atomic>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "Common.hpp"
+#include "Epoch.hpp"
+#include "ShmTable.hpp"
+
+/***
+ * Hash table living inside shared memory, so that the clients can read it directly
+ * (see `shm_table::Reader`) while the writes still go through the server. It offers the
+ * same interface of `HashTable`, hence it can be used as `Server`'s table.
+ *
+ * The buckets are chained through offsets inside a fixed pool of nodes. Each stripe's
+ * version is both the writers' lock and the readers' seqlock. Once the pool is exhausted
+ * the table is copied into a new, twice as large, generation: the writers are stopped
+ * meanwhile, the readers notice the stale generation and map the new one.
+ */
+template <typename Key, typename Value, typename Hash = hashing::Default<Key>>
+class ShmHashTable {
+
+    using Segment = shm_table::Segment<Key, Value>;
+    using Node = typename Segment::Node;
+
+public:
+
+    /***
+     * Create the shared memory objects of the table.
+     * @param initial_capacity Rounded up to a power of two.
+     */
+    ShmHashTable(std::size_t initial_capacity = 1 << 3) {
+
+        auto [addr, size] = create(shm_table::CONTROL_SHM_FILENAME, sizeof(shm_table::Control));
+        this->m_control = new(addr) shm_table::Control{};
+
+        auto capacity = std::bit_ceil(std::max<std::size_t>(initial_capacity, 1));
+        this->m_mapping = make_generation(0, capacity);
+    }
+
+    ~ShmHashTable() {
+        Mapping* mapping = this->m_mapping.load();
+        shm_unlink(shm_table::segment_name(mapping->m_generation).c_str());
+        Mapping::destroy(mapping);
+        munmap(this->m_control, sizeof(shm_table::Control));
+        shm_unlink(shm_table::CONTROL_SHM_FILENAME);
+    }
+
+    ShmHashTable(const ShmHashTable&) = delete;
+    ShmHashTable& operator=(const ShmHashTable&) = delete;
+
+    /***
+     * Remove the shared memory objects of the table, e.g. when the server is interrupted.
+     */
+    static void unlink_shared_memory() {
+        auto [addr, size] = shm_table::map(shm_table::CONTROL_SHM_FILENAME, O_RDONLY);
+        if (addr != nullptr) {
+            auto generation = reinterpret_cast<shm_table::Control*>(addr)->m_generation.load();
+            shm_unlink(shm_table::segment_name(generation).c_str());
+            munmap(addr, size);
+        }
+        shm_unlink(shm_table::CONTROL_SHM_FILENAME);
+    }
+
+    std::size_t size() const {
+        return this->m_mapping.load()->m_segment->m_size;
+    }
+
+    std::size_t capacity() const {
+        return this->m_mapping.load()->m_segment->m_capacity;
+    }
+
+    std::optional<Value> insert(Key key, Value value) noexcept {
+        return update(key, [&value](const std::optional<Value>&) {
+            return std::optional{value};
+        });
+    }
+
+    /***
+     * Read-modify-write the value indexed by the key atomically, with the stripe locked.
+     * @param modify Invoked with the current value (None if missing), it returns the value
+     * to store, or None to leave the table unchanged. It is invoked again if the table has
+     * to grow first.
+     * @return The previous value.
+     */
+    template <typename Modify>
+    std::optional<Value> update(const Key& key, Modify modify) noexcept {
+
+        auto hashed = Hash{}(key);
+
+        while (true) {
+
+            epoch::Guard guard{};
+            WriteSection section{*this, hashed};
+            Segment* segment = section.m_segment;
+
+            auto& slot = segment->slots()[segment->index(hashed)];
+
+            Node* existing = nullptr;
+            for (uint32_t offset = slot.load(); offset != shm_table::NIL; offset = segment->node(offset).m_next.load()) {
+                Node& node = segment->node(offset);
+                if (node.m_hash == hashed && node.m_key == key) {
+                    existing = &node;
+                    break;
+                }
+            }
+
+            std::optional<Value> current{};
+            if (existing != nullptr) {
+                current = existing->m_value;
+            }
+
+            std::optional<Value> updated = modify(current);
+            if (!updated) {
+                return current;
+            }
+
+            if (existing != nullptr) {
+                // We find an existing entry, we replace its value
+                existing->m_value = std::move(updated.value());
+                return current;
+            }
+
+            uint32_t offset = allocate_node(segment);
+            if (offset == shm_table::NIL) {
+                // The pool is exhausted: let the section go, and move to a larger generation
+                section.release();
+                grow(section.m_mapping);
+                continue;
+            }
+
+            Node* node = new(&segment->node(offset)) Node{};
+            node->m_hash = hashed;
+            node->m_key = key;
+            node->m_value = std::move(updated.value());
+            node->m_next.store(slot.load(), std::memory_order_relaxed);
+            slot.store(offset, std::memory_order_release);
+
+            segment->m_size++;
+            return {};
+        }
+    }
+
+    /***
+     * Get the value indexed by the key, if contained. (Read-Only operation)
+     * The lookup is the same one of the clients: lockless, validated against the stripe's version.
+     * If it can't be validated, the key is read with the stripe locked.
+     */
+    std::optional<Value> get(const Key& key) noexcept {
+
+        auto hashed = Hash{}(key);
+
+        epoch::Guard guard{};
+
+        Segment* segment = this->m_mapping.load(std::memory_order_acquire)->m_segment;
+        if (auto result = segment->optimistic_find(hashed, key, MAX_OPTIMISTIC_ATTEMPTS)) {
+            return result.value();
+        }
+
+        // Too many writers on the stripe, or the table is growing: let's queue behind them.
+        // The stripe has no reader lock, the readers in the clients retry meanwhile
+        WriteSection section{*this, hashed};
+        return section.m_segment->find(hashed, key);
+    }
+
+    std::optional<std::pair<Key, Value>> remove(const Key &key) noexcept {
+
+        auto hashed = Hash{}(key);
+
+        epoch::Guard guard{};
+        WriteSection section{*this, hashed};
+        Segment* segment = section.m_segment;
+
+        std::atomic_uint32_t* link = &segment->slots()[segment->index(hashed)];
+
+        for (uint32_t offset = link->load(); offset != shm_table::NIL; offset = link->load()) {
+            Node& node = segment->node(offset);
+            if (node.m_hash == hashed && node.m_key == key) {
+                auto removed = std::pair{std::move(node.m_key), std::move(node.m_value)};
+                link->store(node.m_next.load(), std::memory_order_release);
+                // Readers still on the node retry, since the stripe's version changes
+                free_node(segment, offset);
+                segment->m_size--;
+                return std::optional{removed};
+            }
+            link = &node.m_next;
+        }
+
+        return {};
+    }
+
+    bool has(const Key& key) noexcept {
+        return get(key).has_value();
+    }
+
+    /***
+     * Visit all the pairs, a stripe at a time. It is not an atomic snapshot: the pairs
+     * written meanwhile may or may not be visited. The table doesn't grow until it returns.
+     * @param visit Invoked with each (key, value) pair.
+     */
+    template <typename Visit>
+    void for_each(Visit visit) {
+
+        std::lock_guard<std::mutex> grow_lock{this->m_grow_mutex};
+        Segment* segment = this->m_mapping.load()->m_segment;
+
+        for (std::size_t stripe = 0; stripe < segment->m_stripe_count; stripe++) {
+
+            lock(segment->stripes()[stripe]);
+
+            // The slots sharing the stripe
+            for (std::size_t index = stripe; index < segment->m_capacity; index += segment->m_stripe_count) {
+                for (uint32_t offset = segment->slots()[index].load(); offset != shm_table::NIL; offset = segment->node(offset).m_next.load()) {
+                    visit(segment->node(offset).m_key, segment->node(offset).m_value);
+                }
+            }
+
+            unlock(segment->stripes()[stripe]);
+        }
+    }
+
+private:
+
+    /***
+     * A generation mapped by the server.
+     */
+    struct Mapping {
+
+        uint64_t m_generation;
+        Segment* m_segment;
+        std::size_t m_bytes;
+
+        static void destroy(void* ptr) {
+            auto mapping = reinterpret_cast<Mapping*>(ptr);
+            munmap(mapping->m_segment, mapping->m_bytes);
+            delete mapping;
+        }
+    };
+
+    /***
+     * RAII writer section on the stripe of the given hash, in the current generation.
+     * The stripe's version is odd while it is held.
+     */
+    struct WriteSection {
+
+        Mapping* m_mapping;
+        Segment* m_segment;
+        shm_table::Stripe* m_stripe{nullptr};
+
+        WriteSection(ShmHashTable& table, uint64_t hashed) {
+            while (true) {
+                m_mapping = table.m_mapping.load(std::memory_order_acquire);
+                m_segment = m_mapping->m_segment;
+                m_stripe = &m_segment->stripe(hashed);
+
+                lock(*m_stripe);
+
+                // The table could have grown while we were waiting
+                if (!m_segment->m_stale.load(std::memory_order_acquire)) {
+                    return;
+                }
+                unlock(*m_stripe);
+            }
+        }
+
+        ~WriteSection() {
+            release();
+        }
+
+        void release() {
+            if (m_stripe != nullptr) {
+                unlock(*m_stripe);
+                m_stripe = nullptr;
+            }
+        }
+    };
+
+    shm_table::Control* m_control{nullptr};
+    std::atomic<Mapping*> m_mapping{nullptr};
+
+    // Held by the thread moving the table to a new generation
+    std::mutex m_grow_mutex{};
+
+    // The stripes grow together with the table, up to this many
+    static constexpr std::size_t MAX_STRIPES = 1 << 14;
+
+    // How many times a reader retries before yielding
+    static constexpr int MAX_OPTIMISTIC_ATTEMPTS = 8;
+
+    static void lock(shm_table::Stripe& stripe) {
+        while (true) {
+            auto version = stripe.m_version.load(std::memory_order_relaxed);
+            if (!(version & 1) && stripe.m_version.compare_exchange_weak(version, version + 1, std::memory_order_acquire)) {
+                std::atomic_thread_fence(std::memory_order_release);
+                return;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    static void unlock(shm_table::Stripe& stripe) {
+        stripe.m_version.fetch_add(1, std::memory_order_release);
+    }
+
+    static std::pair<void*, std::size_t> create(const char* name, std::size_t bytes) {
+
+        int fd;
+        if ((fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR)) == -1) {
+            panic("[server] :: error while invoking shm_open for the shared table");
+        }
+
+        if (ftruncate(fd, static_cast<off_t>(bytes)) == -1) {
+            panic("[server] :: error while invoking ftruncate for the shared table");
+        }
+
+        void* addr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            panic("[server] :: error while invoking mmap for the shared table");
+        }
+
+        close(fd);
+
+        return {addr, bytes};
+    }
+
+    static Mapping* make_generation(uint64_t generation, std::size_t capacity) {
+        auto stripes = std::min(capacity, MAX_STRIPES);
+        auto name = shm_table::segment_name(generation);
+        auto [addr, bytes] = create(name.c_str(), Segment::bytes(capacity, capacity, stripes));
+        return new Mapping{generation, new(addr) Segment(capacity, capacity, stripes), bytes};
+    }
+
+    /***
+     * @return The offset of a free node, or NIL if the pool is exhausted.
+     */
+    static uint32_t allocate_node(Segment* segment) {
+
+        while (segment->m_free_lock.test_and_set(std::memory_order_acquire)) {}
+
+        uint32_t offset = shm_table::NIL;
+        if (segment->m_free_head != shm_table::NIL) {
+            offset = segment->m_free_head;
+            segment->m_free_head = segment->node(offset).m_next.load(std::memory_order_relaxed);
+        }
+        else if (segment->m_unused_nodes > 0) {
+            // Nodes never used yet are taken in order
+            offset = static_cast<uint32_t>(segment->m_node_capacity - --segment->m_unused_nodes);
+        }
+
+        segment->m_free_lock.clear(std::memory_order_release);
+        return offset;
+    }
+
+    /***
+     * Push the node to the free list. Its `m_next` is reused as the list's link: a reader
+     * still on the node may follow it to an unrelated node, but it fails the validation.
+     */
+    static void free_node(Segment* segment, uint32_t offset) {
+        while (segment->m_free_lock.test_and_set(std::memory_order_acquire)) {}
+        segment->node(offset).m_next.store(segment->m_free_head, std::memory_order_release);
+        segment->m_free_head = offset;
+        segment->m_free_lock.clear(std::memory_order_release);
+    }
+
+    /***
+     * Copy the table into a new generation with twice the capacity, holding all the
+     * stripes of the current one.
+     * @param full The generation found full.
+     */
+    void grow(Mapping* full) {
+
+        std::lock_guard<std::mutex> grow_lock{this->m_grow_mutex};
+
+        epoch::Guard guard{};
+        Mapping* mapping = this->m_mapping.load();
+        if (mapping != full) {
+            // Somebody else has already grown it
+            return;
+        }
+
+        Segment* old = mapping->m_segment;
+        for (std::size_t i = 0; i < old->m_stripe_count; i++) {
+            lock(old->stripes()[i]);
+        }
+
+        Mapping* grown = make_generation(mapping->m_generation + 1, old->m_capacity * 2);
+        Segment* segment = grown->m_segment;
+
+        for (std::size_t i = 0; i < old->m_capacity; i++) {
+            for (uint32_t offset = old->slots()[i].load(); offset != shm_table::NIL; offset = old->node(offset).m_next.load()) {
+                Node& node = old->node(offset);
+                uint32_t copy = allocate_node(segment);
+                auto& slot = segment->slots()[segment->index(node.m_hash)];
+                Node* copied = new(&segment->node(copy)) Node{};
+                copied->m_hash = node.m_hash;
+                copied->m_key = node.m_key;
+                copied->m_value = node.m_value;
+                copied->m_next.store(slot.load(), std::memory_order_relaxed);
+                slot.store(copy, std::memory_order_relaxed);
+            }
+        }
+        segment->m_size.store(old->m_size.load());
+
+        // Publish the new generation, to the server's threads and to the clients
+        this->m_mapping.store(grown, std::memory_order_release);
+        this->m_control->m_generation.store(grown->m_generation, std::memory_order_release);
+        old->m_stale.store(true, std::memory_order_release);
+
+        for (std::size_t i = 0; i < old->m_stripe_count; i++) {
+            unlock(old->stripes()[i]);
+        }
+
+        // Clients mapping the old generation keep it until they notice it is stale
+        shm_unlink(shm_table::segment_name(mapping->m_generation).c_str());
+        epoch::Domain::instance().retire(mapping, &Mapping::destroy);
+    }
+
+};
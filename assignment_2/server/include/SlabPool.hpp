@@ -0,0 +1,176 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+
+namespace slab {
+
+    /***
+     * A pool of blocks of a fixed size, carved out of larger slabs: allocating and freeing
+     * a block is a pointer bump or a free-list push/pop, under the pool's own mutex, instead
+     * of a call to the general-purpose allocator. Each slab keeps its own freed blocks, which
+     * are reused before carving new ones; a slab whose blocks are all free is given back to
+     * the upstream allocator, except the one being carved (it is reset instead), so a pool
+     * that shrinks does not keep its peak footprint.
+     * Each pool lives on its own cache lines, so that the pools of a sharded set don't
+     * share them.
+     * @tparam Allocator The upstream allocator, stateless, providing the slabs.
+     */
+    template <typename Allocator>
+    class alignas(64) Pool {
+
+        using ByteAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<std::byte>;
+
+    public:
+
+        // The size of the slabs requested to the upstream allocator
+        static constexpr std::size_t SLAB_SIZE = 64 * 1024;
+
+        /***
+         * @param block_size Rounded up to a multiple of the pointer's size; the blocks are
+         * aligned as the upstream allocator aligns the slabs, up to this multiple.
+         */
+        explicit Pool(std::size_t block_size) :
+            m_block_size{(std::max(block_size, sizeof(FreeBlock)) + alignof(FreeBlock) - 1) & ~(alignof(FreeBlock) - 1)} {}
+
+        ~Pool() {
+            for (auto& [begin, slab]: m_slabs) {
+                ByteAllocator{}.deallocate(begin, slab.m_size);
+            }
+        }
+
+        Pool(const Pool&) = delete;
+        Pool& operator=(const Pool&) = delete;
+
+        void* allocate() {
+
+            std::lock_guard<std::mutex> lock{m_mutex};
+
+            // The freed blocks first, so the slabs fill up again instead of new ones being carved
+            if (Slab* slab = m_partial) {
+                FreeBlock* block = slab->m_free;
+                slab->m_free = block->m_next;
+                slab->m_live++;
+                if (slab->m_free == nullptr) {
+                    unlink_partial(slab);
+                }
+                return block;
+            }
+
+            if (m_current == nullptr || static_cast<std::size_t>(m_current->m_end - m_current->m_cursor) < m_block_size) {
+                // The rest of the current slab is too small, it is wasted
+                std::size_t size = std::max(SLAB_SIZE, m_block_size);
+                std::byte* begin = ByteAllocator{}.allocate(size);
+                m_current = &m_slabs.try_emplace(begin, begin, size).first->second;
+                m_slab_bytes += size;
+            }
+
+            void* block = m_current->m_cursor;
+            m_current->m_cursor += m_block_size;
+            m_current->m_live++;
+            return block;
+        }
+
+        void deallocate(void* ptr) noexcept {
+
+            std::lock_guard<std::mutex> lock{m_mutex};
+
+            // The slab holding the block: the last one starting at or before it
+            auto it = std::prev(m_slabs.upper_bound(static_cast<std::byte*>(ptr)));
+            Slab* slab = &it->second;
+
+            if (--slab->m_live == 0) {
+                unlink_partial(slab);
+                if (slab == m_current) {
+                    // Carved again from its start
+                    slab->m_free = nullptr;
+                    slab->m_cursor = slab->m_begin;
+                }
+                else {
+                    m_slab_bytes -= slab->m_size;
+                    ByteAllocator{}.deallocate(slab->m_begin, slab->m_size);
+                    m_slabs.erase(it);
+                }
+                return;
+            }
+
+            slab->m_free = new(ptr) FreeBlock{slab->m_free};
+            if (!slab->m_listed) {
+                link_partial(slab);
+            }
+        }
+
+        std::size_t block_size() const {
+            return m_block_size;
+        }
+
+        /***
+         * The memory held from the upstream allocator, by the slabs.
+         */
+        std::size_t slab_bytes() {
+            std::lock_guard<std::mutex> lock{m_mutex};
+            return m_slab_bytes;
+        }
+
+    private:
+
+        struct FreeBlock {
+            FreeBlock* m_next;
+        };
+
+        struct Slab {
+            std::byte* m_begin;
+            std::size_t m_size;
+            // The part of the slab never carved yet
+            std::byte* m_cursor;
+            std::byte* m_end;
+            // The blocks in use, and the freed ones
+            std::size_t m_live{0};
+            FreeBlock* m_free{nullptr};
+            // In the list of the slabs with freed blocks
+            bool m_listed{false};
+            Slab* m_prev{nullptr};
+            Slab* m_next{nullptr};
+
+            Slab(std::byte* begin, std::size_t size) : m_begin{begin}, m_size{size}, m_cursor{begin}, m_end{begin + size} {}
+        };
+
+        std::mutex m_mutex{};
+        const std::size_t m_block_size;
+
+        // The slabs by address, to find the one holding a freed block
+        std::map<std::byte*, Slab> m_slabs{};
+        std::size_t m_slab_bytes{0};
+
+        // The slab being carved, and the slabs with freed blocks
+        Slab* m_current{nullptr};
+        Slab* m_partial{nullptr};
+
+        void link_partial(Slab* slab) {
+            slab->m_listed = true;
+            slab->m_prev = nullptr;
+            slab->m_next = m_partial;
+            if (m_partial != nullptr) {
+                m_partial->m_prev = slab;
+            }
+            m_partial = slab;
+        }
+
+        void unlink_partial(Slab* slab) {
+            if (!slab->m_listed) {
+                return;
+            }
+            (slab->m_prev != nullptr ? slab->m_prev->m_next : m_partial) = slab->m_next;
+            if (slab->m_next != nullptr) {
+                slab->m_next->m_prev = slab->m_prev;
+            }
+            slab->m_listed = false;
+        }
+    };
+
+}
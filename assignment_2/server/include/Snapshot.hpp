@@ -0,0 +1,243 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Common.hpp"
+
+namespace snapshot {
+
+    static constexpr char MAGIC[8] = {'K', 'V', 'S', 'N', 'A', 'P', '0', '2'};
+
+    /***
+     * The snapshot is a flat file: this header, followed by `m_count` fixed-size records.
+     * It can be mapped and read in place, each loader thread taking a range of records.
+     */
+    struct Header {
+        char m_magic[8];
+        uint32_t m_key_size;
+        uint32_t m_value_size;
+        uint64_t m_count;
+    };
+
+    template <typename Key, typename Value>
+    struct Record {
+        Key m_key;
+        Value m_value;
+        // A wall-clock instant (see `deadline::to_wall`), `deadline::NONE` if it never expires
+        uint64_t m_expires_at;
+    };
+
+    /***
+     * Does the table store the pairs' expirations (its `for_each` visits them too)?
+     */
+    template <typename Table, typename Key, typename Value>
+    concept Expiring = requires (Table& table, Key key, Value value) { table.insert(key, value, uint64_t{}); };
+
+    // How many records are buffered before being written to the file
+    static constexpr std::size_t WRITE_BATCH = 1 << 12;
+
+    /***
+     * Write the table's pairs into the file. The pairs are copied a stripe at a time, so
+     * the writers are never blocked for long. The file is written aside and renamed once
+     * complete, hence a crash never leaves a truncated snapshot behind.
+     * @return How many pairs have been written, or -1 on failure.
+     */
+    template <typename Key, typename Value, typename Table>
+    int64_t write(Table& table, const std::string& path) {
+
+        static_assert(std::is_trivially_destructible_v<Key> && std::is_trivially_destructible_v<Value>,
+                      "the snapshot stores flat keys and values");
+
+        using Rec = Record<Key, Value>;
+
+        auto tmp_path = path + ".tmp";
+        FILE* file = std::fopen(tmp_path.c_str(), "wb");
+        if (file == nullptr) {
+            return -1;
+        }
+
+        // The count is known at the end, the header is rewritten then
+        Header header{};
+        std::memcpy(header.m_magic, MAGIC, sizeof(MAGIC));
+        header.m_key_size = sizeof(Key);
+        header.m_value_size = sizeof(Value);
+
+        bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+
+        std::vector<Rec> batch{};
+        batch.reserve(WRITE_BATCH);
+
+        auto add = [&](const Key& key, const Value& value, uint64_t expires_at) {
+            batch.push_back(Rec{key, value, deadline::to_wall(expires_at)});
+            if (batch.size() == WRITE_BATCH) {
+                ok = ok && std::fwrite(batch.data(), sizeof(Rec), batch.size(), file) == batch.size();
+                header.m_count += batch.size();
+                batch.clear();
+            }
+        };
+
+        if constexpr (Expiring<Table, Key, Value>) {
+            table.for_each(add);
+        }
+        else {
+            table.for_each([&](const Key& key, const Value& value) { add(key, value, deadline::NONE); });
+        }
+
+        ok = ok && std::fwrite(batch.data(), sizeof(Rec), batch.size(), file) == batch.size();
+        header.m_count += batch.size();
+
+        ok = ok && std::fseek(file, 0, SEEK_SET) == 0 && std::fwrite(&header, sizeof(header), 1, file) == 1;
+        ok = ok && std::fflush(file) == 0 && fsync(fileno(file)) == 0;
+        ok = std::fclose(file) == 0 && ok;
+
+        if (!ok || std::rename(tmp_path.c_str(), path.c_str()) == -1) {
+            std::remove(tmp_path.c_str());
+            return -1;
+        }
+
+        return static_cast<int64_t>(header.m_count);
+    }
+
+    /***
+     * A snapshot mapped in memory, read-only.
+     */
+    template <typename Key, typename Value>
+    class Mapped {
+
+    public:
+
+        explicit Mapped(const std::string& path) {
+
+            int fd;
+            if ((fd = ::open(path.c_str(), O_RDONLY)) == -1) {
+                return;
+            }
+
+            struct stat st{};
+            if (fstat(fd, &st) == -1 || static_cast<std::size_t>(st.st_size) < sizeof(Header)) {
+                close(fd);
+                return;
+            }
+
+            void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+
+            if (addr == MAP_FAILED) {
+                return;
+            }
+
+            m_addr = addr;
+            m_size = st.st_size;
+
+            // The whole file is going to be read, by several threads at once
+            madvise(m_addr, m_size, MADV_WILLNEED);
+
+            auto header = reinterpret_cast<const Header*>(m_addr);
+            m_valid = std::memcmp(header->m_magic, MAGIC, sizeof(MAGIC)) == 0 &&
+                      header->m_key_size == sizeof(Key) && header->m_value_size == sizeof(Value) &&
+                      m_size >= sizeof(Header) + header->m_count * sizeof(Record<Key, Value>);
+        }
+
+        ~Mapped() {
+            if (m_addr != nullptr) {
+                munmap(m_addr, m_size);
+            }
+        }
+
+        Mapped(const Mapped&) = delete;
+        Mapped& operator=(const Mapped&) = delete;
+
+        bool is_valid() const { return m_valid; }
+
+        uint64_t count() const { return m_valid ? reinterpret_cast<const Header*>(m_addr)->m_count : 0; }
+
+        const Record<Key, Value>* records() const {
+            return reinterpret_cast<const Record<Key, Value>*>(reinterpret_cast<const char*>(m_addr) + sizeof(Header));
+        }
+
+    private:
+        void* m_addr{nullptr};
+        std::size_t m_size{0};
+        bool m_valid{false};
+    };
+
+    /***
+     * How many pairs the snapshot holds, to presize the table before loading it.
+     */
+    template <typename Key, typename Value>
+    uint64_t count(const std::string& path) {
+        return Mapped<Key, Value>(path).count();
+    }
+
+    /***
+     * Insert the snapshot's pairs into the table, with the given number of threads,
+     * each one loading a contiguous range of records. The pairs expired meanwhile are
+     * skipped; a table without expirations can't load the pairs with one.
+     * @return How many pairs have been loaded, or -1 if the file is missing or invalid
+     * (or it holds expirations the table can't store).
+     */
+    template <typename Key, typename Value, typename Table>
+    int64_t load(Table& table, const std::string& path, unsigned threads) {
+
+        Mapped<Key, Value> mapped{path};
+        if (!mapped.is_valid()) {
+            return -1;
+        }
+
+        uint64_t count = mapped.count();
+        threads = std::max(1u, threads);
+
+        if constexpr (!Expiring<Table, Key, Value>) {
+            auto records = mapped.records();
+            if (std::any_of(records, records + count, [](const Record<Key, Value>& r) { return r.m_expires_at != deadline::NONE; })) {
+                return -1;
+            }
+        }
+
+        std::atomic_uint64_t loaded{0};
+
+        std::vector<std::thread> loaders{};
+        for (unsigned t = 0; t < threads; t++) {
+            loaders.emplace_back([&, t]() {
+                uint64_t begin = count * t / threads;
+                uint64_t end = count * (t + 1) / threads;
+                uint64_t inserted = 0;
+                for (uint64_t i = begin; i < end; i++) {
+                    auto& record = mapped.records()[i];
+                    if constexpr (Expiring<Table, Key, Value>) {
+                        uint64_t expires_at = deadline::from_wall(record.m_expires_at);
+                        if (!deadline::expired(expires_at)) {
+                            table.insert(record.m_key, record.m_value, expires_at);
+                            inserted++;
+                        }
+                    }
+                    else {
+                        table.insert(record.m_key, record.m_value);
+                        inserted++;
+                    }
+                }
+                loaded += inserted;
+            });
+        }
+
+        for (auto& loader: loaders) {
+            loader.join();
+        }
+
+        return static_cast<int64_t>(loaded.load());
+    }
+
+}
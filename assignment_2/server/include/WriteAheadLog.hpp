@@ -0,0 +1,401 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Common.hpp"
+
+/***
+ * Append-only log of the writes applied to the table, to replay them after a restart.
+ *
+ * The workers append their records to their own buffer, tagged with a global sequence
+ * number (LSN). A single log thread collects all the buffers into one large write and
+ * syncs it (group commit): while a batch is being synced the next one keeps filling up,
+ * so the cost of a sync is shared by all the writes of a batch.
+ *
+ * The log is split in segments, `<path>.<n>`: taking a snapshot starts a new segment,
+ * and the older ones are deleted once the snapshot is complete (compaction). Each segment
+ * starts with a header holding the keys' and values' sizes, the records follow.
+ *
+ * @tparam Completion What is handed back once a record is durable (e.g. the request to acknowledge).
+ */
+template <typename Key, typename Value, typename Completion>
+class WriteAheadLog {
+
+public:
+
+    enum class Op : uint32_t {
+        Insert = 1,
+        Remove = 2,
+        // An insert keeping the expiration of the pair (a read-modify-write)
+        Update = 3
+    };
+
+    static constexpr char MAGIC[8] = {'K', 'V', 'W', 'A', 'L', '0', '0', '2'};
+
+    struct Header {
+        char m_magic[8];
+        uint32_t m_key_size;
+        uint32_t m_value_size;
+    };
+
+    struct Record {
+        uint64_t m_lsn;
+        Op m_op;
+        uint32_t m_checksum;
+        Key m_key;
+        Value m_value;
+        // A wall-clock instant (see `deadline::to_wall`), `deadline::NONE` if it never expires
+        uint64_t m_expires_at;
+    };
+
+    static_assert(std::is_trivially_destructible_v<Key> && std::is_trivially_destructible_v<Value>,
+                  "the log stores flat keys and values");
+
+    /***
+     * @param path Prefix of the segments' names.
+     * @param writers How many threads append records, each one gets its own buffer.
+     * @param on_durable Invoked by the log thread with the completions whose records are durable,
+     * it must not block: it returns false if the completion could not be handed over yet, and it
+     * is invoked again with it a while later.
+     */
+    WriteAheadLog(std::string path, std::size_t writers, std::function<bool(Completion&)> on_durable) :
+        m_path{std::move(path)}, m_buffers(std::max<std::size_t>(writers, 1)), m_on_durable{std::move(on_durable)} {}
+
+    ~WriteAheadLog() {
+        if (m_fd != -1) {
+            close(m_fd);
+        }
+    }
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    /***
+     * Read back all the segments, applying their records in LSN order. Records torn by
+     * a crash (a partial write at the end of a segment) are discarded.
+     * @param apply Invoked with each (op, key, value, expiration), the expiration back on the deadline clock.
+     * @return How many records have been applied, or None (and nothing is applied) if a
+     * segment has been written with other key and value types.
+     */
+    template <typename Apply>
+    std::optional<uint64_t> replay(Apply apply) {
+
+        std::vector<Record> records{};
+
+        for (auto segment: segments()) {
+
+            m_segment = std::max(m_segment, segment + 1);
+
+            int fd;
+            if ((fd = ::open(segment_path(segment).c_str(), O_RDONLY)) == -1) {
+                continue;
+            }
+
+            // A header torn by a crash leaves an empty segment
+            Header header{};
+            ssize_t header_size = read(fd, &header, sizeof(Header));
+            if (header_size == sizeof(Header) && !matches(header)) {
+                close(fd);
+                return {};
+            }
+
+            Record record{};
+            while (header_size == sizeof(Header) && read(fd, &record, sizeof(Record)) == sizeof(Record) && checksum(record) == record.m_checksum) {
+                records.push_back(record);
+            }
+
+            close(fd);
+        }
+
+        // The buffers of different workers are written in any order: the LSN gives the order they were applied in
+        std::sort(records.begin(), records.end(), [](const Record& a, const Record& b) { return a.m_lsn < b.m_lsn; });
+
+        for (auto& record: records) {
+            apply(record.m_op, record.m_key, record.m_value, deadline::from_wall(record.m_expires_at));
+        }
+
+        if (!records.empty()) {
+            m_next_lsn = records.back().m_lsn + 1;
+        }
+
+        return records.size();
+    }
+
+    /***
+     * Open a new segment and start the log thread.
+     */
+    void open() {
+        open_segment();
+        m_log_thread = std::thread{[this]() { this->log_loop(); }};
+        m_log_thread.detach();
+    }
+
+    /***
+     * Append a record to the writer's buffer. Writes of the same key must be appended in
+     * the order they are applied to the table.
+     * @param expires_at The pair's expiration, on the deadline clock (`deadline::NONE` if never).
+     * @param completion Handed to `on_durable` once the record is durable, if any.
+     */
+    void append(unsigned writer, Op op, const Key& key, const Value& value, uint64_t expires_at,
+                std::optional<Completion> completion = {}) {
+
+        Buffer& buffer = m_buffers[writer % m_buffers.size()];
+        {
+            std::lock_guard<std::mutex> lock{buffer.m_mutex};
+
+            // The LSN is taken with the buffer locked: once the log thread has locked all
+            // the buffers, every smaller LSN is in the batch (or in a previous one).
+            uint64_t lsn = m_next_lsn++;
+
+            Record record{lsn, op, 0, key, value, deadline::to_wall(expires_at)};
+            record.m_checksum = checksum(record);
+            buffer.m_records.push_back(record);
+
+            if (completion) {
+                buffer.m_completions.emplace_back(lsn, std::move(completion.value()));
+            }
+        }
+
+        notify();
+    }
+
+    /***
+     * Hand the completion to `on_durable` once all the records appended so far are durable.
+     */
+    void sync(unsigned writer, Completion completion) {
+
+        Buffer& buffer = m_buffers[writer % m_buffers.size()];
+        {
+            std::lock_guard<std::mutex> lock{buffer.m_mutex};
+            buffer.m_completions.emplace_back(m_next_lsn - 1, std::move(completion));
+        }
+
+        notify();
+    }
+
+    /***
+     * Start a new segment: the records appended from now on are not in the previous ones.
+     * @return The new segment, to be passed to `compact`.
+     */
+    uint64_t rotate() {
+        std::lock_guard<std::mutex> lock{m_file_mutex};
+        close(m_fd);
+        open_segment();
+        return m_segment - 1;
+    }
+
+    /***
+     * Delete the segments before the given one, once their records are in a snapshot.
+     */
+    void compact(uint64_t segment) {
+        for (auto old: segments()) {
+            if (old < segment) {
+                std::filesystem::remove(segment_path(old));
+            }
+        }
+    }
+
+    /***
+     * The last LSN whose record is durable.
+     */
+    uint64_t durable_lsn() const {
+        return m_durable_lsn;
+    }
+
+private:
+
+    struct alignas(64) Buffer {
+        std::mutex m_mutex{};
+        std::vector<Record> m_records{};
+        std::vector<std::pair<uint64_t, Completion>> m_completions{};
+    };
+
+    std::string m_path;
+    std::vector<Buffer> m_buffers;
+    std::function<bool(Completion&)> m_on_durable;
+
+    std::atomic_uint64_t m_next_lsn{1};
+    std::atomic_uint64_t m_durable_lsn{0};
+
+    // The descriptor of the segment being written, and the number of the next one
+    std::mutex m_file_mutex{};
+    int m_fd{-1};
+    uint64_t m_segment{0};
+
+    std::thread m_log_thread{};
+    std::mutex m_pending_mutex{};
+
+    // How often the completions not handed over are retried, when no record comes meanwhile
+    static constexpr std::chrono::milliseconds RETRY_INTERVAL{1};
+
+    std::condition_variable m_pending_cv{};
+    bool m_pending{false};
+
+    static uint32_t checksum(Record record) {
+        record.m_checksum = 0;
+        uint32_t hash = 2166136261u;
+        for (auto byte: std::as_bytes(std::span{&record, 1})) {
+            hash ^= static_cast<uint8_t>(byte);
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    std::string segment_path(uint64_t segment) const {
+        return m_path + "." + std::to_string(segment);
+    }
+
+    /***
+     * The existing segments, in order.
+     */
+    std::vector<uint64_t> segments() const {
+
+        std::filesystem::path path{m_path};
+        auto directory = path.has_parent_path() ? path.parent_path() : std::filesystem::path{"."};
+        auto prefix = path.filename().string() + ".";
+
+        std::vector<uint64_t> found{};
+        std::error_code error{};
+        for (auto& entry: std::filesystem::directory_iterator{directory, error}) {
+            auto name = entry.path().filename().string();
+            auto suffix = name.substr(std::min(prefix.size(), name.size()));
+            if (name.rfind(prefix, 0) == 0 && !suffix.empty() && std::all_of(suffix.begin(), suffix.end(), ::isdigit)) {
+                found.push_back(std::stoull(suffix));
+            }
+        }
+
+        std::sort(found.begin(), found.end());
+        return found;
+    }
+
+    static bool matches(const Header& header) {
+        return std::memcmp(header.m_magic, MAGIC, sizeof(MAGIC)) == 0 &&
+               header.m_key_size == sizeof(Key) && header.m_value_size == sizeof(Value);
+    }
+
+    void open_segment() {
+        if ((m_fd = ::open(segment_path(m_segment).c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_APPEND, S_IRUSR | S_IWUSR)) == -1) {
+            panic("[server] :: error while opening the write-ahead log");
+        }
+        m_segment++;
+
+        Header header{};
+        std::memcpy(header.m_magic, MAGIC, sizeof(MAGIC));
+        header.m_key_size = sizeof(Key);
+        header.m_value_size = sizeof(Value);
+        if (write(m_fd, &header, sizeof(Header)) != sizeof(Header)) {
+            panic("[server] :: error while writing the write-ahead log's header");
+        }
+    }
+
+    void notify() {
+        {
+            std::lock_guard<std::mutex> lock{m_pending_mutex};
+            m_pending = true;
+        }
+        m_pending_cv.notify_one();
+    }
+
+    [[noreturn]] void log_loop() {
+
+        std::vector<Record> batch{};
+        std::vector<std::pair<uint64_t, Completion>> waiting{};
+        // Durable, but not handed over yet
+        std::vector<Completion> undelivered{};
+
+        while (true) {
+
+            {
+                std::unique_lock<std::mutex> lock{m_pending_mutex};
+                if (undelivered.empty()) {
+                    m_pending_cv.wait(lock, [this]() { return m_pending; });
+                }
+                else {
+                    m_pending_cv.wait_for(lock, RETRY_INTERVAL, [this]() { return m_pending; });
+                }
+                m_pending = false;
+            }
+
+            std::erase_if(undelivered, [this](Completion& completion) { return m_on_durable(completion); });
+
+            // Every LSN below this one is already in a buffer
+            uint64_t watermark = m_next_lsn.load();
+
+            for (auto& buffer: m_buffers) {
+                std::lock_guard<std::mutex> lock{buffer.m_mutex};
+                batch.insert(batch.end(), buffer.m_records.begin(), buffer.m_records.end());
+                buffer.m_records.clear();
+                std::move(buffer.m_completions.begin(), buffer.m_completions.end(), std::back_inserter(waiting));
+                buffer.m_completions.clear();
+            }
+
+            if (!batch.empty()) {
+                std::lock_guard<std::mutex> lock{m_file_mutex};
+                write_all(batch);
+                batch.clear();
+            }
+
+            m_durable_lsn = watermark - 1;
+
+            // Acknowledge whatever is durable now
+            auto durable = std::partition(waiting.begin(), waiting.end(), [watermark](auto& c) { return c.first >= watermark; });
+            for (auto it = durable; it != waiting.end(); it++) {
+                if (!m_on_durable(it->second)) {
+                    undelivered.push_back(std::move(it->second));
+                }
+            }
+            waiting.erase(durable, waiting.end());
+        }
+    }
+
+    /***
+     * Write the batch with as few system calls as possible, then sync it.
+     */
+    void write_all(const std::vector<Record>& batch) {
+
+        auto data = reinterpret_cast<const char*>(batch.data());
+        std::size_t left = batch.size() * sizeof(Record);
+
+        while (left > 0) {
+            ssize_t written = write(m_fd, data, left);
+            if (written == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                panic("[server] :: error while writing the write-ahead log");
+            }
+            data += written;
+            left -= written;
+        }
+
+        #ifdef __APPLE__
+        if (fsync(m_fd) == -1) {
+        #else
+        if (fdatasync(m_fd) == -1) {
+        #endif
+            panic("[server] :: error while syncing the write-ahead log");
+        }
+    }
+
+};
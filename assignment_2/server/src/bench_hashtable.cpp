@@ -0,0 +1,326 @@
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "HashTable.hpp"
+#include "FlatHashTable.hpp"
+#include "Common.hpp"
+
+using Table = HashTable<MyString, MyString>;
+using FlatTable = FlatHashTable<MyString, MyString>;
+using FnvTable = HashTable<MyString, MyString, hashing::Fnv1a>;
+using IntTable = HashTable<uint64_t, uint64_t>;
+using IntFlatTable = FlatHashTable<uint64_t, uint64_t>;
+
+struct Args {
+    size_t keys = 1 << 16;
+    size_t ops_per_thread = 1 << 20;
+    unsigned max_threads = std::thread::hardware_concurrency();
+    unsigned read_percentage = 95;
+};
+
+void print_usage() {
+    std::fprintf(stderr, "usage: ./bench_hashtable [keys=%u] [ops-per-thread=%u] [max-threads=%u] [read-percentage=95]\n",
+                 1 << 16, 1 << 20, std::thread::hardware_concurrency());
+}
+
+std::vector<MyString> make_keys(size_t count) {
+    std::vector<MyString> keys{};
+    keys.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        keys.push_back(MyString::from_string("key-" + std::to_string(i)));
+    }
+    return keys;
+}
+
+/***
+ * The lookups of the table benchmarked, besides its API.
+ */
+struct HashTableBench {
+
+    /***
+     * The lookup under the stripe's reader lock alone, without the epoch guard: only on a
+     * table that never resizes, and whose chains never grow, while it runs.
+     */
+    template <typename T, typename K>
+    static auto get_locked(T& table, const K& key) {
+        return table.get_locked(key);
+    }
+};
+
+/***
+ * Run the mixed workload on the table with the given number of threads.
+ * @return The throughput, in millions of operations per second.
+ */
+template <typename T, typename ReadFn>
+double run(T& table, const std::vector<MyString>& keys, const Args& args, unsigned threads, ReadFn read) {
+
+    std::vector<std::thread> workers{};
+    auto start = std::chrono::steady_clock::now();
+
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            std::mt19937_64 rng{t};
+            std::uniform_int_distribution<size_t> key_dist{0, keys.size() - 1};
+            std::uniform_int_distribution<unsigned> op_dist{0, 99};
+
+            size_t found = 0;
+            for (size_t i = 0; i < args.ops_per_thread; i++) {
+                const MyString& key = keys[key_dist(rng)];
+                if (op_dist(rng) < args.read_percentage) {
+                    found += read(table, key).has_value();
+                }
+                else {
+                    table.insert(key, key);
+                }
+            }
+
+            // Keep the reads alive
+            if (found == static_cast<size_t>(-1)) {
+                std::fprintf(stderr, "unreachable\n");
+            }
+        });
+    }
+
+    for (auto& th: workers) {
+        th.join();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return static_cast<double>(args.ops_per_thread * threads) / elapsed.count() / 1e6;
+}
+
+/***
+ * Insert all the keys into a table starting from the minimum capacity, so it keeps growing,
+ * and report the per-insert latency percentiles.
+ */
+void insert_latency(const std::vector<MyString>& keys, unsigned threads) {
+
+    Table table{};
+    std::vector<std::vector<uint64_t>> latencies(threads);
+    std::vector<std::thread> workers{};
+
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            auto& samples = latencies[t];
+            for (size_t i = t; i < keys.size(); i += threads) {
+                auto start = std::chrono::steady_clock::now();
+                table.insert(keys[i], keys[i]);
+                samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+            }
+        });
+    }
+
+    for (auto& th: workers) {
+        th.join();
+    }
+
+    std::vector<uint64_t> all{};
+    for (auto& samples: latencies) {
+        all.insert(all.end(), samples.begin(), samples.end());
+    }
+    std::sort(all.begin(), all.end());
+
+    auto percentile = [&all](double p) { return all[static_cast<size_t>(p * static_cast<double>(all.size() - 1))]; };
+
+    std::fprintf(stdout, "[bench][info] :: insert latency of a growing table, %u threads (ns)\n", threads);
+    std::fprintf(stdout, "capacity,p50,p99,p999,max\n");
+    std::fprintf(stdout, "%lu,%lu,%lu,%lu,%lu\n", table.capacity(), percentile(0.5), percentile(0.99), percentile(0.999), all.back());
+}
+
+template <typename Fn>
+double measure(size_t ops, Fn fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return static_cast<double>(ops) / elapsed.count() / 1e6;
+}
+
+/***
+ * Single-threaded inserts into a presized table, then lookups of present and missing keys.
+ */
+template <typename T, typename K>
+void single_thread(const char* name, const std::vector<K>& keys, const std::vector<K>& missing) {
+
+    T table(keys.size());
+    size_t found = 0;
+
+    double insert = measure(keys.size(), [&]() {
+        for (auto& key: keys) table.insert(key, key);
+    });
+    double hit = measure(keys.size(), [&]() {
+        for (auto& key: keys) found += table.get(key).has_value();
+    });
+    double miss = measure(missing.size(), [&]() {
+        for (auto& key: missing) found += table.get(key).has_value();
+    });
+
+    std::fprintf(stdout, "%s,%.2f,%.2f,%.2f,%lu\n", name, insert, hit, miss, found);
+}
+
+/***
+ * Compare the chained `HashTable` with the open-addressing `FlatHashTable`.
+ */
+void compare_tables(const std::vector<MyString>& keys, const Args& args) {
+
+    std::vector<MyString> missing{};
+    missing.reserve(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        missing.push_back(MyString::from_string("missing-" + std::to_string(i)));
+    }
+
+    std::fprintf(stdout, "[bench][info] :: single thread, chained vs flat table (Mops/s)\n");
+    std::fprintf(stdout, "table,insert,lookup_hit,lookup_miss,found\n");
+    single_thread<Table>("chained", keys, missing);
+    single_thread<FlatTable>("flat", keys, missing);
+
+    FlatTable flat(args.keys);
+    for (auto& key: keys) {
+        flat.insert(key, key);
+    }
+    Table chained(args.keys);
+    for (auto& key: keys) {
+        chained.insert(key, key);
+    }
+
+    std::fprintf(stdout, "[bench][info] :: mixed workload, chained vs flat table (Mops/s)\n");
+    std::fprintf(stdout, "threads,chained,flat\n");
+
+    for (unsigned threads = 1; threads <= args.max_threads; threads *= 2) {
+        double c = run(chained, keys, args, threads, [](Table& t, const MyString& k) { return t.get(k); });
+        double f = run(flat, keys, args, threads, [](FlatTable& t, const MyString& k) { return t.get(k); });
+        std::fprintf(stdout, "%u,%.2f,%.2f\n", threads, c, f);
+    }
+}
+
+/***
+ * Throughput of the hash function and distribution of the keys among the slots of a
+ * table with as many slots as keys (rounded up to a power of two).
+ */
+template <typename Hash>
+void hash_quality(const char* name, const std::vector<MyString>& keys) {
+
+    size_t sink = 0;
+    constexpr size_t ROUNDS = 16;
+    double speed = measure(keys.size() * ROUNDS, [&]() {
+        for (size_t r = 0; r < ROUNDS; r++) {
+            for (auto& key: keys) sink += Hash{}(key);
+        }
+    });
+
+    size_t capacity = std::bit_ceil(keys.size());
+    std::vector<size_t> slots(capacity);
+    for (auto& key: keys) {
+        slots[Hash{}(key) & (capacity - 1)]++;
+    }
+
+    // Chi-squared statistic over the degrees of freedom: about 1 for a uniform hash
+    double expected = static_cast<double>(keys.size()) / static_cast<double>(capacity);
+    double chi_squared = 0;
+    for (auto count: slots) {
+        chi_squared += (static_cast<double>(count) - expected) * (static_cast<double>(count) - expected) / expected;
+    }
+
+    auto empty = std::count(slots.begin(), slots.end(), 0);
+    auto longest = *std::max_element(slots.begin(), slots.end());
+
+    std::fprintf(stdout, "%s,%.2f,%.3f,%.3f,%lu,%lu\n", name, speed, static_cast<double>(empty) / static_cast<double>(capacity),
+                 chi_squared / static_cast<double>(capacity - 1), longest, sink & 1);
+}
+
+/***
+ * Compare the hash policies: the byte-wise FNV-1a and the word-at-a-time hash.
+ */
+void compare_hashes(const std::vector<MyString>& keys) {
+
+    std::vector<MyString> missing{};
+    for (size_t i = 0; i < keys.size(); i++) {
+        missing.push_back(MyString::from_string("missing-" + std::to_string(i)));
+    }
+
+    std::fprintf(stdout, "[bench][info] :: hash policies (Mhashes/s, distribution over %lu slots)\n", std::bit_ceil(keys.size()));
+    std::fprintf(stdout, "hash,speed,empty_slots,chi_squared,longest_chain,sink\n");
+    hash_quality<hashing::Fnv1a>("fnv1a", keys);
+    hash_quality<hashing::WordAtATime>("word_at_a_time", keys);
+
+    std::fprintf(stdout, "[bench][info] :: single thread, chained table with each hash policy (Mops/s)\n");
+    std::fprintf(stdout, "table,insert,lookup_hit,lookup_miss,found\n");
+    single_thread<FnvTable>("fnv1a", keys, missing);
+    single_thread<Table>("word_at_a_time", keys, missing);
+}
+
+/***
+ * Compare 32-byte string keys and values with 64-bit integer ones, on both tables.
+ */
+void compare_key_types(const std::vector<MyString>& keys) {
+
+    std::vector<MyString> missing{};
+    std::vector<uint64_t> int_keys{};
+    std::vector<uint64_t> int_missing{};
+    for (size_t i = 0; i < keys.size(); i++) {
+        missing.push_back(MyString::from_string("missing-" + std::to_string(i)));
+        int_keys.push_back(i);
+        int_missing.push_back(keys.size() + i);
+    }
+
+    std::fprintf(stdout, "[bench][info] :: single thread, string vs integer keys (Mops/s)\n");
+    std::fprintf(stdout, "table,insert,lookup_hit,lookup_miss,found\n");
+    single_thread<Table>("chained_string", keys, missing);
+    single_thread<IntTable>("chained_u64", int_keys, int_missing);
+    single_thread<FlatTable>("flat_string", keys, missing);
+    single_thread<IntFlatTable>("flat_u64", int_keys, int_missing);
+}
+
+int main(int argc, char** argv) {
+
+    if (argc > 5) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    Args args;
+    try {
+        if (argc > 1) args.keys = std::stoul(argv[1]);
+        if (argc > 2) args.ops_per_thread = std::stoul(argv[2]);
+        if (argc > 3) args.max_threads = std::stoul(argv[3]);
+        if (argc > 4) args.read_percentage = std::stoul(argv[4]);
+    }
+    catch (const std::invalid_argument &e) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    auto keys = make_keys(args.keys);
+
+    // Sized so the keys never trigger a rehash: the reader-locked baseline takes no epoch guard,
+    // and the writes below only overwrite the keys, their chains don't grow
+    Table table(args.keys * 2);
+    for (auto& key: keys) {
+        table.insert(key, key);
+    }
+
+    std::fprintf(stdout, "[bench][info] :: %lu keys, %lu ops per thread, %u%% reads (Mops/s)\n",
+                 args.keys, args.ops_per_thread, args.read_percentage);
+    std::fprintf(stdout, "threads,optimistic,shared_lock\n");
+
+    for (unsigned threads = 1; threads <= args.max_threads; threads *= 2) {
+        double optimistic = run(table, keys, args, threads, [](Table& t, const MyString& k) { return t.get(k); });
+        double shared = run(table, keys, args, threads, [](Table& t, const MyString& k) { return HashTableBench::get_locked(t, k); });
+        std::fprintf(stdout, "%u,%.2f,%.2f\n", threads, optimistic, shared);
+    }
+
+    insert_latency(keys, args.max_threads);
+
+    compare_tables(keys, args);
+
+    compare_hashes(keys);
+
+    compare_key_types(keys);
+
+    return EXIT_SUCCESS;
+}
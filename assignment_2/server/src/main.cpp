@@ -1,52 +1,241 @@
+#include <algorithm>
+#include <cctype>
+#include <optional>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 #include "Server.hpp"
 
+#if defined(ASSIGNMENT_1_ALLOCATOR)
+#include "CustomAllocator.h"
+#endif
+
 struct Args {
     size_t hash_table_size = 0;
     unsigned workers = std::thread::hardware_concurrency();
+    std::string snapshot_path{};
+    std::chrono::seconds snapshot_interval{60};
+    std::string wal_path{};
+    std::string load_path{};
+    size_t max_memory = 0;
+    // "string" (32-byte strings) or "u64" (64-bit integers)
+    std::string key_type{"string"};
+    std::string value_type{"string"};
+    // The CPUs the workers are pinned to, none if empty
+    std::vector<int> worker_cpus{};
+    bool busy_poll = false;
+    // The bounds of the elastic pool, which is enabled if any of them (or the target) is given
+    unsigned min_workers = 0;
+    unsigned max_workers = 0;
+    std::chrono::microseconds target_wait{0};
 };
 
 void print_usage() {
-	std::fprintf(stderr, "usage: ./server <hash-table-size> <workers> [default=%u]\n", std::thread::hardware_concurrency());
+	std::fprintf(stderr, "usage: ./server <hash-table-size> <workers> [default=%u] [--snapshot <file>] [--snapshot-interval <seconds>] [--wal <file>] [--load <file>] [--max-memory <bytes>[K|M|G]] [--key-type string|u64] [--value-type string|u64] [--cpus <list>|all] [--worker-mode blocking|busy-poll] [--min-workers <n>=1] [--max-workers <n>=%u] [--target-wait <us>]\n",
+                 std::thread::hardware_concurrency(), std::thread::hardware_concurrency());
 }
 
 Args parse_arguments(int argc, char *const *argv) {
 
     Args args;
+    std::vector<std::string> positional{};
+
+    for (int i = 1; i < argc; i++) {
+
+        std::string arg{argv[i]};
+
+        if (arg.rfind("--", 0) != 0) {
+            positional.push_back(arg);
+            continue;
+        }
+
+        if (i + 1 == argc) {
+            print_usage();
+            std::exit(EXIT_FAILURE);
+        }
+
+        std::string value{argv[++i]};
+
+        if (arg == "--snapshot") {
+            args.snapshot_path = value;
+        }
+        else if (arg == "--max-memory") {
+            try {
+                size_t suffix = 0;
+                args.max_memory = std::stoul(value, &suffix, 10);
+                switch (suffix < value.size() ? std::toupper(value[suffix]) : 0) {
+                    case 'G': args.max_memory <<= 10; [[fallthrough]];
+                    case 'M': args.max_memory <<= 10; [[fallthrough]];
+                    case 'K': args.max_memory <<= 10; break;
+                    default: break;
+                }
+            }
+            catch (const std::invalid_argument &e) {
+                LOG_ERROR("Cannot parse the memory limit correctly.\n");
+                std::exit(EXIT_FAILURE);
+            }
+        }
+        else if (arg == "--key-type" || arg == "--value-type") {
+            if (value != "string" && value != "u64") {
+                print_usage();
+                std::exit(EXIT_FAILURE);
+            }
+            (arg == "--key-type" ? args.key_type : args.value_type) = value;
+        }
+        else if (arg == "--cpus") {
+            auto cpus = value == "all" ? std::optional{affinity::allowed_cpus()} : affinity::parse_cpu_list(value);
+            if (!cpus) {
+                LOG_ERROR("Cannot parse the CPU list correctly (e.g. 0-3,8).\n");
+                std::exit(EXIT_FAILURE);
+            }
+            args.worker_cpus = cpus.value();
+        }
+        else if (arg == "--worker-mode") {
+            if (value != "blocking" && value != "busy-poll") {
+                print_usage();
+                std::exit(EXIT_FAILURE);
+            }
+            args.busy_poll = value == "busy-poll";
+        }
+        else if (arg == "--min-workers" || arg == "--max-workers" || arg == "--target-wait") {
+            try {
+                auto parsed = std::stoul(value, nullptr, 10);
+                if (arg == "--target-wait") {
+                    args.target_wait = std::chrono::microseconds{parsed};
+                }
+                else {
+                    (arg == "--min-workers" ? args.min_workers : args.max_workers) = std::max<unsigned>(parsed, 1);
+                }
+            }
+            catch (const std::logic_error &e) {
+                LOG_ERROR("Cannot parse %s correctly.\n", arg.c_str());
+                std::exit(EXIT_FAILURE);
+            }
+        }
+        else if (arg == "--load") {
+            args.load_path = value;
+        }
+        else if (arg == "--wal") {
+            args.wal_path = value;
+        }
+        else if (arg == "--snapshot-interval") {
+            try {
+                args.snapshot_interval = std::chrono::seconds{std::stoul(value, nullptr, 10)};
+            }
+            catch (const std::logic_error &e) {
+                LOG_ERROR("Cannot parse the snapshot interval correctly.\n");
+                std::exit(EXIT_FAILURE);
+            }
+            if (args.snapshot_interval.count() == 0) {
+                LOG_ERROR("The snapshot interval must be at least a second.\n");
+                std::exit(EXIT_FAILURE);
+            }
+        }
+        else {
+            print_usage();
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    if (positional.empty() || positional.size() > 2) {
+        print_usage();
+        std::exit(EXIT_FAILURE);
+    }
 
     try {
-        args.hash_table_size = std::stoul(argv[1], nullptr, 10);
+        args.hash_table_size = std::stoul(positional[0], nullptr, 10);
     }
     catch (const std::invalid_argument &e) {
-        fprintf(stderr, "[error] :: Cannot parse HashTable's size correctly.\n");
+        LOG_ERROR("Cannot parse HashTable's size correctly.\n");
         std::exit(EXIT_FAILURE);
     }
 
-    if (argc == 3) {
+    if (positional.size() == 2) {
         try {
-            args.workers = std::stoul(argv[2], nullptr, 10);
+            args.workers = std::stoul(positional[1], nullptr, 10);
         }
         catch (const std::invalid_argument &e) {
-            fprintf(stderr, "[error] :: Cannot parse workers number correctly, using default.\n");
+            LOG_ERROR("Cannot parse workers number correctly, using default.\n");
         }
     }
 
     return args;
 }
 
-int main(int argc, char **argv) {
+template <typename Key, typename Value, typename Table>
+int run(const Args& args) {
 
-	if (argc < 2 || argc > 3) {
-		print_usage();
-		return EXIT_FAILURE;
-	}
+    auto capacity = args.hash_table_size;
+    bool restore = !args.snapshot_path.empty() && access(args.snapshot_path.c_str(), F_OK) == 0;
 
-    auto args = parse_arguments(argc, argv);
+    // Presize the table for the snapshot and the seed file, so loading them never rehashes
+    uint64_t expected = 0;
+    if (restore) {
+        expected += snapshot::count<Key, Value>(args.snapshot_path);
+    }
+    if (!args.load_path.empty()) {
+        expected += bulk_load::count(args.load_path);
+    }
+    capacity = std::max<size_t>(capacity, expected * 4 / 3);
+
+    Server<Key, Value, Table> server(args.workers, capacity);
+
+    if (args.min_workers != 0 || args.max_workers != 0 || args.target_wait.count() != 0) {
+        unsigned max_workers = args.max_workers != 0 ? args.max_workers : std::max(args.workers, std::thread::hardware_concurrency());
+        server.enable_elastic_pool(args.min_workers != 0 ? args.min_workers : 1, max_workers, args.target_wait);
+    }
+
+    // Starting empty would overwrite the snapshot at the first interval
+    if (restore && !server.restore_snapshot(args.snapshot_path)) {
+        return EXIT_FAILURE;
+    }
+    if (!args.load_path.empty() && !server.bulk_load(args.load_path)) {
+        return EXIT_FAILURE;
+    }
+    if (args.max_memory != 0 && !server.enable_cache(args.max_memory)) {
+        LOG_ERROR("This table does not support a memory limit.\n");
+        return EXIT_FAILURE;
+    }
+    if (!args.wal_path.empty() && !server.enable_wal(args.wal_path)) {
+        return EXIT_FAILURE;
+    }
+    if (!args.snapshot_path.empty()) {
+        server.enable_snapshots(args.snapshot_path, args.snapshot_interval);
+    }
+    if (!args.worker_cpus.empty()) {
+        server.pin_workers(args.worker_cpus);
+    }
+    if (args.busy_poll) {
+        server.enable_busy_poll();
+    }
 
-    Server<MyString, MyString> server(args.workers, args.hash_table_size);
     server.start();
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+
+template <typename Key, typename Value>
+int run(const Args& args) {
+#if defined(FLAT_HASH_TABLE)
+    return run<Key, Value, FlatHashTable<Key, Value>>(args);
+#elif defined(SHM_HASH_TABLE)
+    return run<Key, Value, ShmHashTable<Key, Value>>(args);
+#elif defined(ASSIGNMENT_1_ALLOCATOR)
+    // The chains' slabs (and the longer chains) come from the allocator of assignment 1
+    return run<Key, Value, HashTable<Key, Value, hashing::Default<Key>, CustomAllocator<std::byte>>>(args);
+#else
+    return run<Key, Value, HashTable<Key, Value>>(args);
+#endif
+}
+
+int main(int argc, char **argv) {
+
+    auto args = parse_arguments(argc, argv);
+
+    // Integer keys and values are stored, hashed and compared as plain words
+    if (args.key_type == "u64") {
+        return args.value_type == "u64" ? run<uint64_t, uint64_t>(args) : run<uint64_t, MyString>(args);
+    }
+    return args.value_type == "u64" ? run<MyString, uint64_t>(args) : run<MyString, MyString>(args);
+}
@@ -0,0 +1,257 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "Common.hpp"
+#include "Stats.hpp"
+
+struct Args {
+    // The utilization of the workers is measured over this interval
+    unsigned interval_ms = 1000;
+    bool json = false;
+    size_t top_stripes = 10;
+};
+
+void print_usage() {
+    std::fprintf(stderr, "usage: ./server-stats [--interval <ms>=1000] [--top-stripes <n>=10] [--json]\n");
+}
+
+/***
+ * Map the server's statistics read-only: this process can't write into them, and reading
+ * them does not take any lock the server's threads could wait for.
+ */
+const stats::Segment* map_segment() {
+
+    int fd = shm_open(stats::SHM_FILENAME, O_RDONLY, 0);
+    if (fd == -1) {
+        std::fprintf(stderr, "[stats][error] :: cannot open %s, is the server running?\n", stats::SHM_FILENAME);
+        return nullptr;
+    }
+
+    void* addr = mmap(nullptr, sizeof(stats::Segment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        std::fprintf(stderr, "[stats][error] :: cannot map %s\n", stats::SHM_FILENAME);
+        return nullptr;
+    }
+
+    auto segment = static_cast<const stats::Segment*>(addr);
+    if (segment->m_magic != stats::MAGIC) {
+        std::fprintf(stderr, "[stats][error] :: %s has been written by a different version of the server\n", stats::SHM_FILENAME);
+        return nullptr;
+    }
+
+    return segment;
+}
+
+struct WorkerSample {
+    uint64_t m_requests;
+    uint64_t m_hits;
+    uint64_t m_misses;
+    uint64_t m_busy_ns;
+};
+
+std::vector<WorkerSample> sample_workers(const stats::Segment& segment) {
+    std::vector<WorkerSample> samples{};
+    for (size_t i = 0; i < std::min<size_t>(segment.m_workers, stats::MAX_WORKERS); i++) {
+        auto& worker = segment.m_worker_stats[i];
+        samples.push_back({
+            worker.m_requests.load(std::memory_order_relaxed),
+            worker.m_hits.load(std::memory_order_relaxed),
+            worker.m_misses.load(std::memory_order_relaxed),
+            worker.m_busy_ns.load(std::memory_order_relaxed)
+        });
+    }
+    return samples;
+}
+
+struct Stripe {
+    size_t m_index;
+    uint64_t m_waits;
+    uint64_t m_wait_ns;
+};
+
+/***
+ * The stripes whose lock has been waited for the longest.
+ */
+std::vector<Stripe> top_stripes(const stats::Segment& segment, size_t count) {
+    std::vector<Stripe> stripes{};
+    for (size_t i = 0; i < std::min<size_t>(segment.m_stripes.load(std::memory_order_relaxed), stats::MAX_STRIPES); i++) {
+        auto& stripe = segment.m_stripe_stats[i];
+        if (uint64_t waits = stripe.m_waits.load(std::memory_order_relaxed)) {
+            stripes.push_back({i, waits, stripe.m_wait_ns.load(std::memory_order_relaxed)});
+        }
+    }
+    std::sort(stripes.begin(), stripes.end(), [](const Stripe& a, const Stripe& b) { return a.m_wait_ns > b.m_wait_ns; });
+    stripes.resize(std::min(stripes.size(), count));
+    return stripes;
+}
+
+double seconds(uint64_t ns) {
+    return static_cast<double>(ns) / 1e9;
+}
+
+void print_text(const stats::Segment& segment, const std::vector<WorkerSample>& before, const std::vector<WorkerSample>& after,
+                uint64_t elapsed_ns, const std::vector<Stripe>& stripes) {
+
+    uint64_t now = deadline::now();
+
+    std::fprintf(stdout, "[stats][info] :: up %.1fs, %lu workers, published %.1fs ago\n",
+                 seconds(now - segment.m_started_at.load()), segment.m_workers, seconds(now - segment.m_updated_at.load()));
+
+    std::fprintf(stdout, "[stats][info] :: table\n");
+    std::fprintf(stdout, "pairs,capacity,memory_usage,lock_waits,lock_wait_ns\n");
+    std::fprintf(stdout, "%lu,%lu,%lu,%lu,%lu\n", segment.m_pairs.load(), segment.m_capacity.load(), segment.m_memory_usage.load(),
+                 segment.m_lock_waits.load(), segment.m_lock_wait_ns.load());
+
+    std::fprintf(stdout, "[stats][info] :: latencies (ns)\n");
+    std::fprintf(stdout, "op,stage,count,mean,p50,p90,p99,p999,max\n");
+    for (size_t op = 0; op < stats::OPS.size(); op++) {
+        std::pair<const char*, const stats::Histogram*> stages[] = {
+            {"queue_wait", &segment.m_ops[op].m_queue_wait},
+            {"service", &segment.m_ops[op].m_service},
+            {"end_to_end", &segment.m_ops[op].m_end_to_end}
+        };
+        for (auto [stage, histogram]: stages) {
+            auto s = histogram->summarize();
+            if (s.m_count != 0) {
+                std::fprintf(stdout, "%s,%s,%lu,%.0f,%lu,%lu,%lu,%lu,%lu\n", stats::OPS[op], stage, s.m_count, s.m_mean,
+                             s.m_p50, s.m_p90, s.m_p99, s.m_p999, s.m_max);
+            }
+        }
+    }
+
+    auto depth = segment.m_queue_depth.summarize();
+    std::fprintf(stdout, "[stats][info] :: queue depth behind each dequeued request\n");
+    std::fprintf(stdout, "count,mean,p50,p90,p99,p999,max\n");
+    std::fprintf(stdout, "%lu,%.2f,%lu,%lu,%lu,%lu,%lu\n", depth.m_count, depth.m_mean, depth.m_p50, depth.m_p90, depth.m_p99,
+                 depth.m_p999, depth.m_max);
+
+    std::fprintf(stdout, "[stats][info] :: responses dropped on a full client queue: %lu\n", segment.m_dropped_responses.load());
+
+    std::fprintf(stdout, "[stats][info] :: worker pool\n");
+    std::fprintf(stdout, "active,min,max,grows_on_depth,grows_on_wait,shrinks\n");
+    std::fprintf(stdout, "%lu,%lu,%lu,%lu,%lu,%lu\n", segment.m_active_workers.load(), segment.m_min_workers, segment.m_workers,
+                 segment.m_grows_on_depth.load(), segment.m_grows_on_wait.load(), segment.m_shrinks.load());
+
+    std::fprintf(stdout, "[stats][info] :: workers, utilization over the last %.1fs\n", seconds(elapsed_ns));
+    std::fprintf(stdout, "worker,requests,hits,misses,utilization\n");
+    for (size_t i = 0; i < after.size(); i++) {
+        double utilization = static_cast<double>(after[i].m_busy_ns - before[i].m_busy_ns) / static_cast<double>(elapsed_ns);
+        std::fprintf(stdout, "%lu,%lu,%lu,%lu,%.3f\n", i, after[i].m_requests, after[i].m_hits, after[i].m_misses, utilization);
+    }
+
+    std::fprintf(stdout, "[stats][info] :: most waited stripes\n");
+    std::fprintf(stdout, "stripe,waits,wait_ns\n");
+    for (auto& stripe: stripes) {
+        std::fprintf(stdout, "%lu,%lu,%lu\n", stripe.m_index, stripe.m_waits, stripe.m_wait_ns);
+    }
+}
+
+void print_summary_json(const stats::Histogram::Summary& s) {
+    std::fprintf(stdout, "{\"count\":%lu,\"mean\":%.2f,\"p50\":%lu,\"p90\":%lu,\"p99\":%lu,\"p999\":%lu,\"max\":%lu}",
+                 s.m_count, s.m_mean, s.m_p50, s.m_p90, s.m_p99, s.m_p999, s.m_max);
+}
+
+void print_json(const stats::Segment& segment, const std::vector<WorkerSample>& before, const std::vector<WorkerSample>& after,
+                uint64_t elapsed_ns, const std::vector<Stripe>& stripes) {
+
+    uint64_t now = deadline::now();
+
+    std::fprintf(stdout, "{\"uptime_ns\":%lu,\"published_ns_ago\":%lu,\"workers\":%lu,\"interval_ns\":%lu,",
+                 now - segment.m_started_at.load(), now - segment.m_updated_at.load(), segment.m_workers, elapsed_ns);
+
+    std::fprintf(stdout, "\"table\":{\"pairs\":%lu,\"capacity\":%lu,\"memory_usage\":%lu,\"lock_waits\":%lu,\"lock_wait_ns\":%lu},",
+                 segment.m_pairs.load(), segment.m_capacity.load(), segment.m_memory_usage.load(),
+                 segment.m_lock_waits.load(), segment.m_lock_wait_ns.load());
+
+    std::fprintf(stdout, "\"ops\":{");
+    for (size_t op = 0; op < stats::OPS.size(); op++) {
+        std::fprintf(stdout, "%s\"%s\":{\"queue_wait\":", op == 0 ? "" : ",", stats::OPS[op]);
+        print_summary_json(segment.m_ops[op].m_queue_wait.summarize());
+        std::fprintf(stdout, ",\"service\":");
+        print_summary_json(segment.m_ops[op].m_service.summarize());
+        std::fprintf(stdout, ",\"end_to_end\":");
+        print_summary_json(segment.m_ops[op].m_end_to_end.summarize());
+        std::fprintf(stdout, "}");
+    }
+    std::fprintf(stdout, "},\"queue_depth\":");
+    print_summary_json(segment.m_queue_depth.summarize());
+
+    std::fprintf(stdout, ",\"dropped_responses\":%lu", segment.m_dropped_responses.load());
+
+    std::fprintf(stdout, ",\"pool\":{\"active\":%lu,\"min\":%lu,\"max\":%lu,\"grows_on_depth\":%lu,\"grows_on_wait\":%lu,\"shrinks\":%lu}",
+                 segment.m_active_workers.load(), segment.m_min_workers, segment.m_workers,
+                 segment.m_grows_on_depth.load(), segment.m_grows_on_wait.load(), segment.m_shrinks.load());
+
+    std::fprintf(stdout, ",\"workers_stats\":[");
+    for (size_t i = 0; i < after.size(); i++) {
+        double utilization = static_cast<double>(after[i].m_busy_ns - before[i].m_busy_ns) / static_cast<double>(elapsed_ns);
+        std::fprintf(stdout, "%s{\"requests\":%lu,\"hits\":%lu,\"misses\":%lu,\"utilization\":%.4f}", i == 0 ? "" : ",",
+                     after[i].m_requests, after[i].m_hits, after[i].m_misses, utilization);
+    }
+
+    std::fprintf(stdout, "],\"top_stripes\":[");
+    for (size_t i = 0; i < stripes.size(); i++) {
+        std::fprintf(stdout, "%s{\"stripe\":%lu,\"waits\":%lu,\"wait_ns\":%lu}", i == 0 ? "" : ",",
+                     stripes[i].m_index, stripes[i].m_waits, stripes[i].m_wait_ns);
+    }
+    std::fprintf(stdout, "]}\n");
+}
+
+int main(int argc, char** argv) {
+
+    Args args;
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--json") {
+                args.json = true;
+            }
+            else if (arg == "--interval" && i + 1 < argc) {
+                args.interval_ms = std::stoul(argv[++i]);
+            }
+            else if (arg == "--top-stripes" && i + 1 < argc) {
+                args.top_stripes = std::stoul(argv[++i]);
+            }
+            else {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    catch (const std::logic_error& e) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    const stats::Segment* segment = map_segment();
+    if (segment == nullptr) {
+        return EXIT_FAILURE;
+    }
+
+    uint64_t start = deadline::now();
+    auto before = sample_workers(*segment);
+    std::this_thread::sleep_for(std::chrono::milliseconds(std::max(args.interval_ms, 1u)));
+    auto after = sample_workers(*segment);
+    uint64_t elapsed_ns = deadline::now() - start;
+
+    auto stripes = top_stripes(*segment, args.top_stripes);
+
+    if (args.json) {
+        print_json(*segment, before, after, elapsed_ns, stripes);
+    }
+    else {
+        print_text(*segment, before, after, elapsed_ns, stripes);
+    }
+
+    return EXIT_SUCCESS;
+}